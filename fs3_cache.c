@@ -5,65 +5,476 @@
 //                   FS3 filesystem interface.
 //
 //  Author         : Christopher Kurcz
-//  Last Modified  : 12/9/2021
+//  Last Modified  : 12/10/2021
 //
 
 // Includes
 #include <string.h>
 #include <cmpsc311_log.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 // Project Includes
 #include <fs3_cache.h>
+#include <fs3_cache_policy.h>
+#include <fs3_cache_profile.h>
+#include <fs3_cache_l2.h>
+#include <fs3_driver.h>
+
+// Defines
+#define FS3_CACHE_HASH_MULTIPLIER 2654435761u // spreads sector keys across the hash buckets
+#define FS3_CACHE_MIN_SHARD_LINES 64 // fewest lines in a shard, so small caches are not split up
+#define FS3_CACHE_HUGE_PAGE_SIZE (2 * 1024 * 1024) // size of a huge page the arena is rounded up to
+#define FS3_CACHE_TUNE_CHECK 64      // driver operations between checks by the auto-tuner
+#define FS3_CACHE_TUNE_MIN_GETS 1024 // fewest gets the auto-tuner judges the cache over
+#define FS3_CACHE_TUNE_MIN_STEP 64   // fewest lines the auto-tuner grows the cache by
+#define FS3_CACHE_TUNE_THRESHOLD 20  // gets in every 1000 the next step of lines must turn into hits to grow
 
 // Static Global Variables
-    FS3CacheEntry* FS3Cache;
-    uint16_t cacheSize;
+    FS3CacheLines FS3Cache;
+    uint32_t cacheSize;
     int cacheCreated = 0;
-    uint64_t cacheUseCount;
 
-    // cache metrics
-    int cacheInserts;
-    int cacheHits;
-    int cacheGets;
-    int cacheMisses;
+    int cacheResizes = 0;
+    FS3CacheMetrics cacheRetiredMetrics; // metrics of the shards replaced by resizes
+
+    // one mapping holding the data, metadata and hash indexes of every cache line
+    void *cacheArena = NULL;
+    size_t cacheArenaSize = 0;
+    size_t cacheArenaUsed = 0;
+    int cacheArenaHuge = 0;  // 1 if the arena is backed by huge pages
+
+    // locks of the shards, kept for as long as the cache is created so a resize can change the
+    //  shards under them, each on its own processor cache lines so they do not share one
+    FS3CacheShardLock cacheShardLocks[FS3_CACHE_MAX_SHARDS];
+
+    // shards of the cache, each with its own lock, lines, hash index and replacement policy state
+    FS3CacheShard *cacheShards;
+    int cacheShardCount;     // number of shards (a power of 2)
+    int cacheShardBits;      // number of hash bits picking the shard
+    FS3CachePolicy *cachePolicy;
+
+    // copy of the last sector each thread got with fs3_get_cache
+    __thread uint8_t cacheGetCopy[FS3_SECTOR_SIZE];
+
+    // auto-tuner
+    uint32_t tuneStep;       // lines the cache grows by, and sectors remembered after eviction to judge it
+    int tuneCalls;           // driver operations since the tuner last checked
+    int tuneLastGets;        // gets when the tuner last judged the cache
+    int tuneLastGhostHits;   // misses on remembered sectors when the tuner last judged the cache
+
+    // background flusher
+    pthread_t flusherThread;
+    int flusherRunning = 0;
+    pthread_mutex_t flusherLock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t flusherCond = PTHREAD_COND_INITIALIZER;
+
+// Global Variables
+    int fs3_cache_mode = FS3_CACHE_WRITE_THROUGH;
+    int fs3_cache_policy = FS3_CACHE_POLICY_LRU;
+    uint32_t fs3_cache_flush_interval = 0;
+    uint16_t fs3_cache_shards = FS3_DEFAULT_CACHE_SHARDS;
+    uint64_t fs3_cache_budget = 0;
+    int fs3_cache_autotune = 0;
 
 // Implementation
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_init_cache
-// Description  : Initialize the cache with a fixed number of cache lines
+// Description  : Initialize the cache with a number of cache lines, which can
+//                be changed later by fs3_resize_cache
 //
 // Inputs       : cachelines - the number of cache lines to include in cache
 // Outputs      : 0 if successful, -1 if failure
 
-int fs3_init_cache(uint16_t cachelines) {
-    // checks to make sure the number of cache lines is valid
-    if(cachelines < 0){
-        return(-1);
-    }
+int fs3_init_cache(uint32_t cachelines) {
     // checks that the cache is not created
     if(cacheCreated == 1){
         return(-1);
     }
+    // checks that the replacement policy exists
+    if((fs3_cache_policy < 0) || (fs3_cache_policy >= FS3_CACHE_POLICY_COUNT)){
+        return(-1);
+    }
 
-    // sets global variables
-    cacheSize = cachelines;
+    // the cache never needs more lines than the memory budget allows, or than there are sectors on the disk
+    if(cachelines > fs3_cache_max_lines()){
+        cachelines = fs3_cache_max_lines();
+    }
+
+    // sets up the shard locks
+    int i;
+    for(i = 0; i < FS3_CACHE_MAX_SHARDS; i++){
+        pthread_mutex_init(&cacheShardLocks[i].lock, NULL);
+        pthread_cond_init(&cacheShardLocks[i].unpinned, NULL);
+    }
+
+    // sets global variables, leaving the cache marked as not created until every part is built
+    cachePolicy = &fs3_cache_policies[fs3_cache_policy];
+    cacheShards = NULL;
+    cacheArena = NULL;
+    cacheResizes = 0;
+    memset(&cacheRetiredMetrics, 0, sizeof(FS3CacheMetrics));
+    tuneCalls = 0;
+    tuneLastGets = 0;
+    tuneLastGhostHits = 0;
+
+    // builds the cache lines and shards
+    if(fs3_build_cache(cachelines) == -1){
+        fs3_free_cache();
+        return(-1);
+    }
+
+    // starts recording the sectors used, if profiling was asked for
+    if((fs3_cache_profile_rate > 0) && (fs3_init_cache_profile() == -1)){
+        fs3_free_cache();
+        return(-1);
+    }
+
+    // maps the second level cache file, if one was asked for
+    if((fs3_cache_l2_path != NULL) && (fs3_open_cache_l2() == -1)){
+        fs3_free_cache();
+        return(-1);
+    }
+
+    // starts the background flusher if the cache is holding writes and one was asked for
+    if((fs3_cache_mode == FS3_CACHE_WRITE_BACK) && (fs3_cache_flush_interval > 0)){
+        flusherRunning = 1;
+        if(pthread_create(&flusherThread, NULL, fs3_cache_flusher, NULL) != 0){
+            flusherRunning = 0;
+            fs3_free_cache();
+            return(-1);
+        }
+    }
+
+    // updates the global cache created variable
     cacheCreated = 1;
-    cacheUseCount = 0;
 
-    // allocates memory for the cache
-    FS3Cache = malloc(cacheSize * sizeof(FS3CacheEntry));
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_build_cache
+// Description  : Maps an arena for a number of empty cache lines, and splits
+//                them between the shards
+//
+// Inputs       : cachelines - the number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_build_cache(uint32_t cachelines) {
+    int i;
+    cacheSize = cachelines;
+    tuneStep = fs3_cache_tune_step(cacheSize);
+
+    // works out the number of shards, and the hash bits picking one, which lockers check again
+    //  once they hold a shard's lock
+    cacheShardCount = fs3_cache_shard_count(cacheSize);
+    int shardBits = 0;
+    while((1 << shardBits) < cacheShardCount){
+        shardBits = shardBits + 1;
+    }
+    __atomic_store_n(&cacheShardBits, shardBits, __ATOMIC_RELEASE);
+
+    // maps the arena every line is carved from
+    if(fs3_map_cache_arena(fs3_cache_arena_size(cacheSize, cacheShardCount)) == -1){
+        return(-1);
+    }
+
+    // carves the sector data and each field of the lines' metadata from the arena as its own array,
+    //  so scanning one field of every line only touches that field
+    FS3Cache.data = fs3_carve_cache_arena((size_t)cacheSize * FS3_SECTOR_SIZE);
+    FS3Cache.track = fs3_carve_cache_arena(cacheSize * sizeof(int32_t));
+    FS3Cache.sector = fs3_carve_cache_arena(cacheSize * sizeof(int32_t));
+    FS3Cache.hashNext = fs3_carve_cache_arena(cacheSize * sizeof(int32_t));
+    FS3Cache.dirty = fs3_carve_cache_arena(cacheSize * sizeof(uint8_t));
+    FS3Cache.prefetched = fs3_carve_cache_arena(cacheSize * sizeof(uint8_t));
+    FS3Cache.insertTime = fs3_carve_cache_arena(cacheSize * sizeof(uint64_t));
+    FS3Cache.lastUse = fs3_carve_cache_arena(cacheSize * sizeof(uint32_t));
+
+    // every line starts empty (the arena is zeroed, so clean and not read ahead)
+    for(i = 0; i < (int)cacheSize; i++){
+        FS3Cache.track[i] = -1;
+        FS3Cache.sector[i] = -1;
+        FS3Cache.hashNext[i] = -1;
+    }
+
+    // allocates the shards, each on its own processor cache lines so their locks do not share one
+    if(posix_memalign((void **)&cacheShards, FS3_CACHE_SHARD_ALIGNMENT, cacheShardCount * sizeof(FS3CacheShard)) != 0){
+        cacheShards = NULL;
+        return(-1);
+    }
+    memset(cacheShards, 0, cacheShardCount * sizeof(FS3CacheShard));
+
+    // gives each shard an equal slice of the cache lines
+    int firstLine = 0;
+    for(i = 0; i < cacheShardCount; i++){
+        int lineCount = (cacheSize / cacheShardCount) + ((i < (int)(cacheSize % cacheShardCount)) ? 1 : 0);
+        if(fs3_init_cache_shard(&cacheShards[i], i, firstLine, lineCount) == -1){
+            return(-1);
+        }
+        firstLine = firstLine + lineCount;
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_init_cache_shard
+// Description  : Sets up a shard of the cache over a slice of the cache lines,
+//                with every line empty
+//
+// Inputs       : shard - the shard
+//                shardIndex - index of the shard, and of its lock
+//                firstLine - index in the cache of the shard's first line
+//                lineCount - number of lines in the shard
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_init_cache_shard(FS3CacheShard *shard, int shardIndex, int firstLine, int lineCount) {
+    shard->lock = &cacheShardLocks[shardIndex].lock;
+    shard->unpinned = &cacheShardLocks[shardIndex].unpinned;
+    shard->lines.data = FS3_CACHE_LINE_DATA(FS3Cache, firstLine);
+    shard->lines.track = &FS3Cache.track[firstLine];
+    shard->lines.sector = &FS3Cache.sector[firstLine];
+    shard->lines.hashNext = &FS3Cache.hashNext[firstLine];
+    shard->lines.dirty = &FS3Cache.dirty[firstLine];
+    shard->lines.prefetched = &FS3Cache.prefetched[firstLine];
+    shard->lines.insertTime = &FS3Cache.insertTime[firstLine];
+    shard->lines.lastUse = &FS3Cache.lastUse[firstLine];
+    shard->firstLine = firstLine;
+    shard->lineCount = lineCount;
+
+    // carves the hash index from the arena
+    uint32_t hashSize = fs3_cache_hash_size(lineCount);
+    shard->hashMask = hashSize - 1;
+    shard->hashTable = fs3_carve_cache_arena(hashSize * sizeof(int));
+    int i;
+    for(i = 0; i < (int)hashSize; i++){
+        shard->hashTable[i] = -1;
+    }
+
+    // puts every line on the empty line stack, lowest on top
+    shard->freeLines = fs3_carve_cache_arena(lineCount * sizeof(int));
+    for(i = 0; i < lineCount; i++){
+        shard->freeLines[i] = lineCount - 1 - i;
+    }
+    shard->freeCount = lineCount;
+
+    // no line is pinned to begin with, and the replacement policy is told not to evict pinned lines
+    shard->linePins = fs3_carve_cache_arena(lineCount * sizeof(int));
+    shard->policy.pins = shard->linePins;
+
+    // the auto-tuner remembers the shard's share of the sectors evicted most recently
+    if((fs3_cache_autotune == 1) && (lineCount > 0)){
+        int ghostCapacity = tuneStep / cacheShardCount;
+        if(fs3_ghost_init(&shard->tuneGhosts, (ghostCapacity > 0) ? ghostCapacity : 1) == -1){
+            return(-1);
+        }
+    }
+
+    // sets up the replacement policy for the shard's lines
+    return(cachePolicy->init(&shard->policy, lineCount));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_shard_count
+// Description  : Works out the number of shards for a number of cache lines, a
+//                power of 2 no more than asked for, halved until each shard has
+//                enough lines for its replacement policy to work well
+//
+// Inputs       : cachelines - the number of cache lines
+// Outputs      : the number of shards
+
+int fs3_cache_shard_count(uint32_t cachelines) {
+    int shardCount = 1;
+    while((shardCount * 2 <= fs3_cache_shards) && (shardCount * 2 <= FS3_CACHE_MAX_SHARDS) &&
+        (cachelines / (shardCount * 2) >= FS3_CACHE_MIN_SHARD_LINES)){
+        shardCount = shardCount * 2;
+    }
+
+    return(shardCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_hash_size
+// Description  : Works out the number of hash buckets for a shard, a power of 2
+//                at least twice the number of lines, so chains stay short
+//
+// Inputs       : lineCount - number of lines in the shard
+// Outputs      : the number of hash buckets
+
+uint32_t fs3_cache_hash_size(int lineCount) {
+    uint32_t hashSize = 1;
+    while(hashSize < (2 * (uint32_t)lineCount)){
+        hashSize = hashSize * 2;
+    }
+
+    return(hashSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_arena_size
+// Description  : Works out the bytes of arena needed for the cache lines, their
+//                metadata and each shard's hash index, free line stack and pins
+//
+// Inputs       : cachelines - the number of cache lines
+//                shardCount - the number of shards they are split between
+// Outputs      : the size of the arena in bytes
+
+size_t fs3_cache_arena_size(uint32_t cachelines, int shardCount) {
+    // every array is rounded up to an alignment boundary when carved
+    size_t align = FS3_CACHE_SHARD_ALIGNMENT - 1;
+    size_t size = ((size_t)cachelines * FS3_SECTOR_SIZE + align) & ~align;
+    size = size + 3 * ((cachelines * sizeof(int32_t) + align) & ~align);
+    size = size + 2 * ((cachelines * sizeof(uint8_t) + align) & ~align);
+    size = size + ((cachelines * sizeof(uint64_t) + align) & ~align);
+    size = size + ((cachelines * sizeof(uint32_t) + align) & ~align);
+
+    int i;
+    for(i = 0; i < shardCount; i++){
+        int lineCount = (cachelines / shardCount) + ((i < (int)(cachelines % shardCount)) ? 1 : 0);
+        size = size + ((fs3_cache_hash_size(lineCount) * sizeof(int) + align) & ~align);
+        size = size + 2 * ((lineCount * sizeof(int) + align) & ~align);
+    }
+
+    return(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_budget_lines
+// Description  : Works out the most cache lines whose arena fits in a memory budget
+//
+// Inputs       : budget - the memory budget in bytes
+// Outputs      : the number of cache lines, at most one for every sector on the disk
+
+uint32_t fs3_cache_budget_lines(uint64_t budget) {
+    // searches for the largest number of lines that fits, as the arena grows with the lines
+    uint32_t low = 0;
+    uint32_t high = FS3_CACHE_MAX_LINES;
+    while(low < high){
+        uint32_t middle = low + ((high - low + 1) / 2);
+        if(fs3_cache_arena_size(middle, fs3_cache_shard_count(middle)) <= budget){
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return(low);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_max_lines
+// Description  : Works out the most lines the cache may have, the lines fitting
+//                in the memory budget if there is one, otherwise one for every
+//                sector on the disk
+//
+// Inputs       : none
+// Outputs      : the most cache lines
+
+uint32_t fs3_cache_max_lines(void) {
+    if(fs3_cache_budget > 0){
+        return(fs3_cache_budget_lines(fs3_cache_budget));
+    }
+
+    return(FS3_CACHE_MAX_LINES);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_map_cache_arena
+// Description  : Maps the zeroed arena the cache is carved from, backed by huge
+//                pages if the system has them reserved, otherwise asking for
+//                transparent huge pages
+//
+// Inputs       : size - the bytes needed
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_map_cache_arena(size_t size) {
+    // rounds the arena up to whole huge pages
+    cacheArenaSize = (size + FS3_CACHE_HUGE_PAGE_SIZE - 1) & ~((size_t)FS3_CACHE_HUGE_PAGE_SIZE - 1);
+    cacheArenaUsed = 0;
+    cacheArenaHuge = 0;
+
+#ifdef MAP_HUGETLB
+    // tries the reserved huge pages first
+    cacheArena = mmap(NULL, cacheArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(cacheArena != MAP_FAILED){
+        cacheArenaHuge = 1;
+        return(0);
+    }
+#endif
+
+    // otherwise maps normal pages, and lets the kernel back them with huge pages if it can
+    cacheArena = mmap(NULL, cacheArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(cacheArena == MAP_FAILED){
+        cacheArena = NULL;
+        return(-1);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(cacheArena, cacheArenaSize, MADV_HUGEPAGE);
+#endif
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_carve_cache_arena
+// Description  : Takes the next aligned array from the arena
+//
+// Inputs       : size - the bytes needed
+// Outputs      : pointer to the zeroed array
+
+void * fs3_carve_cache_arena(size_t size) {
+    void *array = (uint8_t *)cacheArena + cacheArenaUsed;
+    cacheArenaUsed = cacheArenaUsed + ((size + FS3_CACHE_SHARD_ALIGNMENT - 1) & ~((size_t)FS3_CACHE_SHARD_ALIGNMENT - 1));
+
+    return(array);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_unmap_cache_arena
+// Description  : Unmaps an arena, freeing every cache line carved from it at once
+//
+// Inputs       : arena - the arena
+//                size - the size it was mapped with
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_unmap_cache_arena(void *arena, size_t size) {
+    if(arena == NULL){
+        return(0);
+    }
+
+    return(munmap(arena, size));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_close_cache_shards
+// Description  : Frees the replacement policy of each shard, and the shards
+//
+// Inputs       : shards - the shards
+//                shardCount - the number of shards
+// Outputs      : 0 if successful
 
-    // for each cache line, memory is allocated for the cache line's data, and variables are initialized
+int fs3_close_cache_shards(FS3CacheShard *shards, int shardCount) {
     int i;
-    for(i = 0; i < cacheSize; i++){
-        FS3Cache[i].dataBuffer = malloc(FS3_SECTOR_SIZE);
-        FS3Cache[i].track = -1;
-        FS3Cache[i].sector = -1;
-        FS3Cache[i].countUsed = 0;
+    for(i = 0; i < shardCount; i++){
+        cachePolicy->close(&shards[i].policy);
+        fs3_ghost_close(&shards[i].tuneGhosts);
     }
+    free(shards);
 
     return(0);
 }
@@ -82,14 +493,18 @@ int fs3_close_cache(void)  {
         return(-1);
     }
 
-    // for each cache line, the cache line's data's memory is deallocated
-    int i;
-    for(i = 0; i < cacheSize; i++){
-        free(FS3Cache[i].dataBuffer);
+    // stops the background flusher and waits for it to finish
+    pthread_mutex_lock(&flusherLock);
+    int flusherStarted = flusherRunning;
+    flusherRunning = 0;
+    pthread_cond_signal(&flusherCond);
+    pthread_mutex_unlock(&flusherLock);
+    if(flusherStarted == 1){
+        pthread_join(flusherThread, NULL);
     }
 
-    // deallocates the memory of the cache
-    free(FS3Cache);
+    // frees every part of the cache
+    fs3_free_cache();
 
     // updates the global cache created variable
     cacheCreated = 0;
@@ -99,122 +514,1622 @@ int fs3_close_cache(void)  {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : fs3_put_cache
-// Description  : Put an element in the cache
+// Function     : fs3_free_cache
+// Description  : Frees whichever parts of the cache have been built, for a
+//                close or for an init that failed part way
 //
-// Inputs       : trk - the track number of the sector to put in cache
-//                sct - the sector number of the sector to put in cache
-// Outputs      : 0 if inserted, -1 if not inserted
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
-int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+int fs3_free_cache(void) {
+    // frees the shards, and unmaps the arena holding every line and hash index
+    if(cacheShards != NULL){
+        fs3_close_cache_shards(cacheShards, cacheShardCount);
+        cacheShards = NULL;
+    }
+    fs3_unmap_cache_arena(cacheArena, cacheArenaSize);
+    cacheArena = NULL;
+
+    // stops recording the sectors used
+    fs3_close_cache_profile();
+
+    // writes the second level cache back to its file
+    if(fs3_cache_l2_open() == 1){
+        fs3_close_cache_l2();
+    }
+
+    // frees the shard locks
+    int i;
+    for(i = 0; i < FS3_CACHE_MAX_SHARDS; i++){
+        pthread_cond_destroy(&cacheShardLocks[i].unpinned);
+        pthread_mutex_destroy(&cacheShardLocks[i].lock);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_resize_cache
+// Description  : Grows or shrinks the cache while it is in use, holding the disk
+//                so lines evicted by a shrink can be written back
+//
+// Inputs       : cachelines - the new number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_resize_cache(uint32_t cachelines) {
+    pthread_mutex_lock(&diskLock);
+    int resizeResult = fs3_resize_cache_locked(cachelines);
+    pthread_mutex_unlock(&diskLock);
+
+    return(resizeResult);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_resize_cache_locked
+// Description  : Grows or shrinks the cache, with the disk lock held. Every line
+//                is moved into a new arena, keeping the most recently used lines
+//                the replacement policy orders them by, and writing back the dirty
+//                lines that no longer fit. The old cache is kept, unchanged, until
+//                every dirty line has been written back or moved, and is gone back
+//                to if anything fails
+//
+// Inputs       : cachelines - the new number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_resize_cache_locked(uint32_t cachelines) {
     // checks that the cache is created
     if(cacheCreated == 0){
         return(-1);
     }
+    if(cachelines > fs3_cache_max_lines()){
+        cachelines = fs3_cache_max_lines();
+    }
+    if(cachelines == cacheSize){
+        return(0);
+    }
 
-    // loops through the cache, finding the index of either the least recently used cache line
-    //  or the cache line with the correct track and sector
-    int i;
-    int minUsed = FS3Cache[0].countUsed;
-    int putIndex = 0;
-    for(i = 0; i < cacheSize; i++){
-        // if a match is found, it saves the index and stops the loop
-        if((FS3Cache[i].track==trk)&&(FS3Cache[i].sector==sct)){
-            putIndex = i;
-            break;
-        } else {
-            // if a less recently used cache line is found, it saves the index
-            if(FS3Cache[i].countUsed < minUsed){
-                minUsed = FS3Cache[i].countUsed;
-                putIndex = i;
+    // stops every other use of the cache, and waits for readers to release the lines they hold
+    fs3_lock_all_cache_shards();
+    int i, k;
+    for(i = 0; i < cacheShardCount; i++){
+        FS3CacheShard *shard = &cacheShards[i];
+        for(k = 0; k < shard->lineCount; k++){
+            while(shard->linePins[k] > 0){
+                pthread_cond_wait(shard->unpinned, shard->lock);
+            }
+        }
+    }
+
+    // allocates the eviction order of every old shard before anything is changed, each shard's
+    //  starting at its first line (and one more for each shard before it)
+    FS3CacheSnapshot old;
+    fs3_save_cache(&old);
+    int *orders = malloc((old.size + old.shardCount) * sizeof(int));
+    if(orders == NULL){
+        fs3_unlock_all_cache_shards();
+        return(-1);
+    }
+    int orderCounts[FS3_CACHE_MAX_SHARDS] = {0};
+    int drops[FS3_CACHE_MAX_SHARDS] = {0};
+
+    // builds the new cache, going back to the old one if it cannot be built
+    if(fs3_build_cache(cachelines) == -1){
+        fs3_restore_cache(&old);
+        free(orders);
+        fs3_unlock_all_cache_shards();
+        return(-1);
+    }
+
+    // asks the replacement policy of each old shard for its lines, the next to be evicted first
+    int oldUsed = 0;
+    for(i = 0; i < old.shardCount; i++){
+        FS3CacheShard *oldShard = &old.shards[i];
+        int *order = &orders[oldShard->firstLine + i];
+        int used = oldShard->lineCount - oldShard->freeCount;
+        int line;
+        while((orderCounts[i] < used) && ((line = cachePolicy->evict(&oldShard->policy)) != -1)){
+            if(oldShard->lines.track[line] != -1){
+                order[orderCounts[i]] = line;
+                orderCounts[i] = orderCounts[i] + 1;
+            }
+        }
+        oldUsed = oldUsed + used;
+    }
+
+    // works out how many lines no longer fit, taken evenly from the old shards, and sends the
+    //  dirty ones to the disk, stopping if any write fails with every line still in the old cache
+    int dropTotal = (oldUsed > (int)cachelines) ? (oldUsed - (int)cachelines) : 0;
+    int resizeResult = 0;
+    for(i = 0; (i < old.shardCount) && (resizeResult == 0); i++){
+        FS3CacheShard *oldShard = &old.shards[i];
+        int *order = &orders[oldShard->firstLine + i];
+        int used = oldShard->lineCount - oldShard->freeCount;
+        drops[i] = (oldUsed > 0) ? (int)(((int64_t)used * dropTotal) / oldUsed) : 0;
+        for(k = 0; (k < drops[i]) && (k < orderCounts[i]); k++){
+            if(fs3_drop_cache_line(oldShard, order[k]) == -1){
+                resizeResult = -1;
+                break;
+            }
+        }
+    }
+    if(complete_disk_requests() == -1){
+        resizeResult = -1;
+    }
+
+    // moves the rest over from oldest to newest, then waits for the lines the new cache could
+    //  not keep to be written back
+    for(i = 0; (i < old.shardCount) && (resizeResult == 0); i++){
+        FS3CacheShard *oldShard = &old.shards[i];
+        int *order = &orders[oldShard->firstLine + i];
+        for(k = drops[i]; k < orderCounts[i]; k++){
+            if(fs3_move_cache_line(oldShard, order[k]) == -1){
+                resizeResult = -1;
+                break;
             }
         }
     }
+    if(complete_disk_requests() == -1){
+        resizeResult = -1;
+    }
 
-    // updates global variables
-    cacheInserts = cacheInserts + 1;
-    cacheUseCount = cacheUseCount + 1;
+    // if anything failed, frees the new cache and goes back to the old one, its lines given back
+    //  to the replacement policy in the order it gave them up
+    if(resizeResult == -1){
+        fs3_restore_cache(&old);
+        for(i = 0; i < old.shardCount; i++){
+            fs3_restore_cache_policy(&old.shards[i], &orders[old.shards[i].firstLine + i], orderCounts[i]);
+        }
+        free(orders);
+        fs3_unlock_all_cache_shards();
+        return(-1);
+    }
 
-    // updates the data in the cache line
-    FS3Cache[putIndex].track = trk;
-    FS3Cache[putIndex].sector = sct;
-    FS3Cache[putIndex].countUsed = cacheUseCount;
-    memcpy(FS3Cache[putIndex].dataBuffer, buf, FS3_SECTOR_SIZE);
+    // counts the old cache's metrics and dropped lines in with the retired ones, and frees it
+    for(i = 0; i < old.shardCount; i++){
+        FS3CacheShard *oldShard = &old.shards[i];
+        int *order = &orders[oldShard->firstLine + i];
+        fs3_add_cache_metrics(&cacheRetiredMetrics, &oldShard->metrics);
+        for(k = 0; (k < drops[i]) && (k < orderCounts[i]); k++){
+            fs3_retire_cache_line(oldShard, order[k]);
+        }
+    }
+    free(orders);
+    fs3_close_cache_shards(old.shards, old.shardCount);
+    fs3_unmap_cache_arena(old.arena, old.arenaSize);
+    cacheResizes = cacheResizes + 1;
 
+    fs3_unlock_all_cache_shards();
     return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : fs3_get_cache
-// Description  : Get an element from the cache (
+// Function     : fs3_save_cache
+// Description  : Keeps the cache in use, so it can be gone back to if a resize
+//                fails
 //
-// Inputs       : trk - the track number of the sector to find
-//                sct - the sector number of the sector to find
-// Outputs      : returns NULL if not found or failed, pointer to buffer if found
+// Inputs       : snapshot - where the cache is kept
+// Outputs      : 0 if successful
 
-void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)  {
-    // checks that the cache is created
-    if(cacheCreated == 0){
-        return(NULL);
-    }
+int fs3_save_cache(FS3CacheSnapshot *snapshot) {
+    snapshot->lines = FS3Cache;
+    snapshot->shards = cacheShards;
+    snapshot->shardCount = cacheShardCount;
+    snapshot->size = cacheSize;
+    snapshot->arena = cacheArena;
+    snapshot->arenaSize = cacheArenaSize;
+    snapshot->arenaHuge = cacheArenaHuge;
 
-    // loops through the entire cache, trying to find the cache line with the given track and sector
-    int i;
-    int getIndex = -1;
-    for(i = 0; i < cacheSize; i++){
-        // if a match is found, it saves the index and stops the loop
-        if((FS3Cache[i].track==trk)&&(FS3Cache[i].sector==sct)){
-            getIndex = i;
-            break;
-        }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_restore_cache
+// Description  : Goes back to a cache kept by fs3_save_cache, freeing whatever
+//                part of a new cache was built since
+//
+// Inputs       : snapshot - the cache kept
+// Outputs      : 0 if successful
+
+int fs3_restore_cache(const FS3CacheSnapshot *snapshot) {
+    // frees the new shards and arena, if they were made
+    if((cacheShards != NULL) && (cacheShards != snapshot->shards)){
+        fs3_close_cache_shards(cacheShards, cacheShardCount);
+    }
+    if((cacheArena != NULL) && (cacheArena != snapshot->arena)){
+        fs3_unmap_cache_arena(cacheArena, cacheArenaSize);
     }
 
-    // updates global variables
-    cacheGets = cacheGets + 1;
+    FS3Cache = snapshot->lines;
+    cacheShards = snapshot->shards;
+    cacheShardCount = snapshot->shardCount;
+    cacheSize = snapshot->size;
+    cacheArena = snapshot->arena;
+    cacheArenaSize = snapshot->arenaSize;
+    cacheArenaHuge = snapshot->arenaHuge;
+    int shardBits = 0;
+    while((1 << shardBits) < cacheShardCount){
+        shardBits = shardBits + 1;
+    }
+    __atomic_store_n(&cacheShardBits, shardBits, __ATOMIC_RELEASE);
+    tuneStep = fs3_cache_tune_step(cacheSize);
 
-    if(getIndex == -1){
-        // if no match was found, updates the number of cache misses
-        cacheMisses = cacheMisses + 1;
-        return(NULL);
-    } else {
-        // if a match was found, updates global variables
-        cacheHits = cacheHits + 1;
-        cacheUseCount = cacheUseCount + 1;
+    return(0);
+}
 
-        // updates the data in the cache line
-        FS3Cache[getIndex].countUsed = cacheUseCount;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_restore_cache_policy
+// Description  : Gives the lines a shard's replacement policy gave up for a
+//                resize back to it, the next to be evicted first, so they are
+//                evicted in the same order again
+//
+// Inputs       : shard - the shard
+//                order - the lines, in the order the policy gave them up
+//                orderCount - number of lines
+// Outputs      : 0 if successful
 
-        // returns the pointer to the data
-        return(FS3Cache[getIndex].dataBuffer);
+int fs3_restore_cache_policy(FS3CacheShard *shard, int *order, int orderCount) {
+    int k;
+    for(k = 0; k < orderCount; k++){
+        cachePolicy->place(&shard->policy, shard->lines.track[order[k]], shard->lines.sector[order[k]], order[k]);
     }
+
+    return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : fs3_log_cache_metrics
-// Description  : Log the metrics for the cache 
+// Function     : fs3_drop_cache_line
+// Description  : Sends the write of a line of an old shard that does not fit in
+//                a shrunk cache to the disk, if it is dirty. The line is left as
+//                it is, dirty, so the old cache still holds it if the write fails
 //
-// Inputs       : none
+// Inputs       : oldShard - the shard of the line
+//                line - index of the line in the shard
 // Outputs      : 0 if successful, -1 if failure
 
-int fs3_log_cache_metrics(void) {
-    cacheGets = cacheGets + 1;
-    // checks to make sure there will not be a divide by zero when calculating the cache hit ratio
-    if (cacheGets == 0){
-        return(-1);
+int fs3_drop_cache_line(FS3CacheShard *oldShard, int line) {
+    FS3CacheLines *lines = &oldShard->lines;
+    if(lines->dirty[line] == 1){
+        return(queue_disk_sector_write(lines->track[line], lines->sector[line], FS3_CACHE_LINE_DATA(*lines, line)));
     }
 
-    // calculates the cache hit ratio
-    float cacheHitRatio = ((float)cacheHits) / ((float)cacheGets) * 100;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_retire_cache_line
+// Description  : Counts a line dropped by a shrink in the retired metrics, once
+//                the resize has kept the new cache
+//
+// Inputs       : oldShard - the shard of the line
+//                line - index of the line in the shard
+// Outputs      : 0 if successful
+
+int fs3_retire_cache_line(FS3CacheShard *oldShard, int line) {
+    FS3CacheLines *lines = &oldShard->lines;
+
+    fs3_count_cache_eviction(&cacheRetiredMetrics, lines, line);
+    if(lines->dirty[line] == 1){
+        cacheRetiredMetrics.writeBacks = cacheRetiredMetrics.writeBacks + 1;
+    }
+    if(lines->prefetched[line] == 1){
+        cacheRetiredMetrics.prefetchWasted = cacheRetiredMetrics.prefetchWasted + 1;
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_move_cache_line
+// Description  : Moves a line of an old shard into the resized cache, keeping
+//                whether it is dirty or read ahead. Every shard lock must be held.
+//                The old line is left as it is, so the old cache can be gone back
+//                to until the writes sent for the move are waited for
+//
+// Inputs       : oldShard - the shard of the line
+//                line - index of the line in the shard
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_move_cache_line(FS3CacheShard *oldShard, int line) {
+    FS3CacheLines *lines = &oldShard->lines;
+    FS3TrackIndex trk = lines->track[line];
+    FS3SectorIndex sct = lines->sector[line];
+    FS3CacheShard *shard = fs3_cache_shard(trk, sct);
+
+    // puts the sector in its new shard, which may evict a line moved earlier if the sectors
+    //  hash unevenly, and sends it to the disk if the new shard keeps it out. The resize already
+    //  holds the disk, so a dirty line evicted is written back at once
+    int found;
+    FS3CacheVictim victim;
+    fs3_begin_cache_eviction(&victim, 0);
+    int putIndex = fs3_find_put_line(shard, trk, sct, &found, &victim);
+    if(fs3_end_cache_eviction(&victim) == -1){
+        return(-1);
+    }
+    if(putIndex == -1){
+        if(lines->dirty[line] == 1){
+            return(queue_disk_sector_write(trk, sct, FS3_CACHE_LINE_DATA(*lines, line)));
+        }
+        return(0);
+    }
+
+    memcpy(FS3_CACHE_LINE_DATA(shard->lines, putIndex), FS3_CACHE_LINE_DATA(*lines, line), FS3_SECTOR_SIZE);
+    shard->lines.dirty[putIndex] = lines->dirty[line];
+    shard->lines.prefetched[putIndex] = lines->prefetched[line];
+    shard->lines.insertTime[putIndex] = lines->insertTime[line];
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_tune_step
+// Description  : Works out how many lines the auto-tuner grows a cache by
+//
+// Inputs       : cachelines - the number of cache lines
+// Outputs      : the number of lines, a quarter of the cache
+
+uint32_t fs3_cache_tune_step(uint32_t cachelines) {
+    uint32_t step = cachelines / 4;
+    if(step < FS3_CACHE_TUNE_MIN_STEP){
+        step = FS3_CACHE_TUNE_MIN_STEP;
+    }
+
+    return(step);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_tune_cache
+// Description  : Called by the driver after each operation, with the disk lock
+//                held. Every so often it judges how many of the gets would have
+//                been hits with another step of lines, from the misses on sectors
+//                among the last step evicted, and grows the cache while enough would
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_tune_cache(void) {
+    // checks that the cache is created and being tuned
+    if((cacheCreated == 0) || (fs3_cache_autotune == 0)){
+        return(0);
+    }
+
+    // only checks every so many operations
+    tuneCalls = tuneCalls + 1;
+    if(tuneCalls < FS3_CACHE_TUNE_CHECK){
+        return(0);
+    }
+    tuneCalls = 0;
+
+    // waits until the cache has been used enough to judge it
+    FS3CacheMetrics metrics;
+    fs3_sum_cache_metrics(&metrics);
+    int gets = metrics.gets - tuneLastGets;
+    int ghostHits = metrics.ghostHits - tuneLastGhostHits;
+    int judgeGets = ((int)cacheSize > FS3_CACHE_TUNE_MIN_GETS) ? (int)cacheSize : FS3_CACHE_TUNE_MIN_GETS;
+    if(gets < judgeGets){
+        return(0);
+    }
+    tuneLastGets = metrics.gets;
+    tuneLastGhostHits = metrics.ghostHits;
+
+    // grows the cache by a step if enough gets would have been hits in it
+    uint32_t maxLines = fs3_cache_max_lines();
+    if((cacheSize < maxLines) && (((int64_t)ghostHits * 1000) >= ((int64_t)gets * FS3_CACHE_TUNE_THRESHOLD))){
+        uint32_t newSize = cacheSize + tuneStep;
+        if(newSize > maxLines){
+            newSize = maxLines;
+        }
+        logMessage(FS3DriverLLevel, "Cache tuner growing the cache from %u to %u lines (%d of %d gets were misses on the last %u evicted)",
+            cacheSize, newSize, ghostHits, gets, tuneStep);
+        return(fs3_resize_cache_locked(newSize));
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_put_cache
+// Description  : Put an element in the cache
+//
+// Inputs       : trk - the track number of the sector to put in cache
+//                sct - the sector number of the sector to put in cache
+// Outputs      : 0 if inserted, -1 if not inserted
+
+int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+    // checks that the cache is created
+    if(cacheCreated == 0){
+        return(-1);
+    }
+    fs3_profile_cache_reference(trk, sct, 0);
+
+    // any copy in the second level cache may be older than the data being put
+    fs3_invalidate_cache_l2(trk, sct);
+
+    FS3CacheVictim victim;
+    fs3_begin_cache_eviction(&victim, 1);
+    FS3CacheShard *shard = fs3_lock_cache_shard(trk, sct);
+    if(shard->lineCount == 0){
+        fs3_unlock_cache_shard(shard);
+        fs3_end_cache_eviction(&victim);
+        return(-1);
+    }
+
+    // waits for any reader of the sector's old data to finish with it
+    fs3_wait_cache_sector_unpinned(shard, trk, sct);
+
+    // finds the cache line to put the sector in
+    int found;
+    int putIndex = fs3_find_put_line(shard, trk, sct, &found, &victim);
+    if(putIndex == -1){
+        fs3_unlock_cache_shard(shard);
+        fs3_end_cache_eviction(&victim);
+        return(-1);
+    }
+
+    // updates the shard's metrics
+    shard->metrics.inserts = shard->metrics.inserts + 1;
+
+    // a sector written before its read ahead copy was used no longer counts as read ahead
+    shard->lines.prefetched[putIndex] = 0;
+
+    // a dirty copy of the same sector is newer than the disk, so it is kept, otherwise
+    //  the data in the cache line is updated
+    if((found == 0) || (shard->lines.dirty[putIndex] == 0)){
+        shard->lines.dirty[putIndex] = 0;
+        memcpy(FS3_CACHE_LINE_DATA(shard->lines, putIndex), buf, FS3_SECTOR_SIZE);
+    }
+
+    fs3_unlock_cache_shard(shard);
+    return(fs3_end_cache_eviction(&victim));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_put_cache_dirty
+// Description  : Put a written element in the cache to be flushed to the disk
+//                later, only done when the cache is in write-back mode
+//
+// Inputs       : trk - the track number of the sector to put in cache
+//                sct - the sector number of the sector to put in cache
+//                buf - the new data of the sector
+// Outputs      : 0 if the cache is holding the write, -1 if it must be written through
+
+int fs3_put_cache_dirty(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+    // checks that the cache is created and holding writes
+    if((cacheCreated == 0) || (fs3_cache_mode != FS3_CACHE_WRITE_BACK)){
+        return(-1);
+    }
+    fs3_profile_cache_reference(trk, sct, 0);
+
+    // the copy in the second level cache is older than the write
+    fs3_invalidate_cache_l2(trk, sct);
+
+    FS3CacheVictim victim;
+    fs3_begin_cache_eviction(&victim, 1);
+    FS3CacheShard *shard = fs3_lock_cache_shard(trk, sct);
+    if(shard->lineCount == 0){
+        fs3_unlock_cache_shard(shard);
+        fs3_end_cache_eviction(&victim);
+        return(-1);
+    }
+
+    // waits for any reader of the sector's old data to finish with it
+    fs3_wait_cache_sector_unpinned(shard, trk, sct);
+
+    // finds the cache line to put the sector in
+    int found;
+    int putIndex = fs3_find_put_line(shard, trk, sct, &found, &victim);
+    if(putIndex == -1){
+        fs3_unlock_cache_shard(shard);
+        fs3_end_cache_eviction(&victim);
+        return(-1);
+    }
+
+    // updates the shard's metrics
+    shard->metrics.inserts = shard->metrics.inserts + 1;
+
+    // updates the data in the cache line, marking it as needing to be written to the disk
+    shard->lines.dirty[putIndex] = 1;
+    shard->lines.prefetched[putIndex] = 0;
+    memcpy(FS3_CACHE_LINE_DATA(shard->lines, putIndex), buf, FS3_SECTOR_SIZE);
+
+    fs3_unlock_cache_shard(shard);
+    return(fs3_end_cache_eviction(&victim));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_put_cache_prefetch
+// Description  : Put an element read ahead of a sequential reader in the cache,
+//                marked so it can be counted as a hit or as wasted later
+//
+// Inputs       : trk - the track number of the sector to put in cache
+//                sct - the sector number of the sector to put in cache
+//                buf - the data of the sector
+// Outputs      : 0 if inserted, -1 if not inserted
+
+int fs3_put_cache_prefetch(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+    // checks that the cache is created
+    if(cacheCreated == 0){
+        return(-1);
+    }
+
+    FS3CacheVictim victim;
+    fs3_begin_cache_eviction(&victim, 1);
+    FS3CacheShard *shard = fs3_lock_cache_shard(trk, sct);
+    if(shard->lineCount == 0){
+        fs3_unlock_cache_shard(shard);
+        fs3_end_cache_eviction(&victim);
+        return(-1);
+    }
+
+    // finds the cache line to put the sector in
+    int found;
+    int putIndex = fs3_find_put_line(shard, trk, sct, &found, &victim);
+    if(putIndex == -1){
+        fs3_unlock_cache_shard(shard);
+        fs3_end_cache_eviction(&victim);
+        return(-1);
+    }
+
+    // a copy of the sector already in the cache is at least as new, so it is left alone
+    if(found == 0){
+        // updates the shard's metrics
+        shard->metrics.prefetches = shard->metrics.prefetches + 1;
+
+        // updates the data in the cache line
+        shard->lines.dirty[putIndex] = 0;
+        shard->lines.prefetched[putIndex] = 1;
+        memcpy(FS3_CACHE_LINE_DATA(shard->lines, putIndex), buf, FS3_SECTOR_SIZE);
+    }
+
+    fs3_unlock_cache_shard(shard);
+    return(fs3_end_cache_eviction(&victim));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_contains
+// Description  : Check if an element is in the cache, without counting it as a
+//                get or changing how recently it was used
+//
+// Inputs       : trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+// Outputs      : 1 if the sector is in the cache, 0 if not
+
+int fs3_cache_contains(FS3TrackIndex trk, FS3SectorIndex sct) {
+    // checks that the cache is created
+    if(cacheCreated == 0){
+        return(0);
+    }
+
+    FS3CacheShard *shard = fs3_lock_cache_shard(trk, sct);
+    int line = fs3_find_cache_line(shard, trk, sct);
+    fs3_unlock_cache_shard(shard);
+
+    if(line == -1){
+        return(0);
+    }
+
+    return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_lines
+// Description  : Get the number of lines in the cache
+//
+// Inputs       : none
+// Outputs      : number of cache lines, 0 if the cache is not created
+
+int fs3_cache_lines(void) {
+    if(cacheCreated == 0){
+        return(0);
+    }
+
+    return(cacheSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_find_put_line
+// Description  : Finds the line of a shard a sector should be put in, either the
+//                line already holding it, an empty line, or the line the replacement
+//                policy evicts, copying the evicted line out to be written back if
+//                it is dirty. The line is given the sector. The shard's lock must
+//                be held, and the write back is left until it is unlocked
+//
+// Inputs       : shard - the shard the sector belongs to
+//                trk - the track number of the sector to put in cache
+//                sct - the sector number of the sector to put in cache
+//                found - set to 1 if the line already held the sector, 0 if not
+//                victim - where a dirty line evicted is copied to
+// Outputs      : index of the line in the shard, -1 if failure or the policy kept the sector out
+
+int fs3_find_put_line(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct, int *found, FS3CacheVictim *victim) {
+    // tells the replacement policy the sector is being used
+    if(cachePolicy->access != NULL){
+        cachePolicy->access(&shard->policy, trk, sct);
+    }
+
+    // looks the sector up in the hash index
+    int putIndex = fs3_find_cache_line(shard, trk, sct);
+    shard->useClock = shard->useClock + 1;
+    if(putIndex != -1){
+        *found = 1;
+        cachePolicy->hit(&shard->policy, putIndex);
+        shard->lines.lastUse[putIndex] = shard->useClock;
+        return(putIndex);
+    }
+    *found = 0;
+
+    // otherwise takes an empty line, or the line the replacement policy picks to evict
+    int freeLine = -1;
+    if(shard->freeCount > 0){
+        shard->freeCount = shard->freeCount - 1;
+        freeLine = shard->freeLines[shard->freeCount];
+    }
+    putIndex = cachePolicy->place(&shard->policy, trk, sct, freeLine);
+    if((freeLine != -1) && (putIndex != freeLine)){
+        // the policy did not use the empty line, so it goes back on the free list
+        shard->freeLines[shard->freeCount] = freeLine;
+        shard->freeCount = shard->freeCount + 1;
+    }
+    if(putIndex == -1){
+        // the policy kept the sector out of the cache
+        return(-1);
+    }
+    FS3CacheLines *lines = &shard->lines;
+
+    // counts the eviction of the sector the line held, if any
+    if(lines->track[putIndex] != -1){
+        fs3_count_cache_eviction(&shard->metrics, lines, putIndex);
+    }
+
+    // if the line being evicted holds a write, it is copied out to be sent to the disk once the
+    //  shard is unlocked, as sending it uses the connections every shard shares
+    if(lines->dirty[putIndex] == 1){
+        victim->dirty = 1;
+        victim->track = lines->track[putIndex];
+        victim->sector = lines->sector[putIndex];
+        memcpy(victim->data, FS3_CACHE_LINE_DATA(*lines, putIndex), FS3_SECTOR_SIZE);
+        lines->dirty[putIndex] = 0;
+        shard->metrics.writeBacks = shard->metrics.writeBacks + 1;
+    }
+
+    // if the line being evicted was read ahead and never used, the read was wasted
+    if(lines->prefetched[putIndex] == 1){
+        lines->prefetched[putIndex] = 0;
+        shard->metrics.prefetchWasted = shard->metrics.prefetchWasted + 1;
+    }
+
+    // moves the line from the old sector's hash bucket to the new one's, keeping the sector
+    //  evicted, now clean, in the second level cache, and letting the auto-tuner remember it
+    if(lines->track[putIndex] != -1){
+        if(fs3_put_cache_l2(lines->track[putIndex], lines->sector[putIndex], FS3_CACHE_LINE_DATA(*lines, putIndex)) == 0){
+            shard->metrics.l2Puts = shard->metrics.l2Puts + 1;
+        }
+        fs3_unhash_cache_line(shard, putIndex);
+        if(shard->tuneGhosts.capacity > 0){
+            fs3_ghost_add(&shard->tuneGhosts, 0, ((uint32_t)lines->track[putIndex] * FS3_TRACK_SIZE) + (uint32_t)lines->sector[putIndex]);
+        }
+    }
+    lines->track[putIndex] = trk;
+    lines->sector[putIndex] = sct;
+    lines->insertTime[putIndex] = fs3_cache_clock();
+    lines->lastUse[putIndex] = shard->useClock;
+    fs3_hash_cache_line(shard, putIndex);
+
+    return(putIndex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_begin_cache_eviction
+// Description  : Starts a use of the cache that may evict a dirty line. In write-
+//                back mode the disk lock is taken first, before any shard lock, so
+//                no one reads the sector of a line evicted from the disk before its
+//                write back is sent. The driver already holds it, and takes it again
+//
+// Inputs       : victim - where a dirty line evicted is copied to
+//                evicting - 1 if the use may evict a line
+// Outputs      : 0 if successful
+
+int fs3_begin_cache_eviction(FS3CacheVictim *victim, int evicting) {
+    victim->dirty = 0;
+    victim->diskHeld = ((evicting == 1) && (fs3_cache_mode == FS3_CACHE_WRITE_BACK)) ? 1 : 0;
+    if(victim->diskHeld == 1){
+        pthread_mutex_lock(&diskLock);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_end_cache_eviction
+// Description  : Ends a use of the cache started by fs3_begin_cache_eviction,
+//                sending the write back of any dirty line it evicted, with the
+//                shard unlocked and the disk held, then releasing the disk. The
+//                reply is not waited for: a failure is reported when the read or
+//                write the line was evicted for waits for its own commands
+//
+// Inputs       : victim - the dirty line evicted, if any
+// Outputs      : 0 if successful, -1 if the write back could not be sent
+
+int fs3_end_cache_eviction(FS3CacheVictim *victim) {
+    int result = 0;
+    if(victim->dirty == 1){
+        pthread_mutex_lock(&diskLock);
+        result = send_disk_sector_write(victim->track, victim->sector, victim->data);
+        pthread_mutex_unlock(&diskLock);
+        victim->dirty = 0;
+    }
+    if(victim->diskHeld == 1){
+        pthread_mutex_unlock(&diskLock);
+        victim->diskHeld = 0;
+    }
+
+    return(result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_count_cache_eviction
+// Description  : Counts a line losing its sector in a set of metrics, as clean
+//                or dirty, and how long it held the sector. Called before a dirty
+//                line is written back
+//
+// Inputs       : metrics - the metrics to count it in
+//                lines - the lines of the line's shard
+//                line - index of the line
+// Outputs      : 0 if successful
+
+int fs3_count_cache_eviction(FS3CacheMetrics *metrics, FS3CacheLines *lines, int line) {
+    metrics->evictions = metrics->evictions + 1;
+    if(lines->dirty[line] == 1){
+        metrics->dirtyEvictions = metrics->dirtyEvictions + 1;
+    } else {
+        metrics->cleanEvictions = metrics->cleanEvictions + 1;
+    }
+
+    uint64_t residency = fs3_cache_clock() - lines->insertTime[line];
+    int bucket = fs3_cache_histogram_bucket(residency);
+    metrics->residency[bucket] = metrics->residency[bucket] + 1;
+    metrics->residencyTotal = metrics->residencyTotal + residency;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_histogram_bucket
+// Description  : Works out the telemetry histogram bucket of a value, the number
+//                of bits it needs, so bucket b holds values from 2^(b-1) to 2^b - 1
+//                and the last bucket holds every larger value too
+//
+// Inputs       : value - the value
+// Outputs      : the bucket, from 0 to FS3_CACHE_HISTOGRAM_BUCKETS - 1
+
+int fs3_cache_histogram_bucket(uint64_t value) {
+    if(value == 0){
+        return(0);
+    }
+
+    int bucket = 64 - __builtin_clzll(value);
+    if(bucket >= FS3_CACHE_HISTOGRAM_BUCKETS){
+        bucket = FS3_CACHE_HISTOGRAM_BUCKETS - 1;
+    }
+
+    return(bucket);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_clock
+// Description  : Gets the microseconds on the monotonic clock, which line
+//                residency times are measured by
+//
+// Inputs       : none
+// Outputs      : the time in microseconds
+
+uint64_t fs3_cache_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return(((uint64_t)now.tv_sec * 1000000) + ((uint64_t)now.tv_nsec / 1000));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lock_cache_shard
+// Description  : Locks the shard of the cache a sector belongs to, holding off
+//                any resize until it is unlocked
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : pointer to the locked shard
+
+FS3CacheShard * fs3_lock_cache_shard(FS3TrackIndex trk, FS3SectorIndex sct) {
+    uint32_t hash = fs3_cache_hash(trk, sct);
+
+    // a resize holds every shard lock while it changes the shards, so once the lock is held
+    //  the shard only needs checking again if the number of shards changed while waiting for it
+    while(1){
+        int shardBits = __atomic_load_n(&cacheShardBits, __ATOMIC_ACQUIRE);
+        int shardIndex = (shardBits == 0) ? 0 : (int)(hash >> (32 - shardBits));
+        pthread_mutex_lock(&cacheShardLocks[shardIndex].lock);
+        if(cacheShardBits == shardBits){
+            return(&cacheShards[shardIndex]);
+        }
+        pthread_mutex_unlock(&cacheShardLocks[shardIndex].lock);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_unlock_cache_shard
+// Description  : Unlocks a shard locked by fs3_lock_cache_shard
+//
+// Inputs       : shard - the shard
+// Outputs      : 0 if successful
+
+int fs3_unlock_cache_shard(FS3CacheShard *shard) {
+    pthread_mutex_unlock(shard->lock);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lock_all_cache_shards
+// Description  : Locks every shard lock, always in the same order, so the whole
+//                cache can be used or changed at once
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int fs3_lock_all_cache_shards(void) {
+    int i;
+    for(i = 0; i < FS3_CACHE_MAX_SHARDS; i++){
+        pthread_mutex_lock(&cacheShardLocks[i].lock);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_unlock_all_cache_shards
+// Description  : Unlocks every shard lock
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int fs3_unlock_all_cache_shards(void) {
+    int i;
+    for(i = FS3_CACHE_MAX_SHARDS - 1; i >= 0; i--){
+        pthread_mutex_unlock(&cacheShardLocks[i].lock);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_hash
+// Description  : Works out the hash of a sector, the high bits of which pick its
+//                shard and the low bits its hash bucket in the shard
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : the hash
+
+uint32_t fs3_cache_hash(FS3TrackIndex trk, FS3SectorIndex sct) {
+    uint32_t key = ((uint32_t)trk * FS3_TRACK_SIZE) + (uint32_t)sct;
+    uint32_t hash = key * FS3_CACHE_HASH_MULTIPLIER;
+
+    // folds the high bits down, as the low bits of the product only depend on the low bits of the key
+    return(hash ^ (hash >> 15));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_shard
+// Description  : Finds the shard of the cache a sector belongs to
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : pointer to the shard
+
+FS3CacheShard * fs3_cache_shard(FS3TrackIndex trk, FS3SectorIndex sct) {
+    if(cacheShardBits == 0){
+        return(&cacheShards[0]);
+    }
+
+    return(&cacheShards[fs3_cache_hash(trk, sct) >> (32 - cacheShardBits)]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_find_cache_line
+// Description  : Finds the line of a shard holding a sector in the shard's hash
+//                index. The shard's lock must be held
+//
+// Inputs       : shard - the shard the sector belongs to
+//                trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+// Outputs      : index of the line in the shard, -1 if the sector is not in the cache
+
+int fs3_find_cache_line(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct) {
+    // walks the chain of lines in the sector's hash bucket
+    int i = shard->hashTable[fs3_cache_hash(trk, sct) & shard->hashMask];
+    while(i != -1){
+        if((shard->lines.track[i]==trk)&&(shard->lines.sector[i]==sct)){
+            return(i);
+        }
+        i = shard->lines.hashNext[i];
+    }
+
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_hash_cache_line
+// Description  : Adds a line of a shard to the hash bucket of the sector it holds
+//
+// Inputs       : shard - the shard of the line
+//                line - index of the line in the shard
+// Outputs      : 0 if successful
+
+int fs3_hash_cache_line(FS3CacheShard *shard, int line) {
+    uint32_t bucket = fs3_cache_hash(shard->lines.track[line], shard->lines.sector[line]) & shard->hashMask;
+    shard->lines.hashNext[line] = shard->hashTable[bucket];
+    shard->hashTable[bucket] = line;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_unhash_cache_line
+// Description  : Removes a line of a shard from the hash bucket of the sector it holds
+//
+// Inputs       : shard - the shard of the line
+//                line - index of the line in the shard
+// Outputs      : 0 if successful, -1 if the line was not in its bucket
+
+int fs3_unhash_cache_line(FS3CacheShard *shard, int line) {
+    // finds the link pointing at the line, and points it past the line
+    int *link = &shard->hashTable[fs3_cache_hash(shard->lines.track[line], shard->lines.sector[line]) & shard->hashMask];
+    while(*link != -1){
+        if(*link == line){
+            *link = shard->lines.hashNext[line];
+            shard->lines.hashNext[line] = -1;
+            return(0);
+        }
+        link = &shard->lines.hashNext[*link];
+    }
+
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_get_cache
+// Description  : Get a copy of an element from the cache, made while its shard
+//                is locked into a buffer of the calling thread's own, so another
+//                thread evicting the line cannot change it. The copy is kept
+//                until the thread's next get, fs3_get_cache_ref pins the line
+//                for readers that would rather not copy it
+//
+// Inputs       : trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+// Outputs      : returns NULL if not found or failed, pointer to buffer if found
+
+void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)  {
+    // checks that the cache is created
+    if(cacheCreated == 0){
+        return(NULL);
+    }
+    fs3_profile_cache_reference(trk, sct, 1);
+
+    // a miss brought back from the second level cache may evict a dirty line
+    FS3CacheVictim victim;
+    fs3_begin_cache_eviction(&victim, fs3_cache_l2_open());
+    FS3CacheShard *shard = fs3_lock_cache_shard(trk, sct);
+
+    // looks the sector up, copying its data out before the shard is unlocked
+    void *data = NULL;
+    int getIndex = fs3_lookup_cache_line(shard, trk, sct, &victim);
+    if(getIndex != -1){
+        memcpy(cacheGetCopy, FS3_CACHE_LINE_DATA(shard->lines, getIndex), FS3_SECTOR_SIZE);
+        data = cacheGetCopy;
+    }
+
+    fs3_unlock_cache_shard(shard);
+    if(fs3_end_cache_eviction(&victim) == -1){
+        return(NULL);
+    }
+
+    // returns the pointer to the copy of the data
+    return(data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_get_cache_ref
+// Description  : Get an element from the cache, pinning its line so the data
+//                cannot be evicted or changed until the reference is released
+//
+// Inputs       : trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+//                ref - the reference to fill in
+// Outputs      : 0 if found and pinned, -1 if not found or failed
+
+int fs3_get_cache_ref(FS3TrackIndex trk, FS3SectorIndex sct, FS3CacheRef *ref) {
+    ref->shard = NULL;
+    ref->line = -1;
+    ref->data = NULL;
+
+    // checks that the cache is created
+    if(cacheCreated == 0){
+        return(-1);
+    }
+    fs3_profile_cache_reference(trk, sct, 1);
+
+    // a miss brought back from the second level cache may evict a dirty line
+    FS3CacheVictim victim;
+    fs3_begin_cache_eviction(&victim, fs3_cache_l2_open());
+    FS3CacheShard *shard = fs3_lock_cache_shard(trk, sct);
+
+    // looks the sector up, and pins its line if found
+    int getIndex = fs3_lookup_cache_line(shard, trk, sct, &victim);
+    if(getIndex != -1){
+        shard->linePins[getIndex] = shard->linePins[getIndex] + 1;
+        ref->shard = shard;
+        ref->line = getIndex;
+        ref->data = FS3_CACHE_LINE_DATA(shard->lines, getIndex);
+    }
+
+    fs3_unlock_cache_shard(shard);
+    if(fs3_end_cache_eviction(&victim) == -1){
+        fs3_release_cache_ref(ref);
+        return(-1);
+    }
+
+    if(getIndex == -1){
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_release_cache_ref
+// Description  : Release a line pinned by fs3_get_cache_ref, letting it be
+//                evicted or changed again
+//
+// Inputs       : ref - the reference to release
+// Outputs      : 0 if successful, -1 if the reference holds nothing
+
+int fs3_release_cache_ref(FS3CacheRef *ref) {
+    if((ref->shard == NULL) || (ref->line == -1)){
+        return(-1);
+    }
+
+    FS3CacheShard *shard = ref->shard;
+    pthread_mutex_lock(shard->lock);
+
+    // unpins the line, waking anyone waiting to change it once no reader holds it
+    shard->linePins[ref->line] = shard->linePins[ref->line] - 1;
+    if(shard->linePins[ref->line] == 0){
+        pthread_cond_broadcast(shard->unpinned);
+    }
+
+    pthread_mutex_unlock(shard->lock);
+
+    ref->shard = NULL;
+    ref->line = -1;
+    ref->data = NULL;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lookup_cache_line
+// Description  : Looks up a sector being read, counting the get as a hit or miss
+//                and telling the replacement policy the line was used. The
+//                shard's lock must be held
+//
+// Inputs       : shard - the shard the sector belongs to
+//                trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+//                victim - where a dirty line evicted to bring the sector back is copied to
+// Outputs      : index of the line in the shard, -1 if the sector is not in the cache
+
+int fs3_lookup_cache_line(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct, FS3CacheVictim *victim) {
+    // tells the replacement policy the sector is being used
+    if(cachePolicy->access != NULL){
+        cachePolicy->access(&shard->policy, trk, sct);
+    }
+
+    // looks the sector up in the hash index
+    int getIndex = fs3_find_cache_line(shard, trk, sct);
+
+    // updates the shard's metrics, and the heat of the sector's track
+    shard->useClock = shard->useClock + 1;
+    shard->metrics.gets = shard->metrics.gets + 1;
+    shard->metrics.trackGets[trk] = shard->metrics.trackGets[trk] + 1;
+
+    if(getIndex == -1){
+        // if no match was found, updates the number of cache misses
+        shard->metrics.misses = shard->metrics.misses + 1;
+
+        // a miss on a sector evicted recently would have been a hit in a bigger cache
+        if(shard->tuneGhosts.capacity > 0){
+            int node = fs3_ghost_find(&shard->tuneGhosts, ((uint32_t)trk * FS3_TRACK_SIZE) + (uint32_t)sct);
+            if(node != -1){
+                fs3_ghost_remove(&shard->tuneGhosts, node);
+                shard->metrics.ghostHits = shard->metrics.ghostHits + 1;
+            }
+        }
+
+        // a sector evicted to the second level cache is brought back into a line from there
+        return(fs3_promote_cache_l2_line(shard, trk, sct, victim));
+    }
+
+    // if a match was found, updates the number of cache hits
+    shard->metrics.hits = shard->metrics.hits + 1;
+    shard->metrics.trackHits[trk] = shard->metrics.trackHits[trk] + 1;
+
+    // counts how long ago the line was last used, in uses of the whole cache, as each shard
+    //  sees about its share of them
+    uint64_t reuseDistance = (uint64_t)(shard->useClock - shard->lines.lastUse[getIndex]) * cacheShardCount;
+    int bucket = fs3_cache_histogram_bucket(reuseDistance);
+    shard->metrics.reuseDistance[bucket] = shard->metrics.reuseDistance[bucket] + 1;
+    shard->lines.lastUse[getIndex] = shard->useClock;
+
+    // tells the replacement policy the cache line was used
+    cachePolicy->hit(&shard->policy, getIndex);
+
+    // the first use of a line that was read ahead counts as a prefetch hit
+    if(shard->lines.prefetched[getIndex] == 1){
+        shard->lines.prefetched[getIndex] = 0;
+        shard->metrics.prefetchHits = shard->metrics.prefetchHits + 1;
+    }
+
+    return(getIndex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_promote_cache_l2_line
+// Description  : Brings a sector that missed back from the second level cache
+//                into a line of its shard. The shard's lock must be held
+//
+// Inputs       : shard - the shard the sector belongs to
+//                trk - the track number of the sector
+//                sct - the sector number of the sector
+//                victim - where a dirty line evicted for it is copied to
+// Outputs      : index of the line in the shard, -1 if not held in the second level cache
+
+int fs3_promote_cache_l2_line(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct, FS3CacheVictim *victim) {
+    // copies the sector out first, as the line it goes in may evict into the same set
+    uint8_t sectorData[FS3_SECTOR_SIZE];
+    if(fs3_get_cache_l2(trk, sct, sectorData) == -1){
+        return(-1);
+    }
+
+    int found;
+    int line = fs3_find_put_line(shard, trk, sct, &found, victim);
+    if(line == -1){
+        return(-1);
+    }
+    memcpy(FS3_CACHE_LINE_DATA(shard->lines, line), sectorData, FS3_SECTOR_SIZE);
+    shard->lines.dirty[line] = 0;
+    shard->lines.prefetched[line] = 0;
+    shard->metrics.l2Hits = shard->metrics.l2Hits + 1;
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_wait_cache_sector_unpinned
+// Description  : Waits until no reader holds the line of a sector, so its data
+//                can be changed. The shard's lock must be held, and is released
+//                while waiting
+//
+// Inputs       : shard - the shard the sector belongs to
+//                trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : 0 if successful
+
+int fs3_wait_cache_sector_unpinned(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct) {
+    // the sector is looked up again after each wait, as its line may have been evicted meanwhile
+    int line = fs3_find_cache_line(shard, trk, sct);
+    while((line != -1) && (shard->linePins[line] > 0)){
+        pthread_cond_wait(shard->unpinned, shard->lock);
+        line = fs3_find_cache_line(shard, trk, sct);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_flush_cache
+// Description  : Write every dirty element of the cache back to the disk, in
+//                track order so each track is only seeked to once
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_flush_cache(void) {
+    // checks that the cache is created
+    if(cacheCreated == 0){
+        return(0);
+    }
+
+    // holds every shard so the lines can be sorted across shards, which also holds off any resize
+    fs3_lock_all_cache_shards();
+
+    int i;
+    int dirtyCount = 0;
+    int *dirtyLines = malloc((cacheSize + 1) * sizeof(int));
+    if(dirtyLines == NULL){
+        fs3_unlock_all_cache_shards();
+        return(-1);
+    }
+
+    // collects the index of every dirty cache line
+    for(i = 0; i < (int)cacheSize; i++){
+        if(FS3Cache.dirty[i] == 1){
+            dirtyLines[dirtyCount] = i;
+            dirtyCount = dirtyCount + 1;
+        }
+    }
+
+    // sorts the dirty lines by track, then by sector
+    qsort(dirtyLines, dirtyCount, sizeof(int), fs3_compare_cache_lines);
+
+    // sends the write of each dirty line to the disk without waiting for each reply, then
+    //  marks them all clean once every write has succeeded
+    int flushResult = 0;
+    for(i = 0; i < dirtyCount; i++){
+        int line = dirtyLines[i];
+        if(queue_disk_sector_write(FS3Cache.track[line], FS3Cache.sector[line], FS3_CACHE_LINE_DATA(FS3Cache, line)) == -1){
+            flushResult = -1;
+            break;
+        }
+    }
+    if(complete_disk_requests() == -1){
+        flushResult = -1;
+    }
+    for(i = 0; (i < dirtyCount) && (flushResult == 0); i++){
+        int line = dirtyLines[i];
+        FS3Cache.dirty[line] = 0;
+        FS3CacheShard *shard = fs3_cache_shard(FS3Cache.track[line], FS3Cache.sector[line]);
+        shard->metrics.writeBacks = shard->metrics.writeBacks + 1;
+    }
+
+    fs3_unlock_all_cache_shards();
+
+    free(dirtyLines);
+    return(flushResult);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_take_cache_dirty
+// Description  : Copies out a sector the cache holds a write of, marking its line
+//                clean, so the caller can write that one sector back to the disk
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+//                buf - buffer to copy the sector's data into
+// Outputs      : 1 if the sector was dirty and copied, 0 if not, -1 if failure
+
+int fs3_take_cache_dirty(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+    // checks that the cache is created
+    if(cacheCreated == 0){
+        return(0);
+    }
+
+    FS3CacheShard *shard = fs3_lock_cache_shard(trk, sct);
+    if(shard->lineCount == 0){
+        fs3_unlock_cache_shard(shard);
+        return(0);
+    }
+
+    // copies the line out if it holds a write not yet on the disk
+    int taken = 0;
+    int line = fs3_find_cache_line(shard, trk, sct);
+    if((line != -1) && (shard->lines.dirty[line] == 1)){
+        memcpy(buf, FS3_CACHE_LINE_DATA(shard->lines, line), FS3_SECTOR_SIZE);
+        shard->lines.dirty[line] = 0;
+        shard->metrics.writeBacks = shard->metrics.writeBacks + 1;
+        taken = 1;
+    }
+
+    fs3_unlock_cache_shard(shard);
+    return(taken);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_compare_cache_lines
+// Description  : Orders two cache line indexes by the track, then sector, they hold
+//
+// Inputs       : a - pointer to the first cache line index
+//                b - pointer to the second cache line index
+// Outputs      : negative, zero, or positive as the first line comes before, with, or after the second
+
+int fs3_compare_cache_lines(const void *a, const void *b) {
+    int lineA = *(const int *)a;
+    int lineB = *(const int *)b;
+
+    if(FS3Cache.track[lineA] != FS3Cache.track[lineB]){
+        return(FS3Cache.track[lineA] - FS3Cache.track[lineB]);
+    }
+    return(FS3Cache.sector[lineA] - FS3Cache.sector[lineB]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_flusher
+// Description  : Background thread that flushes the cache every
+//                fs3_cache_flush_interval milliseconds until the cache is closed
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void * fs3_cache_flusher(void *arg) {
+    pthread_mutex_lock(&flusherLock);
+    while(flusherRunning == 1){
+        // works out when the next flush is due
+        struct timespec wakeTime;
+        clock_gettime(CLOCK_REALTIME, &wakeTime);
+        wakeTime.tv_sec = wakeTime.tv_sec + (fs3_cache_flush_interval / 1000);
+        wakeTime.tv_nsec = wakeTime.tv_nsec + ((long)(fs3_cache_flush_interval % 1000) * 1000000);
+        if(wakeTime.tv_nsec >= 1000000000){
+            wakeTime.tv_sec = wakeTime.tv_sec + 1;
+            wakeTime.tv_nsec = wakeTime.tv_nsec - 1000000000;
+        }
+
+        // waits until the flush is due or the cache is being closed
+        pthread_cond_timedwait(&flusherCond, &flusherLock, &wakeTime);
+        if(flusherRunning == 0){
+            break;
+        }
+        pthread_mutex_unlock(&flusherLock);
+
+        // flushes the cache while holding the disk, so the driver is not using it at the same time
+        pthread_mutex_lock(&diskLock);
+        fs3_flush_cache();
+        pthread_mutex_unlock(&diskLock);
+
+        pthread_mutex_lock(&flusherLock);
+    }
+    pthread_mutex_unlock(&flusherLock);
+
+    return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sum_cache_metrics
+// Description  : Adds up the metrics of every shard of the cache
+//
+// Inputs       : total - where to put the totals
+// Outputs      : 0 if successful
+
+int fs3_sum_cache_metrics(FS3CacheMetrics *total) {
+    memset(total, 0, sizeof(FS3CacheMetrics));
+    if(cacheCreated == 0){
+        return(0);
+    }
+
+    // starts from the metrics of the shards replaced by resizes, holding every shard so a
+    //  resize cannot move metrics between them meanwhile
+    fs3_lock_all_cache_shards();
+    fs3_add_cache_metrics(total, &cacheRetiredMetrics);
+
+    int i;
+    for(i = 0; i < cacheShardCount; i++){
+        fs3_add_cache_metrics(total, &cacheShards[i].metrics);
+    }
+
+    fs3_unlock_all_cache_shards();
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_add_cache_metrics
+// Description  : Adds one set of cache metrics into a total
+//
+// Inputs       : total - the total
+//                metrics - the metrics to add
+// Outputs      : 0 if successful
+
+int fs3_add_cache_metrics(FS3CacheMetrics *total, FS3CacheMetrics *metrics) {
+    total->inserts = total->inserts + metrics->inserts;
+    total->gets = total->gets + metrics->gets;
+    total->hits = total->hits + metrics->hits;
+    total->misses = total->misses + metrics->misses;
+    total->writeBacks = total->writeBacks + metrics->writeBacks;
+    total->prefetches = total->prefetches + metrics->prefetches;
+    total->prefetchHits = total->prefetchHits + metrics->prefetchHits;
+    total->prefetchWasted = total->prefetchWasted + metrics->prefetchWasted;
+    total->ghostHits = total->ghostHits + metrics->ghostHits;
+    total->l2Hits = total->l2Hits + metrics->l2Hits;
+    total->l2Puts = total->l2Puts + metrics->l2Puts;
+    total->evictions = total->evictions + metrics->evictions;
+    total->cleanEvictions = total->cleanEvictions + metrics->cleanEvictions;
+    total->dirtyEvictions = total->dirtyEvictions + metrics->dirtyEvictions;
+    total->residencyTotal = total->residencyTotal + metrics->residencyTotal;
+
+    int i;
+    for(i = 0; i < FS3_MAX_TRACKS; i++){
+        total->trackGets[i] = total->trackGets[i] + metrics->trackGets[i];
+        total->trackHits[i] = total->trackHits[i] + metrics->trackHits[i];
+    }
+    for(i = 0; i < FS3_CACHE_HISTOGRAM_BUCKETS; i++){
+        total->reuseDistance[i] = total->reuseDistance[i] + metrics->reuseDistance[i];
+        total->residency[i] = total->residency[i] + metrics->residency[i];
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_write_cache_metrics_json
+// Description  : Writes the cache's metrics as a JSON object, with the heat of
+//                every track that was read and the reuse distance and residency
+//                histograms (only the buckets holding something)
+//
+// Inputs       : out - the file to write to
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_write_cache_metrics_json(FILE *out) {
+    // adds up the metrics kept by each shard
+    FS3CacheMetrics metrics;
+    fs3_sum_cache_metrics(&metrics);
+
+    fprintf(out, "{\n");
+    fprintf(out, "    \"policy\": \"%s\",\n", fs3_cache_policies[fs3_cache_policy].name);
+    fprintf(out, "    \"lines\": %u,\n", cacheSize);
+    fprintf(out, "    \"shards\": %d,\n", cacheShardCount);
+    fprintf(out, "    \"resizes\": %d,\n", cacheResizes);
+    fprintf(out, "    \"inserts\": %d,\n", metrics.inserts);
+    fprintf(out, "    \"gets\": %d,\n", metrics.gets);
+    fprintf(out, "    \"hits\": %d,\n", metrics.hits);
+    fprintf(out, "    \"misses\": %d,\n", metrics.misses);
+    fprintf(out, "    \"hitRatio\": %.4f,\n", (metrics.gets > 0) ? (double)metrics.hits / metrics.gets : 0.0);
+    fprintf(out, "    \"writeBacks\": %d,\n", metrics.writeBacks);
+    fprintf(out, "    \"prefetches\": %d,\n", metrics.prefetches);
+    fprintf(out, "    \"prefetchHits\": %d,\n", metrics.prefetchHits);
+    fprintf(out, "    \"prefetchWasted\": %d,\n", metrics.prefetchWasted);
+    fprintf(out, "    \"ghostHits\": %d,\n", metrics.ghostHits);
+    fprintf(out, "    \"l2Hits\": %d,\n", metrics.l2Hits);
+    fprintf(out, "    \"l2Puts\": %d,\n", metrics.l2Puts);
+    fprintf(out, "    \"evictions\": %d,\n", metrics.evictions);
+    fprintf(out, "    \"cleanEvictions\": %d,\n", metrics.cleanEvictions);
+    fprintf(out, "    \"dirtyEvictions\": %d,\n", metrics.dirtyEvictions);
+    fprintf(out, "    \"meanResidencyUs\": %lu,\n",
+        (unsigned long)((metrics.evictions > 0) ? metrics.residencyTotal / metrics.evictions : 0));
+
+    // writes the gets and hits of every track that was read
+    fprintf(out, "    \"tracks\": [");
+    int i;
+    int written = 0;
+    for(i = 0; i < FS3_MAX_TRACKS; i++){
+        if(metrics.trackGets[i] > 0){
+            fprintf(out, "%s\n        {\"track\": %d, \"gets\": %d, \"hits\": %d, \"hitRatio\": %.4f}",
+                (written > 0) ? "," : "", i, metrics.trackGets[i], metrics.trackHits[i],
+                (double)metrics.trackHits[i] / metrics.trackGets[i]);
+            written = written + 1;
+        }
+    }
+    fprintf(out, "%s],\n", (written > 0) ? "\n    " : "");
+
+    // writes the two histograms, each bucket with the smallest value it holds
+    int histogram;
+    for(histogram = 0; histogram < 2; histogram++){
+        int *counts = (histogram == 0) ? metrics.reuseDistance : metrics.residency;
+        fprintf(out, "    \"%s\": [", (histogram == 0) ? "reuseDistance" : "residencyUs");
+        written = 0;
+        for(i = 0; i < FS3_CACHE_HISTOGRAM_BUCKETS; i++){
+            if(counts[i] > 0){
+                fprintf(out, "%s\n        {\"atLeast\": %lu, \"count\": %d}", (written > 0) ? "," : "",
+                    (i == 0) ? 0ul : (1ul << (i - 1)), counts[i]);
+                written = written + 1;
+            }
+        }
+        fprintf(out, "%s]%s\n", (written > 0) ? "\n    " : "", (histogram == 0) ? "," : "");
+    }
+    fprintf(out, "}");
+
+    return(ferror(out) ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_cache_metrics
+// Description  : Log the metrics for the cache 
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_cache_metrics(void) {
+    // adds up the metrics kept by each shard
+    FS3CacheMetrics metrics;
+    fs3_sum_cache_metrics(&metrics);
+
+    // calculates the cache hit ratio, and the mean time an evicted line held its sector,
+    //  leaving them 0 when nothing was looked up or evicted
+    float cacheHitRatio = 0;
+    if(metrics.gets > 0){
+        cacheHitRatio = ((float)metrics.hits) / ((float)metrics.gets) * 100;
+    }
+    double meanResidency = 0;
+    if(metrics.evictions > 0){
+        meanResidency = (double)metrics.residencyTotal / metrics.evictions / 1000;
+    }
 
     // logs the different metrics for the cache
     logMessage(FS3DriverLLevel, "** FS3 cache Metrics **");
-    logMessage(FS3DriverLLevel, "Cache inserts    [%9d]",cacheInserts);
-    logMessage(FS3DriverLLevel, "Cache gets       [%9d]",cacheGets);
-    logMessage(FS3DriverLLevel, "Cache hits       [%9d]",cacheHits);
-    logMessage(FS3DriverLLevel, "Cache misses     [%9d]",cacheMisses);
+    logMessage(FS3DriverLLevel, "Cache policy     [%9s]",fs3_cache_policies[fs3_cache_policy].name);
+    logMessage(FS3DriverLLevel, "Cache lines      [%9u]",cacheSize);
+    logMessage(FS3DriverLLevel, "Cache shards     [%9d]",cacheShardCount);
+    logMessage(FS3DriverLLevel, "Cache arena KB   [%9lu]%s",(unsigned long)(cacheArenaSize / 1024),(cacheArenaHuge == 1) ? " huge pages" : "");
+    logMessage(FS3DriverLLevel, "Cache inserts    [%9d]",metrics.inserts);
+    logMessage(FS3DriverLLevel, "Cache gets       [%9d]",metrics.gets);
+    logMessage(FS3DriverLLevel, "Cache hits       [%9d]",metrics.hits);
+    logMessage(FS3DriverLLevel, "Cache misses     [%9d]",metrics.misses);
     logMessage(FS3DriverLLevel, "Cache hit ratio  [%8.2f%]",cacheHitRatio);
+    logMessage(FS3DriverLLevel, "Cache evictions  [%9d]",metrics.evictions);
+    logMessage(FS3DriverLLevel, "  clean          [%9d]",metrics.cleanEvictions);
+    logMessage(FS3DriverLLevel, "  dirty          [%9d]",metrics.dirtyEvictions);
+    logMessage(FS3DriverLLevel, "Mean residency ms[%9.1f]",meanResidency);
+    if(fs3_cache_mode == FS3_CACHE_WRITE_BACK){
+        logMessage(FS3DriverLLevel, "Cache writebacks [%9d]",metrics.writeBacks);
+    }
+    if(metrics.prefetches > 0){
+        logMessage(FS3DriverLLevel, "Prefetches       [%9d]",metrics.prefetches);
+        logMessage(FS3DriverLLevel, "Prefetch hits    [%9d]",metrics.prefetchHits);
+        logMessage(FS3DriverLLevel, "Prefetch wasted  [%9d]",metrics.prefetchWasted);
+    }
+    if((fs3_cache_autotune == 1) || (cacheResizes > 0)){
+        logMessage(FS3DriverLLevel, "Cache resizes    [%9d]",cacheResizes);
+        logMessage(FS3DriverLLevel, "Tuner ghost hits [%9d]",metrics.ghostHits);
+    }
+    if(fs3_cache_l2_open() == 1){
+        logMessage(FS3DriverLLevel, "L2 hits          [%9d]",metrics.l2Hits);
+        logMessage(FS3DriverLLevel, "L2 puts          [%9d]",metrics.l2Puts);
+        logMessage(FS3DriverLLevel, "L2 lines held    [%9d]",fs3_cache_l2_valid_lines());
+    }
+
+    // logs the hit ratio every other cache size would have had
+    if(fs3_cache_profile_rate > 0){
+        fs3_log_cache_profile(metrics.hits);
+    }
 
     return(0);
 }
@@ -12,34 +12,290 @@
 //
 
 // Include
+#include <stdio.h>
+#include <pthread.h>
 #include <fs3_controller.h>
 #include <fs3_common.h>
+#include <fs3_cache_policy.h>
 
 // Defines
 #define FS3_DEFAULT_CACHE_SIZE 0x8; // 8 cache entries, by default
+#define FS3_CACHE_WRITE_THROUGH 0 // writes go to the disk as soon as they are made
+#define FS3_CACHE_WRITE_BACK 1    // writes are held in the cache until they are flushed
+#define FS3_CACHE_MAX_LINES (FS3_MAX_TRACKS * FS3_TRACK_SIZE) // one line for every sector on the disk
+#define FS3_DEFAULT_CACHE_SHARDS 16  // most shards the cache is split into, by default
+#define FS3_CACHE_MAX_SHARDS 64      // most shards the cache can be split into
+#define FS3_CACHE_SHARD_ALIGNMENT 64 // bytes in a processor cache line, so shards do not share one
+#define FS3_CACHE_HISTOGRAM_BUCKETS 32 // buckets of the telemetry histograms, one for each power of 2
+#define FS3_CACHE_LINE_DATA(lines, line) ((lines).data + ((size_t)(line) * FS3_SECTOR_SIZE)) // sector data of a line
 
 // Type Definitions
-    // cache entry struct
-    typedef struct FS3CacheEntry_{
-        int track;
-        int sector;
-        void *dataBuffer;
-        uint32_t countUsed;
-    } FS3CacheEntry;
+    // cache lines struct, each field of every line kept in its own array carved from the cache arena
+    typedef struct {
+        uint8_t *data;        // FS3_SECTOR_SIZE bytes of sector data per line
+        int32_t *track;       // track of the sector held, -1 if empty
+        int32_t *sector;      // sector held, -1 if empty
+        int32_t *hashNext;    // next line in the same hash bucket, -1 if last
+        uint8_t *dirty;       // written and not yet flushed to the disk
+        uint8_t *prefetched;  // read ahead into the cache and not used yet
+        uint64_t *insertTime; // microseconds on the monotonic clock when the sector was put in the line
+        uint32_t *lastUse;    // the shard's use clock when the line was last used
+    } FS3CacheLines;
+
+    // cache metrics, counted by each shard and added up when logged
+    typedef struct {
+        int inserts;
+        int gets;
+        int hits;
+        int misses;
+        int writeBacks;
+        int prefetches;
+        int prefetchHits;
+        int prefetchWasted;
+        int ghostHits;          // misses on sectors the auto-tuner remembers evicting
+        int l2Hits;             // misses found in the second level cache file
+        int l2Puts;             // clean lines evicted into the second level cache file
+        int evictions;          // lines given to another sector, or dropped by a shrink
+        int cleanEvictions;
+        int dirtyEvictions;     // evictions that had to write the line back first
+        uint64_t residencyTotal; // microseconds the evicted lines held their sectors, in total
+        int trackGets[FS3_MAX_TRACKS];  // gets of the sectors of each track
+        int trackHits[FS3_MAX_TRACKS];  // hits on the sectors of each track
+        int reuseDistance[FS3_CACHE_HISTOGRAM_BUCKETS]; // hits by the log2 of the gets and puts to the cache since the line was last used
+        int residency[FS3_CACHE_HISTOGRAM_BUCKETS];     // evictions by the log2 of the microseconds the line held its sector
+    } FS3CacheMetrics;
+
+    // cache shard lock struct, kept apart from the shard so it outlives a resize
+    typedef struct {
+        pthread_mutex_t lock;     // held while the shard's lines, index, policy or metrics are used
+        pthread_cond_t unpinned;  // signalled when a line's last reference is released
+    } __attribute__((aligned(FS3_CACHE_SHARD_ALIGNMENT))) FS3CacheShardLock;
+
+    // cache shard struct, a slice of the cache lines with its own lock, hash index and replacement policy
+    typedef struct {
+        pthread_mutex_t *lock;  // the shard's lock
+        FS3CacheLines lines;    // the shard's slice of the cache lines
+        int lineCount;
+        int firstLine;          // index in the cache of the shard's first line
+        int *hashTable;         // first line in each hash bucket, -1 if empty
+        uint32_t hashMask;
+        int *freeLines;         // stack of lines not holding a sector
+        int freeCount;
+        int *linePins;          // number of references held on each line
+        pthread_cond_t *unpinned; // the shard's condition signalled when a line is unpinned
+        FS3PolicyState policy;
+        FS3GhostSet tuneGhosts; // sectors evicted most recently, kept for the auto-tuner
+        uint32_t useClock;      // gets and puts made to the shard, the clock reuse distances are measured by
+        FS3CacheMetrics metrics;
+    } __attribute__((aligned(FS3_CACHE_SHARD_ALIGNMENT))) FS3CacheShard;
+
+    // cache reference struct, a line pinned by fs3_get_cache_ref until it is released
+    typedef struct {
+        FS3CacheShard *shard;
+        int line;               // index of the line in the shard, -1 if nothing is held
+        void *data;             // the sector's data, safe to read until released
+    } FS3CacheRef;
+
+    // cache victim struct, a dirty sector an operation evicted, written back once its shard is unlocked
+    typedef struct {
+        int dirty;              // 1 if the sector below still has to be written back
+        int diskHeld;           // 1 if the operation holds the disk lock
+        FS3TrackIndex track;
+        FS3SectorIndex sector;
+        uint8_t data[FS3_SECTOR_SIZE];
+    } FS3CacheVictim;
+
+    // cache snapshot struct, the cache in use kept while a resize builds a new one, to go back to if it fails
+    typedef struct {
+        FS3CacheLines lines;    // the cache lines
+        FS3CacheShard *shards;
+        int shardCount;
+        uint32_t size;          // number of cache lines
+        void *arena;            // arena every line is carved from
+        size_t arenaSize;
+        int arenaHuge;          // 1 if the arena is backed by huge pages
+    } FS3CacheSnapshot;
+
+// Global data
+extern int fs3_cache_mode;                // Write policy of the cache (write-through or write-back)
+extern int fs3_cache_policy;              // Replacement policy of the cache (FS3_CACHE_POLICY_*)
+extern uint32_t fs3_cache_flush_interval; // Milliseconds between background flushes, 0 for none
+extern uint16_t fs3_cache_shards;         // Most shards to split the cache into
+extern uint64_t fs3_cache_budget;         // Most bytes the cache may use, 0 for no budget
+extern int fs3_cache_autotune;            // 1 to grow the cache while more lines would be hits
 
 // Cache Functions
 
-int fs3_init_cache(uint16_t cachelines);
-    // Initialize the cache with a fixed number of cache lines
+int fs3_init_cache(uint32_t cachelines);
+    // Initialize the cache with a number of cache lines
+
+int fs3_build_cache(uint32_t cachelines);
+    // Map an arena for a number of empty cache lines and split them between the shards
+
+int fs3_init_cache_shard(FS3CacheShard *shard, int shardIndex, int firstLine, int lineCount);
+    // Set up a shard of the cache over a slice of the cache lines
+
+int fs3_cache_shard_count(uint32_t cachelines);
+    // Work out the number of shards for a number of cache lines
+
+uint32_t fs3_cache_hash_size(int lineCount);
+    // Work out the number of hash buckets for a shard
+
+size_t fs3_cache_arena_size(uint32_t cachelines, int shardCount);
+    // Work out the bytes of arena the cache lines and shard indexes need
+
+uint32_t fs3_cache_budget_lines(uint64_t budget);
+    // Work out the most cache lines that fit in a memory budget
+
+uint32_t fs3_cache_max_lines(void);
+    // Work out the most lines the cache may have under the memory budget
+
+int fs3_map_cache_arena(size_t size);
+    // Map the zeroed arena the cache is carved from, using huge pages if available
+
+void * fs3_carve_cache_arena(size_t size);
+    // Take the next aligned array from the arena
+
+int fs3_unmap_cache_arena(void *arena, size_t size);
+    // Unmap an arena, freeing every cache line carved from it at once
+
+int fs3_close_cache_shards(FS3CacheShard *shards, int shardCount);
+    // Free the replacement policy of each shard, and the shards
 
 int fs3_close_cache(void);
     // Close the cache, freeing any buffers held in it
 
+int fs3_free_cache(void);
+    // Free whichever parts of the cache have been built, for a close or a failed init
+
+int fs3_resize_cache(uint32_t cachelines);
+    // Grow or shrink the cache while it is in use, keeping the most recently used lines
+
+int fs3_resize_cache_locked(uint32_t cachelines);
+    // Grow or shrink the cache, with the disk lock already held
+
+int fs3_save_cache(FS3CacheSnapshot *snapshot);
+    // Keep the cache in use, to go back to if a resize fails
+
+int fs3_restore_cache(const FS3CacheSnapshot *snapshot);
+    // Go back to a kept cache, freeing whatever part of a new cache was built
+
+int fs3_restore_cache_policy(FS3CacheShard *shard, int *order, int orderCount);
+    // Give the lines a shard's replacement policy gave up for a resize back to it
+
+int fs3_drop_cache_line(FS3CacheShard *oldShard, int line);
+    // Send the write of a line that does not fit in a shrunk cache, if dirty, leaving the line as it is
+
+int fs3_retire_cache_line(FS3CacheShard *oldShard, int line);
+    // Count a line dropped by a shrink in the retired metrics
+
+int fs3_move_cache_line(FS3CacheShard *oldShard, int line);
+    // Move a line into the resized cache
+
+uint32_t fs3_cache_tune_step(uint32_t cachelines);
+    // Work out how many lines the auto-tuner grows a cache by
+
+int fs3_tune_cache(void);
+    // Grow the cache if enough recent misses would have been hits with more lines (disk lock held)
+
 int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
     // Put an element in the cache
 
 void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct);
-    // Get an element from the cache (returns NULL if not found)
+    // Get a copy of an element from the cache, kept for the calling thread until its next get (returns NULL if not found)
+
+int fs3_get_cache_ref(FS3TrackIndex trk, FS3SectorIndex sct, FS3CacheRef *ref);
+    // Get an element from the cache, pinning its line until released (returns -1 if not found)
+
+int fs3_release_cache_ref(FS3CacheRef *ref);
+    // Release a line pinned by fs3_get_cache_ref
+
+int fs3_put_cache_dirty(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Put a written element in the cache to be flushed later (write-back mode only)
+
+int fs3_put_cache_prefetch(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Put an element read ahead of a sequential reader in the cache
+
+int fs3_cache_contains(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Check if an element is in the cache, without counting it as a use
+
+int fs3_cache_lines(void);
+    // Get the number of lines in the cache
+
+int fs3_find_put_line(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct, int *found, FS3CacheVictim *victim);
+    // Find the line of a shard a sector should be put in, copying out the line it evicts if dirty (returns -1 if not let in)
+
+int fs3_begin_cache_eviction(FS3CacheVictim *victim, int evicting);
+    // Start a use of the cache that may evict a dirty line, holding the disk first in write-back mode
+
+int fs3_end_cache_eviction(FS3CacheVictim *victim);
+    // Write back the dirty line a use of the cache evicted, with its shard unlocked, and release the disk
+
+uint32_t fs3_cache_hash(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Work out the hash of a sector, picking its shard and hash bucket
+
+FS3CacheShard * fs3_lock_cache_shard(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Lock the shard of the cache a sector belongs to, holding off any resize
+
+int fs3_unlock_cache_shard(FS3CacheShard *shard);
+    // Unlock a shard locked by fs3_lock_cache_shard
+
+int fs3_lock_all_cache_shards(void);
+    // Lock every shard lock, so the whole cache can be used or changed at once
+
+int fs3_unlock_all_cache_shards(void);
+    // Unlock every shard lock
+
+FS3CacheShard * fs3_cache_shard(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Find the shard of the cache a sector belongs to
+
+int fs3_find_cache_line(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct);
+    // Find the line of a shard holding a sector (returns -1 if not found)
+
+int fs3_lookup_cache_line(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct, FS3CacheVictim *victim);
+    // Look up a sector being read, counting the get and telling the replacement policy (returns -1 if not found)
+
+int fs3_promote_cache_l2_line(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct, FS3CacheVictim *victim);
+    // Bring a sector that missed back from the second level cache into a line
+
+int fs3_wait_cache_sector_unpinned(FS3CacheShard *shard, FS3TrackIndex trk, FS3SectorIndex sct);
+    // Wait until no reader holds the line of a sector, so its data can be changed
+
+int fs3_hash_cache_line(FS3CacheShard *shard, int line);
+    // Add a line of a shard to the hash bucket of the sector it holds
+
+int fs3_unhash_cache_line(FS3CacheShard *shard, int line);
+    // Remove a line of a shard from the hash bucket of the sector it holds
+
+int fs3_flush_cache(void);
+    // Write every dirty element of the cache back to the disk, in track order
+
+int fs3_take_cache_dirty(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Copy out a sector the cache holds a write of and mark it clean (returns 1 if it was dirty)
+
+int fs3_compare_cache_lines(const void *a, const void *b);
+    // Order two cache line indexes by track, then sector
+
+void * fs3_cache_flusher(void *arg);
+    // Background thread that periodically flushes the cache
+
+int fs3_sum_cache_metrics(FS3CacheMetrics *total);
+    // Add up the metrics of every shard of the cache
+
+int fs3_add_cache_metrics(FS3CacheMetrics *total, FS3CacheMetrics *metrics);
+    // Add one set of cache metrics into a total
+
+int fs3_count_cache_eviction(FS3CacheMetrics *metrics, FS3CacheLines *lines, int line);
+    // Count a line losing its sector in a set of metrics, by whether it was dirty and how long it was held
+
+int fs3_cache_histogram_bucket(uint64_t value);
+    // Work out the telemetry histogram bucket of a value, the number of bits it needs
+
+uint64_t fs3_cache_clock(void);
+    // Get the microseconds on the monotonic clock, which line residency times are measured by
+
+int fs3_write_cache_metrics_json(FILE *out);
+    // Write the cache's metrics, track heat and histograms as a JSON object
 
 int fs3_log_cache_metrics(void);
     // Log the metrics for the cache 
@@ -0,0 +1,315 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cache_bench.c
+//  Description    : This is a microbenchmark of the FS3 sector cache. It fills
+//                   caches from 8 to 65535 lines and times lookups that hit,
+//                   lookups that miss and puts that evict, to show what each
+//                   costs does not grow with the size of the cache. With -t it
+//                   instead times read hits from more and more threads at once,
+//                   to show how the sharded cache scales across processors.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/13/2021
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_cache.h>
+#include <fs3_cache_policy.h>
+
+// Defines
+#define FS3_CACHE_BENCH_ARGUMENTS "he:n:s:t:"
+#define FS3_CACHE_BENCH_LOOKUPS 1000000 // lookups timed for each cache size by default
+#define FS3_CACHE_BENCH_THREAD_LINES 4096 // cache lines of the cache read from many threads
+#define FS3_CACHE_BENCH_MAX_THREADS 64  // most threads reading at once
+#define FS3_DISK_SECTORS (FS3_MAX_TRACKS * FS3_TRACK_SIZE)
+#define USAGE \
+    "USAGE: fs3_cache_bench [-h] [-e <policy>] [-n <lookups>] [-s <shards>] [-t <threads>]\n" \
+    "\n" \
+    "where:\n" \
+    "    -h - help mode (display this message)\n" \
+    "    -e - set the cache replacement policy (lru, clock, 2q, arc, tinylfu)\n" \
+    "    -n - set the number of lookups timed for each cache size, or by each thread\n" \
+    "    -s - set the most shards the cache is split into (a power of 2)\n" \
+    "    -t - time read hits from 1 thread, then twice as many, up to <threads> at once\n" \
+    "\n" \
+
+//
+// Global Data
+    const uint32_t fs3BenchCacheSizes[] = {8, 64, 512, 4096, 32768, 65535}; // cache lines of each cache timed
+    int fs3BenchLookups = FS3_CACHE_BENCH_LOOKUPS; // lookups timed for each cache size, or by each thread
+
+//
+// Functional Prototypes
+
+int bench_cache_size(uint32_t cachelines, int lookups); // time the lookups and puts of one cache size
+int bench_cache_threads(int maxThreads);  // time read hits from more and more threads at once
+void * bench_read_hits(void *arg);        // look up held sectors from one thread
+uint32_t bench_next_sector(uint32_t *seed, uint32_t range); // pick the next sector, from 0 to range - 1
+double bench_clock(void);                 // nanoseconds on the monotonic clock
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the cache microbenchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+    // Local variables
+    int ch;
+    int threads = 0;
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, FS3_CACHE_BENCH_ARGUMENTS)) != -1){
+        switch(ch){
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'e': // Set the cache replacement policy
+            if((fs3_cache_policy = fs3_find_cache_policy(optarg)) == -1){
+                fprintf(stderr, "Unknown cache replacement policy [%s]\n", optarg);
+                return(-1);
+            }
+            break;
+
+        case 'n': // Set the number of lookups
+            if((sscanf(optarg, "%d", &fs3BenchLookups) != 1) || (fs3BenchLookups <= 0)){
+                fprintf(stderr, "Bad number of lookups [%s]\n", optarg);
+                return(-1);
+            }
+            break;
+
+        case 's': // Set the most cache shards
+            if((sscanf(optarg, "%hu", &fs3_cache_shards) != 1) || (fs3_cache_shards == 0)){
+                fprintf(stderr, "Bad cache shard count [%s]\n", optarg);
+                return(-1);
+            }
+            break;
+
+        case 't': // Time read hits from many threads
+            if((sscanf(optarg, "%d", &threads) != 1) || (threads <= 0) || (threads > FS3_CACHE_BENCH_MAX_THREADS)){
+                fprintf(stderr, "Bad number of threads [%s]\n", optarg);
+                return(-1);
+            }
+            break;
+
+        default:  // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+
+    // Setup the log as needed
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    enableLogLevels(LOG_ERROR_LEVEL);
+
+    if(threads > 0){
+        return(bench_cache_threads(threads));
+    }
+
+    printf("%8s %12s %12s %12s %10s\n", "lines", "hit (ns)", "miss (ns)", "put (ns)", "held hit");
+    int i;
+    for(i = 0; i < (int)(sizeof(fs3BenchCacheSizes) / sizeof(fs3BenchCacheSizes[0])); i++){
+        if(bench_cache_size(fs3BenchCacheSizes[i], fs3BenchLookups) == -1){
+            fprintf(stderr, "Failed timing a cache of %u lines\n", fs3BenchCacheSizes[i]);
+            return(-1);
+        }
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_size
+// Description  : Fills a cache of a number of lines, then times lookups of
+//                sectors it holds, lookups of sectors it does not, and puts of
+//                sectors from twice as many as it holds, so about half evict
+//
+// Inputs       : cachelines - the number of cache lines
+//                lookups - number of each kind of operation timed
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_cache_size(uint32_t cachelines, int lookups) {
+    uint8_t buf[FS3_SECTOR_SIZE];
+    memset(buf, 0, FS3_SECTOR_SIZE);
+    if(fs3_init_cache(cachelines) == -1){
+        return(-1);
+    }
+
+    // fills every line, with sectors 0 to cachelines - 1
+    uint32_t k;
+    for(k = 0; k < cachelines; k++){
+        if(fs3_put_cache(k / FS3_TRACK_SIZE, k % FS3_TRACK_SIZE, buf) == -1){
+            fs3_close_cache();
+            return(-1);
+        }
+    }
+
+    uint32_t seed = 1;
+    int i;
+    uint32_t hits = 0;
+
+    // looks up sectors the cache holds
+    double start = bench_clock();
+    for(i = 0; i < lookups; i++){
+        k = bench_next_sector(&seed, cachelines);
+        if(fs3_get_cache(k / FS3_TRACK_SIZE, k % FS3_TRACK_SIZE) != NULL){
+            hits = hits + 1;
+        }
+    }
+    double hitTime = bench_clock() - start;
+
+    // looks up sectors past the ones the cache holds
+    start = bench_clock();
+    for(i = 0; i < lookups; i++){
+        k = cachelines + bench_next_sector(&seed, FS3_DISK_SECTORS - cachelines);
+        fs3_get_cache(k / FS3_TRACK_SIZE, k % FS3_TRACK_SIZE);
+    }
+    double missTime = bench_clock() - start;
+
+    // puts sectors from twice as many as the cache holds
+    start = bench_clock();
+    for(i = 0; i < lookups; i++){
+        k = bench_next_sector(&seed, 2 * cachelines) % FS3_DISK_SECTORS;
+        fs3_put_cache(k / FS3_TRACK_SIZE, k % FS3_TRACK_SIZE, buf);
+    }
+    double putTime = bench_clock() - start;
+
+    // a few held sectors may have been evicted by the fill, if they hash unevenly between the shards
+    printf("%8u %12.1f %12.1f %12.1f %9.2f%%\n", cachelines, hitTime / lookups, missTime / lookups, putTime / lookups,
+        (100.0 * hits) / lookups);
+
+    return(fs3_close_cache());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_threads
+// Description  : Fills a cache, then has 1 thread look up the sectors it holds,
+//                then 2 at once, doubling up to a most, each thread making the
+//                same number of lookups, and reports the lookups made each second
+//                by them all and how many times the 1 thread's rate that is
+//
+// Inputs       : maxThreads - the most threads reading at once
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_cache_threads(int maxThreads) {
+    uint8_t buf[FS3_SECTOR_SIZE];
+    memset(buf, 0, FS3_SECTOR_SIZE);
+    if(fs3_init_cache(FS3_CACHE_BENCH_THREAD_LINES) == -1){
+        return(-1);
+    }
+    uint32_t k;
+    for(k = 0; k < FS3_CACHE_BENCH_THREAD_LINES; k++){
+        fs3_put_cache(k / FS3_TRACK_SIZE, k % FS3_TRACK_SIZE, buf);
+    }
+
+    printf("%8s %8s %16s %10s\n", "shards", "threads", "lookups/s", "speedup");
+    double singleRate = 0;
+    int threads = 1;
+    while(threads <= maxThreads){
+        // starts every thread, each with its own sequence of sectors, and waits for them all
+        pthread_t readers[FS3_CACHE_BENCH_MAX_THREADS];
+        double start = bench_clock();
+        int i;
+        for(i = 0; i < threads; i++){
+            if(pthread_create(&readers[i], NULL, bench_read_hits, (void *)(intptr_t)(i + 1)) != 0){
+                fprintf(stderr, "Failed starting a reading thread\n");
+                fs3_close_cache();
+                return(-1);
+            }
+        }
+        for(i = 0; i < threads; i++){
+            pthread_join(readers[i], NULL);
+        }
+        double rate = ((double)threads * fs3BenchLookups * 1e9) / (bench_clock() - start);
+
+        if(threads == 1){
+            singleRate = rate;
+        }
+        printf("%8d %8d %16.0f %9.2fx\n", fs3_cache_shard_count(FS3_CACHE_BENCH_THREAD_LINES), threads, rate, rate / singleRate);
+
+        // doubles the threads, ending on the most asked for
+        if((threads < maxThreads) && (threads * 2 > maxThreads)){
+            threads = maxThreads;
+        } else {
+            threads = threads * 2;
+        }
+    }
+
+    return(fs3_close_cache());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_read_hits
+// Description  : Looks up sectors the cache holds from one thread, pinning each
+//                and copying its data out as a reader of the cache does
+//
+// Inputs       : arg - the seed of the thread's sequence of sectors
+// Outputs      : NULL
+
+void * bench_read_hits(void *arg) {
+    uint32_t seed = (uint32_t)(intptr_t)arg;
+    uint8_t copy[FS3_SECTOR_SIZE];
+    FS3CacheRef ref;
+    int i;
+    for(i = 0; i < fs3BenchLookups; i++){
+        uint32_t k = bench_next_sector(&seed, FS3_CACHE_BENCH_THREAD_LINES);
+        if(fs3_get_cache_ref(k / FS3_TRACK_SIZE, k % FS3_TRACK_SIZE, &ref) == 0){
+            memcpy(copy, ref.data, FS3_SECTOR_SIZE);
+            fs3_release_cache_ref(&ref);
+        }
+    }
+
+    return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_next_sector
+// Description  : Picks the next sector with a linear congruential generator,
+//                cheap enough not to hide the cost of a lookup
+//
+// Inputs       : seed - the state of the generator
+//                range - number of sectors to pick from
+// Outputs      : the sector, from 0 to range - 1
+
+uint32_t bench_next_sector(uint32_t *seed, uint32_t range) {
+    *seed = (*seed * 1103515245) + 12345;
+
+    return((*seed >> 8) % range);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_clock
+// Description  : Reads the monotonic clock
+//
+// Inputs       : none
+// Outputs      : nanoseconds on the monotonic clock
+
+double bench_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return((now.tv_sec * 1e9) + now.tv_nsec);
+}
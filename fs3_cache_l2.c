@@ -0,0 +1,356 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cache_l2.c
+//  Description    : This is the implementation of the second level of the cache
+//                   for the FS3 filesystem interface. Clean sectors evicted from
+//                   the cache in memory are kept in a memory mapped file on the
+//                   local disk, which is checked before the network and kept
+//                   across runs of the client. The file records the epoch of the
+//                   remote disk its sectors came from, and is emptied when
+//                   opened against any other.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/9/2021
+//
+
+// Includes
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_cache_l2.h>
+#include <fs3_network.h>
+#include <fs3_driver.h>
+
+// Defines
+#define FS3_L2_KEY(trk, sct) (((uint32_t)(trk) * FS3_TRACK_SIZE) + (uint32_t)(sct)) // one number for a sector
+#define FS3_L2_MAGIC 0x3243414345335346ull     // "FS3ECAC2" read as a little endian number
+#define FS3_L2_VERSION 1
+#define FS3_L2_PAGE_SIZE 4096                  // alignment of the key table and sector data in the file
+#define FS3_L2_HASH_MULTIPLIER 2654435761u     // spreads sector keys across the sets
+#define FS3_L2_EPOCH_BASIS 14695981039346656037ull // FNV-1a hash of the disk epoch and server
+#define FS3_L2_EPOCH_PRIME 1099511628211ull
+
+// Static Global Variables
+    void *l2Map = NULL;           // the whole mapped file
+    size_t l2MapSize;
+    FS3CacheL2Header *l2Header;
+    uint32_t *l2Keys;             // sector held by each line plus one, 0 if empty
+    uint8_t *l2Data;              // sector data of each line
+    uint32_t l2Sets;              // number of sets of FS3_L2_WAYS lines
+    uint8_t *l2Hands;             // next way replaced in each set
+    pthread_mutex_t l2Lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Global Variables
+    char *fs3_cache_l2_path = NULL;                    // File holding the second level cache, NULL for none
+    uint32_t fs3_cache_l2_lines = FS3_DEFAULT_L2_LINES; // Sectors the second level cache file holds
+    uint64_t fs3_cache_l2_epoch = 0;                   // Epoch of the remote disk, changed whenever its contents are replaced
+
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_open_cache_l2
+// Description  : Map the second level cache file, creating it if needed. Its
+//                sectors are kept only if it was closed cleanly by a client of
+//                the same layout and disk epoch, otherwise it is emptied
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_open_cache_l2(void) {
+    // checks that there is a file to use, and that it is not already open
+    if((fs3_cache_l2_path == NULL) || (l2Map != NULL)){
+        return(-1);
+    }
+
+    // works out the layout of the file, a whole number of sets
+    uint32_t lines = fs3_cache_l2_lines - (fs3_cache_l2_lines % FS3_L2_WAYS);
+    if(lines == 0){
+        return(-1);
+    }
+    size_t keysSize = ((lines * sizeof(uint32_t)) + FS3_L2_PAGE_SIZE - 1) & ~((size_t)FS3_L2_PAGE_SIZE - 1);
+    size_t mapSize = FS3_L2_PAGE_SIZE + keysSize + ((size_t)lines * FS3_SECTOR_SIZE);
+
+    // opens the file, sizing it to the layout
+    int fd = open(fs3_cache_l2_path, O_RDWR | O_CREAT, 0644);
+    if(fd == -1){
+        return(-1);
+    }
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) == -1){
+        close(fd);
+        return(-1);
+    }
+    if(((size_t)fileStat.st_size != mapSize) && (ftruncate(fd, (off_t)mapSize) == -1)){
+        close(fd);
+        return(-1);
+    }
+
+    // maps the file, which stays mapped once the descriptor is closed
+    void *map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        return(-1);
+    }
+    l2Hands = calloc(lines / FS3_L2_WAYS, sizeof(uint8_t));
+    if(l2Hands == NULL){
+        munmap(map, mapSize);
+        return(-1);
+    }
+
+    // sets global variables
+    l2Map = map;
+    l2MapSize = mapSize;
+    l2Header = map;
+    l2Keys = (uint32_t *)((uint8_t *)map + FS3_L2_PAGE_SIZE);
+    l2Data = (uint8_t *)map + FS3_L2_PAGE_SIZE + keysSize;
+    l2Sets = lines / FS3_L2_WAYS;
+
+    // empties the file unless it holds sectors of this disk epoch, left by a client that closed it
+    uint64_t epoch = fs3_cache_l2_file_epoch();
+    if((l2Header->magic != FS3_L2_MAGIC) || (l2Header->version != FS3_L2_VERSION) ||
+        (l2Header->lines != lines) || (l2Header->epoch != epoch) || (l2Header->inUse != 0)){
+        logMessage(FS3DriverLLevel, "Second level cache [%s] emptied (%s)", fs3_cache_l2_path,
+            (l2Header->magic != FS3_L2_MAGIC) ? "new file" :
+            ((l2Header->inUse != 0) ? "not closed cleanly" :
+            ((l2Header->epoch != epoch) ? "other disk epoch" : "other layout")));
+        memset(l2Keys, 0, lines * sizeof(uint32_t));
+        l2Header->magic = FS3_L2_MAGIC;
+        l2Header->version = FS3_L2_VERSION;
+        l2Header->lines = lines;
+        l2Header->epoch = epoch;
+    } else {
+        logMessage(FS3DriverLLevel, "Second level cache [%s] kept %d sectors", fs3_cache_l2_path, fs3_cache_l2_valid_lines());
+    }
+
+    // marks the file in use before any line changes, so a crash leaves it to be emptied
+    l2Header->inUse = 1;
+    if(msync(l2Header, FS3_L2_PAGE_SIZE, MS_SYNC) == -1){
+        fs3_close_cache_l2();
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_close_cache_l2
+// Description  : Write the second level cache back to its file and unmap it,
+//                marking the file safe to reuse only once its lines are written
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_close_cache_l2(void) {
+    // checks that the file is open
+    if(l2Map == NULL){
+        return(-1);
+    }
+
+    // writes every line, then clears the in use mark
+    int result = 0;
+    if(msync(l2Map, l2MapSize, MS_SYNC) == -1){
+        result = -1;
+    } else {
+        l2Header->inUse = 0;
+        if(msync(l2Header, FS3_L2_PAGE_SIZE, MS_SYNC) == -1){
+            result = -1;
+        }
+    }
+
+    munmap(l2Map, l2MapSize);
+    free(l2Hands);
+    l2Map = NULL;
+    l2Hands = NULL;
+
+    return(result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_l2_open
+// Description  : Check if the second level cache is open
+//
+// Inputs       : none
+// Outputs      : 1 if open, 0 if not
+
+int fs3_cache_l2_open(void) {
+    return((l2Map != NULL) ? 1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_l2_file_epoch
+// Description  : Work out the epoch stored in the file, from the epoch of the
+//                remote disk and the server it is on, so a file filled from one
+//                server is never read for another
+//
+// Inputs       : none
+// Outputs      : the epoch
+
+uint64_t fs3_cache_l2_file_epoch(void) {
+    const char *ip = (fs3_network_address == NULL) ? FS3_DEFAULT_IP : (const char *)fs3_network_address;
+    uint16_t port = (fs3_network_port == 0) ? FS3_DEFAULT_PORT : fs3_network_port;
+
+    uint64_t epoch = FS3_L2_EPOCH_BASIS;
+    int i;
+    for(i = 0; i < 8; i++){
+        epoch = (epoch ^ ((fs3_cache_l2_epoch >> (i * 8)) & 0xff)) * FS3_L2_EPOCH_PRIME;
+    }
+    for(i = 0; ip[i] != '\0'; i++){
+        epoch = (epoch ^ (uint8_t)ip[i]) * FS3_L2_EPOCH_PRIME;
+    }
+    epoch = (epoch ^ (port & 0xff)) * FS3_L2_EPOCH_PRIME;
+    epoch = (epoch ^ (port >> 8)) * FS3_L2_EPOCH_PRIME;
+
+    return(epoch);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_put_cache_l2
+// Description  : Keep a clean sector evicted from the cache in memory, in its
+//                line of the file if already held, or else in the next way of
+//                its set
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+//                buf - the data of the sector, the same as on the disk
+// Outputs      : 0 if kept, -1 if the file is not open
+
+int fs3_put_cache_l2(FS3TrackIndex trk, FS3SectorIndex sct, const void *buf) {
+    if(l2Map == NULL){
+        return(-1);
+    }
+
+    uint32_t key = FS3_L2_KEY(trk, sct);
+    pthread_mutex_lock(&l2Lock);
+
+    int line = fs3_find_cache_l2_line(key);
+    if(line == -1){
+        // takes an empty way of the set, or else the next one round
+        uint32_t set = (key * FS3_L2_HASH_MULTIPLIER) % l2Sets;
+        int way;
+        line = -1;
+        for(way = 0; way < FS3_L2_WAYS; way++){
+            if(l2Keys[(set * FS3_L2_WAYS) + way] == 0){
+                line = (int)(set * FS3_L2_WAYS) + way;
+                break;
+            }
+        }
+        if(line == -1){
+            line = (int)(set * FS3_L2_WAYS) + l2Hands[set];
+            l2Hands[set] = (uint8_t)((l2Hands[set] + 1) % FS3_L2_WAYS);
+        }
+        l2Keys[line] = key + 1;
+    }
+    memcpy(l2Data + ((size_t)line * FS3_SECTOR_SIZE), buf, FS3_SECTOR_SIZE);
+
+    pthread_mutex_unlock(&l2Lock);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_get_cache_l2
+// Description  : Copy a sector out of the second level cache
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+//                buf - buffer of FS3_SECTOR_SIZE bytes to copy the sector into
+// Outputs      : 0 if found, -1 if not held or the file is not open
+
+int fs3_get_cache_l2(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+    if(l2Map == NULL){
+        return(-1);
+    }
+
+    pthread_mutex_lock(&l2Lock);
+    int line = fs3_find_cache_l2_line(FS3_L2_KEY(trk, sct));
+    if(line != -1){
+        memcpy(buf, l2Data + ((size_t)line * FS3_SECTOR_SIZE), FS3_SECTOR_SIZE);
+    }
+    pthread_mutex_unlock(&l2Lock);
+
+    return((line == -1) ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_invalidate_cache_l2
+// Description  : Forget a sector being written, so its old data is never read
+//                back from the file
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : 0 if successful, -1 if the file is not open
+
+int fs3_invalidate_cache_l2(FS3TrackIndex trk, FS3SectorIndex sct) {
+    if(l2Map == NULL){
+        return(-1);
+    }
+
+    pthread_mutex_lock(&l2Lock);
+    int line = fs3_find_cache_l2_line(FS3_L2_KEY(trk, sct));
+    if(line != -1){
+        l2Keys[line] = 0;
+    }
+    pthread_mutex_unlock(&l2Lock);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_find_cache_l2_line
+// Description  : Find the line of the file holding a sector, looking through
+//                the ways of its set. The L2 lock must be held
+//
+// Inputs       : key - the sector's key
+// Outputs      : the line, -1 if not held
+
+int fs3_find_cache_l2_line(uint32_t key) {
+    uint32_t set = (key * FS3_L2_HASH_MULTIPLIER) % l2Sets;
+    int way;
+    for(way = 0; way < FS3_L2_WAYS; way++){
+        if(l2Keys[(set * FS3_L2_WAYS) + way] == key + 1){
+            return((int)(set * FS3_L2_WAYS) + way);
+        }
+    }
+
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_l2_valid_lines
+// Description  : Count the lines of the file holding a sector
+//
+// Inputs       : none
+// Outputs      : number of lines, 0 if the file is not open
+
+int fs3_cache_l2_valid_lines(void) {
+    if(l2Map == NULL){
+        return(0);
+    }
+
+    pthread_mutex_lock(&l2Lock);
+    int count = 0;
+    uint32_t i;
+    for(i = 0; i < l2Sets * FS3_L2_WAYS; i++){
+        if(l2Keys[i] != 0){
+            count = count + 1;
+        }
+    }
+    pthread_mutex_unlock(&l2Lock);
+
+    return(count);
+}
@@ -0,0 +1,68 @@
+#ifndef FS3_CACHE_L2_INCLUDED
+#define FS3_CACHE_L2_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cache_l2.h
+//  Description    : This is the interface for the second level of the sector
+//                   cache in the FS3 filesystem, a file on the local disk
+//                   holding sectors evicted from the cache in memory.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/9/2021
+//
+
+// Include
+#include <stdint.h>
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_DEFAULT_L2_LINES 16384 // sectors held by the second level cache file, by default (16 MB)
+#define FS3_L2_WAYS 4              // lines of the file each sector can be held in
+
+// Type Definitions
+    // header at the start of the second level cache file
+    typedef struct {
+        uint64_t magic;   // FS3_L2_MAGIC, so other files are not mistaken for a cache
+        uint32_t version; // layout of the file
+        uint32_t lines;   // number of sectors the file holds
+        uint64_t epoch;   // the remote disk the sectors were read from
+        uint32_t inUse;   // 1 while a client has the file open, so a crash leaves it untrusted
+        uint32_t unused;
+    } FS3CacheL2Header;
+
+// Global data
+extern char *fs3_cache_l2_path;       // File holding the second level cache, NULL for none
+extern uint32_t fs3_cache_l2_lines;   // Sectors the second level cache file holds
+extern uint64_t fs3_cache_l2_epoch;   // Epoch of the remote disk, changed whenever its contents are replaced
+
+// L2 Cache Functions
+
+int fs3_open_cache_l2(void);
+    // Map the second level cache file, discarding its sectors if they are not for this disk epoch
+
+int fs3_close_cache_l2(void);
+    // Write the second level cache back to its file and unmap it, marking it safe to reuse
+
+int fs3_cache_l2_open(void);
+    // Check if the second level cache is open (1 if open, 0 if not)
+
+uint64_t fs3_cache_l2_file_epoch(void);
+    // Work out the epoch stored in the file, from the disk epoch and the server it is on
+
+int fs3_put_cache_l2(FS3TrackIndex trk, FS3SectorIndex sct, const void *buf);
+    // Keep a clean sector evicted from the cache in memory
+
+int fs3_get_cache_l2(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Copy a sector out of the second level cache (returns -1 if not held)
+
+int fs3_invalidate_cache_l2(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Forget a sector being written, so an old copy is never read back
+
+int fs3_find_cache_l2_line(uint32_t key);
+    // Find the line of the file holding a sector (returns -1 if not held)
+
+int fs3_cache_l2_valid_lines(void);
+    // Count the lines of the file holding a sector
+
+#endif
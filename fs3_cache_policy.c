@@ -0,0 +1,1010 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cache_policy.c
+//  Description    : This is the implementation of the replacement policies of
+//                   the cache for the FS3 filesystem interface.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/9/2021
+//
+
+// Includes
+#include <string.h>
+#include <stdlib.h>
+
+// Project Includes
+#include <fs3_cache_policy.h>
+
+// Defines
+#define FS3_POLICY_KEY(trk, sct) (((uint32_t)(trk) * FS3_TRACK_SIZE) + (uint32_t)(sct)) // one number for a sector
+#define FS3_POLICY_HASH_MULTIPLIER 2654435761u // spreads sector keys across the ghost hash buckets
+#define FS3_SKETCH_ROWS 4             // number of counter rows in the TinyLFU frequency sketch
+#define FS3_SKETCH_MAX_COUNT 15       // largest count a sketch counter holds
+#define FS3_SKETCH_SAMPLES_PER_LINE 10 // uses counted per cache line before the sketch counts are halved
+#define FS3_CLOCK_EVICTED 2           // clock state of a line taken out by fs3_clock_evict
+
+// Global Variables
+    FS3CachePolicy fs3_cache_policies[FS3_CACHE_POLICY_COUNT] = {
+        { "lru", fs3_lru_init, fs3_lru_close, NULL, fs3_lru_hit, fs3_lru_place, fs3_lru_evict },
+        { "clock", fs3_clock_init, fs3_clock_close, NULL, fs3_clock_hit, fs3_clock_place, fs3_clock_evict },
+        { "2q", fs3_2q_init, fs3_2q_close, NULL, fs3_2q_hit, fs3_2q_place, fs3_2q_evict },
+        { "arc", fs3_arc_init, fs3_arc_close, NULL, fs3_arc_hit, fs3_arc_place, fs3_arc_evict },
+        { "tinylfu", fs3_tinylfu_init, fs3_tinylfu_close, fs3_tinylfu_access, fs3_lru_hit, fs3_tinylfu_place, fs3_lru_evict },
+    };
+
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_find_cache_policy
+// Description  : Find the number of a replacement policy from its name
+//
+// Inputs       : name - the name of the policy
+// Outputs      : number of the policy, -1 if there is no policy with the name
+
+int fs3_find_cache_policy(const char *name) {
+    int i;
+    for(i = 0; i < FS3_CACHE_POLICY_COUNT; i++){
+        if(strcmp(fs3_cache_policies[i].name, name) == 0){
+            return(i);
+        }
+    }
+
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_policy_list_init
+// Description  : Empty a policy list
+//
+// Inputs       : list - the list
+// Outputs      : 0 if successful
+
+int fs3_policy_list_init(FS3PolicyList *list) {
+    list->head = -1;
+    list->tail = -1;
+    list->size = 0;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_policy_list_push
+// Description  : Add an index at the head of a policy list
+//
+// Inputs       : list - the list
+//                prev - the previous index array of the list
+//                next - the next index array of the list
+//                i - the index to add
+// Outputs      : 0 if successful
+
+int fs3_policy_list_push(FS3PolicyList *list, int *prev, int *next, int i) {
+    prev[i] = -1;
+    next[i] = list->head;
+    if(list->head != -1){
+        prev[list->head] = i;
+    } else {
+        list->tail = i;
+    }
+    list->head = i;
+    list->size = list->size + 1;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_policy_list_remove
+// Description  : Remove an index from a policy list
+//
+// Inputs       : list - the list
+//                prev - the previous index array of the list
+//                next - the next index array of the list
+//                i - the index to remove
+// Outputs      : 0 if successful
+
+int fs3_policy_list_remove(FS3PolicyList *list, int *prev, int *next, int i) {
+    if(prev[i] != -1){
+        next[prev[i]] = next[i];
+    } else {
+        list->head = next[i];
+    }
+    if(next[i] != -1){
+        prev[next[i]] = prev[i];
+    } else {
+        list->tail = prev[i];
+    }
+    list->size = list->size - 1;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_policy_line_pinned
+// Description  : Check if a cache line is pinned by a reader, so it cannot be evicted
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                line - index of the cache line
+// Outputs      : 1 if the line is pinned, 0 if not
+
+int fs3_policy_line_pinned(FS3PolicyState *state, int line) {
+    if((state->pins != NULL) && (state->pins[line] > 0)){
+        return(1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_policy_list_victim
+// Description  : Finds the line to evict from a policy list, the oldest line in
+//                the list that is not pinned
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                list - which of the policy's lists to evict from
+// Outputs      : index of the line, -1 if every line in the list is pinned
+
+int fs3_policy_list_victim(FS3PolicyState *state, int list) {
+    int line = state->lists[list].tail;
+    while((line != -1) && (fs3_policy_line_pinned(state, line) == 1)){
+        line = state->prev[line];
+    }
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_policy_lines_init
+// Description  : Allocate the per line state shared by the list based policies,
+//                with both lists empty
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                lines - the number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_policy_lines_init(FS3PolicyState *state, int lines) {
+    state->lines = lines;
+    state->prev = malloc((lines + 1) * sizeof(int));
+    state->next = malloc((lines + 1) * sizeof(int));
+    state->listOf = malloc((lines + 1) * sizeof(int));
+    state->keys = malloc((lines + 1) * sizeof(uint32_t));
+    if((state->prev == NULL) || (state->next == NULL) || (state->listOf == NULL) || (state->keys == NULL)){
+        fs3_policy_lines_close(state);
+        return(-1);
+    }
+
+    fs3_policy_list_init(&state->lists[0]);
+    fs3_policy_list_init(&state->lists[1]);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_policy_lines_close
+// Description  : Free the per line state shared by the list based policies
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : 0 if successful
+
+int fs3_policy_lines_close(FS3PolicyState *state) {
+    free(state->prev);
+    free(state->next);
+    free(state->listOf);
+    free(state->keys);
+    state->prev = NULL;
+    state->next = NULL;
+    state->listOf = NULL;
+    state->keys = NULL;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ghost_init
+// Description  : Allocate the ghost entries, which record sectors recently
+//                evicted from the cache without their data
+//
+// Inputs       : ghosts - the ghost entries
+//                capacity - the most sectors recorded at once
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_ghost_init(FS3GhostSet *ghosts, int capacity) {
+    // allocates the hash index with at least twice as many buckets as entries, so chains stay short
+    uint32_t hashSize = 1;
+    while(hashSize < (2 * (uint32_t)capacity)){
+        hashSize = hashSize * 2;
+    }
+    ghosts->hashMask = hashSize - 1;
+
+    ghosts->capacity = capacity;
+    ghosts->keys = malloc((capacity + 1) * sizeof(uint32_t));
+    ghosts->prev = malloc((capacity + 1) * sizeof(int));
+    ghosts->next = malloc((capacity + 1) * sizeof(int));
+    ghosts->hashNext = malloc((capacity + 1) * sizeof(int));
+    ghosts->listOf = malloc((capacity + 1) * sizeof(int));
+    ghosts->freeNodes = malloc((capacity + 1) * sizeof(int));
+    ghosts->hashTable = malloc(hashSize * sizeof(int));
+    if((ghosts->keys == NULL) || (ghosts->prev == NULL) || (ghosts->next == NULL) || (ghosts->hashNext == NULL) ||
+        (ghosts->listOf == NULL) || (ghosts->freeNodes == NULL) || (ghosts->hashTable == NULL)){
+        fs3_ghost_close(ghosts);
+        return(-1);
+    }
+
+    // empties the hash index and both lists, and puts every entry on the free stack
+    int i;
+    for(i = 0; i < (int)hashSize; i++){
+        ghosts->hashTable[i] = -1;
+    }
+    for(i = 0; i < capacity; i++){
+        ghosts->freeNodes[i] = capacity - 1 - i;
+    }
+    ghosts->freeCount = capacity;
+    fs3_policy_list_init(&ghosts->lists[0]);
+    fs3_policy_list_init(&ghosts->lists[1]);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ghost_close
+// Description  : Free the ghost entries
+//
+// Inputs       : ghosts - the ghost entries
+// Outputs      : 0 if successful
+
+int fs3_ghost_close(FS3GhostSet *ghosts) {
+    free(ghosts->keys);
+    free(ghosts->prev);
+    free(ghosts->next);
+    free(ghosts->hashNext);
+    free(ghosts->listOf);
+    free(ghosts->freeNodes);
+    free(ghosts->hashTable);
+    ghosts->keys = NULL;
+    ghosts->prev = NULL;
+    ghosts->next = NULL;
+    ghosts->hashNext = NULL;
+    ghosts->listOf = NULL;
+    ghosts->freeNodes = NULL;
+    ghosts->hashTable = NULL;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ghost_find
+// Description  : Find the ghost entry of a sector
+//
+// Inputs       : ghosts - the ghost entries
+//                key - the sector
+// Outputs      : index of the ghost entry, -1 if the sector is not recorded
+
+int fs3_ghost_find(FS3GhostSet *ghosts, uint32_t key) {
+    int node = ghosts->hashTable[(key * FS3_POLICY_HASH_MULTIPLIER) & ghosts->hashMask];
+    while(node != -1){
+        if(ghosts->keys[node] == key){
+            return(node);
+        }
+        node = ghosts->hashNext[node];
+    }
+
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ghost_add
+// Description  : Record a sector at the head of a ghost list, forgetting the
+//                oldest sector of the list if every entry is in use
+//
+// Inputs       : ghosts - the ghost entries
+//                list - which ghost list to add to
+//                key - the sector
+// Outputs      : index of the ghost entry, -1 if failure
+
+int fs3_ghost_add(FS3GhostSet *ghosts, int list, uint32_t key) {
+    if(ghosts->capacity == 0){
+        return(-1);
+    }
+    if(ghosts->freeCount == 0){
+        fs3_ghost_remove_lru(ghosts, (ghosts->lists[list].size > 0) ? list : (1 - list));
+    }
+
+    // takes a free entry and links it into its hash bucket and list
+    ghosts->freeCount = ghosts->freeCount - 1;
+    int node = ghosts->freeNodes[ghosts->freeCount];
+    uint32_t bucket = (key * FS3_POLICY_HASH_MULTIPLIER) & ghosts->hashMask;
+    ghosts->keys[node] = key;
+    ghosts->listOf[node] = list;
+    ghosts->hashNext[node] = ghosts->hashTable[bucket];
+    ghosts->hashTable[bucket] = node;
+    fs3_policy_list_push(&ghosts->lists[list], ghosts->prev, ghosts->next, node);
+
+    return(node);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ghost_remove
+// Description  : Remove a ghost entry, giving it back to the free stack
+//
+// Inputs       : ghosts - the ghost entries
+//                node - index of the ghost entry
+// Outputs      : 0 if successful
+
+int fs3_ghost_remove(FS3GhostSet *ghosts, int node) {
+    // unlinks the entry from its hash bucket
+    int *link = &ghosts->hashTable[(ghosts->keys[node] * FS3_POLICY_HASH_MULTIPLIER) & ghosts->hashMask];
+    while(*link != node){
+        link = &ghosts->hashNext[*link];
+    }
+    *link = ghosts->hashNext[node];
+
+    // unlinks the entry from its list
+    fs3_policy_list_remove(&ghosts->lists[ghosts->listOf[node]], ghosts->prev, ghosts->next, node);
+
+    ghosts->freeNodes[ghosts->freeCount] = node;
+    ghosts->freeCount = ghosts->freeCount + 1;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ghost_remove_lru
+// Description  : Remove the oldest entry of a ghost list
+//
+// Inputs       : ghosts - the ghost entries
+//                list - which ghost list to remove from
+// Outputs      : 0 if successful, -1 if the list is empty
+
+int fs3_ghost_remove_lru(FS3GhostSet *ghosts, int list) {
+    if(ghosts->lists[list].tail == -1){
+        return(-1);
+    }
+
+    return(fs3_ghost_remove(ghosts, ghosts->lists[list].tail));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lru_init
+// Description  : LRU policy, sets up an empty use list
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                lines - the number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_lru_init(FS3PolicyState *state, int lines) {
+    return(fs3_policy_lines_init(state, lines));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lru_close
+// Description  : LRU policy, frees the use list
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : 0 if successful
+
+int fs3_lru_close(FS3PolicyState *state) {
+    return(fs3_policy_lines_close(state));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lru_hit
+// Description  : LRU policy, makes a line the most recently used by moving it
+//                to the head of the use list
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                line - index of the cache line
+// Outputs      : 0 if successful
+
+int fs3_lru_hit(FS3PolicyState *state, int line) {
+    if(state->lists[0].head != line){
+        fs3_policy_list_remove(&state->lists[0], state->prev, state->next, line);
+        fs3_policy_list_push(&state->lists[0], state->prev, state->next, line);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lru_place
+// Description  : LRU policy, picks the line for a new sector, the least
+//                recently used line if there is no free line
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                trk - the track number of the new sector
+//                sct - the sector number of the new sector
+//                freeLine - an empty line, -1 if every line is in use
+// Outputs      : index of the cache line, -1 if every line is pinned
+
+int fs3_lru_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine) {
+    int line = freeLine;
+    if(line == -1){
+        line = fs3_policy_list_victim(state, 0);
+        if(line == -1){
+            return(-1);
+        }
+        fs3_policy_list_remove(&state->lists[0], state->prev, state->next, line);
+    }
+
+    state->keys[line] = FS3_POLICY_KEY(trk, sct);
+    fs3_policy_list_push(&state->lists[0], state->prev, state->next, line);
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lru_evict
+// Description  : Takes the least recently used line that is not pinned out of
+//                the LRU, for when the cache is shrunk
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : index of the cache line, -1 if there is none to evict
+
+int fs3_lru_evict(FS3PolicyState *state) {
+    int line = fs3_policy_list_victim(state, 0);
+    if(line != -1){
+        fs3_policy_list_remove(&state->lists[0], state->prev, state->next, line);
+    }
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_clock_init
+// Description  : CLOCK policy, sets up the reference bits and the hand
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                lines - the number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_clock_init(FS3PolicyState *state, int lines) {
+    state->lines = lines;
+    state->clockReferenced = calloc(lines + 1, sizeof(uint8_t));
+    if(state->clockReferenced == NULL){
+        return(-1);
+    }
+    state->clockHand = 0;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_clock_close
+// Description  : CLOCK policy, frees the reference bits
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : 0 if successful
+
+int fs3_clock_close(FS3PolicyState *state) {
+    free(state->clockReferenced);
+    state->clockReferenced = NULL;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_clock_hit
+// Description  : CLOCK policy, marks a line as referenced
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                line - index of the cache line
+// Outputs      : 0 if successful
+
+int fs3_clock_hit(FS3PolicyState *state, int line) {
+    state->clockReferenced[line] = 1;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_clock_place
+// Description  : CLOCK policy, picks the line for a new sector, moving the hand
+//                round the lines and clearing reference bits until it finds a
+//                line that has not been referenced since the hand last passed
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                trk - the track number of the new sector
+//                sct - the sector number of the new sector
+//                freeLine - an empty line, -1 if every line is in use
+// Outputs      : index of the cache line, -1 if every line is pinned
+
+int fs3_clock_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine) {
+    int line = freeLine;
+    if(line == -1){
+        // pinned lines are passed over, and after two full turns every line must be pinned
+        int passed = 0;
+        while((state->clockReferenced[state->clockHand] == 1) || (fs3_policy_line_pinned(state, state->clockHand) == 1)){
+            if(passed >= 2 * state->lines){
+                return(-1);
+            }
+            state->clockReferenced[state->clockHand] = 0;
+            state->clockHand = (state->clockHand + 1) % state->lines;
+            passed = passed + 1;
+        }
+        line = state->clockHand;
+        state->clockHand = (state->clockHand + 1) % state->lines;
+    }
+
+    state->clockReferenced[line] = 1;
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_clock_evict
+// Description  : Takes the next line the clock hand finds unreferenced out of
+//                the clock, for when the cache is shrunk
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : index of the cache line, -1 if there is none to evict
+
+int fs3_clock_evict(FS3PolicyState *state) {
+    // referenced lines are cleared as the hand passes, so three full turns pass every line twice
+    int passed = 0;
+    while(passed < 3 * state->lines){
+        int line = state->clockHand;
+        state->clockHand = (state->clockHand + 1) % state->lines;
+        passed = passed + 1;
+
+        if((state->clockReferenced[line] == FS3_CLOCK_EVICTED) || (fs3_policy_line_pinned(state, line) == 1)){
+            continue;
+        }
+        if(state->clockReferenced[line] == 1){
+            state->clockReferenced[line] = 0;
+            continue;
+        }
+        state->clockReferenced[line] = FS3_CLOCK_EVICTED;
+        return(line);
+    }
+
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_2q_init
+// Description  : 2Q policy, sets up the first-use FIFO (list 0), the main LRU
+//                (list 1) and the ghost list of sectors that left the FIFO
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                lines - the number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_2q_init(FS3PolicyState *state, int lines) {
+    // the FIFO is kept to a quarter of the cache, and half a cache of sectors is remembered after it
+    state->twoQInLimit = (lines / 4 > 0) ? (lines / 4) : 1;
+    state->twoQOutLimit = (lines / 2 > 0) ? (lines / 2) : 1;
+
+    if(fs3_policy_lines_init(state, lines) == -1){
+        return(-1);
+    }
+    if(fs3_ghost_init(&state->ghosts, state->twoQOutLimit) == -1){
+        fs3_policy_lines_close(state);
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_2q_close
+// Description  : 2Q policy, frees the lists
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : 0 if successful
+
+int fs3_2q_close(FS3PolicyState *state) {
+    fs3_ghost_close(&state->ghosts);
+    return(fs3_policy_lines_close(state));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_2q_hit
+// Description  : 2Q policy, makes a line in the main LRU the most recently used,
+//                lines still in the first-use FIFO are left where they are
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                line - index of the cache line
+// Outputs      : 0 if successful
+
+int fs3_2q_hit(FS3PolicyState *state, int line) {
+    if((state->listOf[line] == 1) && (state->lists[1].head != line)){
+        fs3_policy_list_remove(&state->lists[1], state->prev, state->next, line);
+        fs3_policy_list_push(&state->lists[1], state->prev, state->next, line);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_2q_place
+// Description  : 2Q policy, picks the line for a new sector, evicting from the
+//                first-use FIFO while it is over its limit and from the main LRU
+//                otherwise. A sector remembered from leaving the FIFO has been
+//                used again, so it goes in the main LRU, others go in the FIFO
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                trk - the track number of the new sector
+//                sct - the sector number of the new sector
+//                freeLine - an empty line, -1 if every line is in use
+// Outputs      : index of the cache line, -1 if every line is pinned
+
+int fs3_2q_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine) {
+    uint32_t key = FS3_POLICY_KEY(trk, sct);
+
+    int line = freeLine;
+    if(line == -1){
+        // evicts the oldest line of the FIFO if it is over its limit, otherwise the least
+        //  recently used line of the main LRU, using the other list if every line in it is pinned
+        int from = ((state->lists[0].size > state->twoQInLimit) || (state->lists[1].size == 0)) ? 0 : 1;
+        line = fs3_policy_list_victim(state, from);
+        if(line == -1){
+            from = 1 - from;
+            line = fs3_policy_list_victim(state, from);
+        }
+        if(line == -1){
+            return(-1);
+        }
+        fs3_policy_list_remove(&state->lists[from], state->prev, state->next, line);
+
+        // remembers the sectors evicted from the FIFO
+        if(from == 0){
+            fs3_ghost_add(&state->ghosts, 0, state->keys[line]);
+        }
+    }
+
+    // puts the sector in the main LRU if it was remembered, otherwise in the FIFO
+    int node = fs3_ghost_find(&state->ghosts, key);
+    int list = 0;
+    if(node != -1){
+        fs3_ghost_remove(&state->ghosts, node);
+        list = 1;
+    }
+    state->keys[line] = key;
+    state->listOf[line] = list;
+    fs3_policy_list_push(&state->lists[list], state->prev, state->next, line);
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_2q_evict
+// Description  : Takes the line 2Q would evict next out of its lists, for when
+//                the cache is shrunk
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : index of the cache line, -1 if there is none to evict
+
+int fs3_2q_evict(FS3PolicyState *state) {
+    int from = ((state->lists[0].size > state->twoQInLimit) || (state->lists[1].size == 0)) ? 0 : 1;
+    int line = fs3_policy_list_victim(state, from);
+    if(line == -1){
+        from = 1 - from;
+        line = fs3_policy_list_victim(state, from);
+    }
+    if(line != -1){
+        fs3_policy_list_remove(&state->lists[from], state->prev, state->next, line);
+    }
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_arc_init
+// Description  : ARC policy, sets up the lists of lines used once (list 0) and
+//                used more than once (list 1), and a ghost list of sectors
+//                recently evicted from each
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                lines - the number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_arc_init(FS3PolicyState *state, int lines) {
+    state->arcTarget = 0;
+
+    if(fs3_policy_lines_init(state, lines) == -1){
+        return(-1);
+    }
+    if(fs3_ghost_init(&state->ghosts, lines) == -1){
+        fs3_policy_lines_close(state);
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_arc_close
+// Description  : ARC policy, frees the lists
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : 0 if successful
+
+int fs3_arc_close(FS3PolicyState *state) {
+    fs3_ghost_close(&state->ghosts);
+    return(fs3_policy_lines_close(state));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_arc_hit
+// Description  : ARC policy, moves a line to the head of the list of lines used
+//                more than once
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                line - index of the cache line
+// Outputs      : 0 if successful
+
+int fs3_arc_hit(FS3PolicyState *state, int line) {
+    fs3_policy_list_remove(&state->lists[state->listOf[line]], state->prev, state->next, line);
+    state->listOf[line] = 1;
+    fs3_policy_list_push(&state->lists[1], state->prev, state->next, line);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_arc_place
+// Description  : ARC policy, picks the line for a new sector. A sector found in
+//                a ghost list moves the target size of the used-once list toward
+//                that list, then a line is evicted from the used-once list if it
+//                is over the target and from the used-more list otherwise
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                trk - the track number of the new sector
+//                sct - the sector number of the new sector
+//                freeLine - an empty line, -1 if every line is in use
+// Outputs      : index of the cache line, -1 if every line is pinned
+
+int fs3_arc_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine) {
+    uint32_t key = FS3_POLICY_KEY(trk, sct);
+    int ghostSizeOnce = state->ghosts.lists[0].size;
+    int ghostSizeMore = state->ghosts.lists[1].size;
+    int delta;
+
+    // adapts the target to where the sector was last evicted from, and forgets it as a ghost
+    int node = fs3_ghost_find(&state->ghosts, key);
+    int ghostList = -1;
+    int dropOnce = 0;
+    if(node != -1){
+        ghostList = state->ghosts.listOf[node];
+        if(ghostList == 0){
+            delta = (ghostSizeMore > ghostSizeOnce) ? (ghostSizeMore / ghostSizeOnce) : 1;
+            state->arcTarget = (state->arcTarget + delta < state->lines) ? (state->arcTarget + delta) : state->lines;
+        } else {
+            delta = (ghostSizeOnce > ghostSizeMore) ? (ghostSizeOnce / ghostSizeMore) : 1;
+            state->arcTarget = (state->arcTarget - delta > 0) ? (state->arcTarget - delta) : 0;
+        }
+        fs3_ghost_remove(&state->ghosts, node);
+    } else {
+        // a new sector keeps the used-once history to the size of the cache
+        if(state->lists[0].size + state->ghosts.lists[0].size >= state->lines){
+            if(state->lists[0].size < state->lines){
+                fs3_ghost_remove_lru(&state->ghosts, 0);
+            } else {
+                dropOnce = 1;
+            }
+        } else if(state->lists[0].size + state->lists[1].size + state->ghosts.lists[0].size + state->ghosts.lists[1].size >= 2 * state->lines){
+            fs3_ghost_remove_lru(&state->ghosts, 1);
+        }
+    }
+
+    int line = freeLine;
+    if(line == -1){
+        int evictOnce = (state->lists[0].size > 0) && ((state->lists[0].size > state->arcTarget) || ((ghostList == 1) && (state->lists[0].size == state->arcTarget)));
+        // evicts the least recently used line used once, or used more than once, using the
+        //  other list if every line in it is pinned
+        int from = ((evictOnce == 1) || (dropOnce == 1) || (state->lists[1].size == 0)) ? 0 : 1;
+        line = fs3_policy_list_victim(state, from);
+        if(line == -1){
+            from = 1 - from;
+            line = fs3_policy_list_victim(state, from);
+        }
+        if(line == -1){
+            return(-1);
+        }
+        fs3_policy_list_remove(&state->lists[from], state->prev, state->next, line);
+
+        // remembers the evicted sector, unless the used-once history is full
+        if((from == 1) || (dropOnce == 0)){
+            fs3_ghost_add(&state->ghosts, from, state->keys[line]);
+        }
+    }
+
+    // a sector found in either ghost list has been used before, so it goes in the used-more list
+    int list = (ghostList != -1) ? 1 : 0;
+    state->keys[line] = key;
+    state->listOf[line] = list;
+    fs3_policy_list_push(&state->lists[list], state->prev, state->next, line);
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_arc_evict
+// Description  : Takes the line ARC would evict next out of its lists, for when
+//                the cache is shrunk
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : index of the cache line, -1 if there is none to evict
+
+int fs3_arc_evict(FS3PolicyState *state) {
+    int from = ((state->lists[0].size > state->arcTarget) || (state->lists[1].size == 0)) ? 0 : 1;
+    int line = fs3_policy_list_victim(state, from);
+    if(line == -1){
+        from = 1 - from;
+        line = fs3_policy_list_victim(state, from);
+    }
+    if(line != -1){
+        fs3_policy_list_remove(&state->lists[from], state->prev, state->next, line);
+    }
+
+    return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_tinylfu_init
+// Description  : TinyLFU policy, sets up an LRU use list and an empty frequency
+//                sketch with about four counters per cache line in each row
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                lines - the number of cache lines
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_tinylfu_init(FS3PolicyState *state, int lines) {
+    uint32_t rowSize = 64;
+    while(rowSize < (4 * (uint32_t)lines)){
+        rowSize = rowSize * 2;
+    }
+    state->sketchMask = rowSize - 1;
+    state->sketchSamples = 0;
+    state->sketchSampleLimit = (lines > 0) ? (lines * FS3_SKETCH_SAMPLES_PER_LINE) : FS3_SKETCH_SAMPLES_PER_LINE;
+
+    state->sketchCounts = calloc(FS3_SKETCH_ROWS * rowSize, sizeof(uint8_t));
+    if(state->sketchCounts == NULL){
+        return(-1);
+    }
+    if(fs3_policy_lines_init(state, lines) == -1){
+        free(state->sketchCounts);
+        state->sketchCounts = NULL;
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_tinylfu_close
+// Description  : TinyLFU policy, frees the use list and the frequency sketch
+//
+// Inputs       : state - the replacement policy state of the cache lines
+// Outputs      : 0 if successful
+
+int fs3_tinylfu_close(FS3PolicyState *state) {
+    free(state->sketchCounts);
+    state->sketchCounts = NULL;
+
+    return(fs3_policy_lines_close(state));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_tinylfu_access
+// Description  : TinyLFU policy, counts a use of a sector in each row of the
+//                frequency sketch, halving every count once enough uses have been
+//                counted so old uses fade
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                trk - the track number of the sector
+//                sct - the sector number of the sector
+// Outputs      : 0 if successful
+
+int fs3_tinylfu_access(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct) {
+    uint32_t key = FS3_POLICY_KEY(trk, sct);
+
+    // increments the sector's counter in each row, up to the largest count
+    int row;
+    for(row = 0; row < FS3_SKETCH_ROWS; row++){
+        uint32_t hash = (key + row) * FS3_POLICY_HASH_MULTIPLIER;
+        hash = hash ^ (hash >> 15);
+        uint8_t *counter = &state->sketchCounts[(row * (state->sketchMask + 1)) + (hash & state->sketchMask)];
+        if(*counter < FS3_SKETCH_MAX_COUNT){
+            *counter = *counter + 1;
+        }
+    }
+
+    // halves every count after enough uses
+    state->sketchSamples = state->sketchSamples + 1;
+    if(state->sketchSamples >= state->sketchSampleLimit){
+        uint32_t i;
+        for(i = 0; i < FS3_SKETCH_ROWS * (state->sketchMask + 1); i++){
+            state->sketchCounts[i] = state->sketchCounts[i] / 2;
+        }
+        state->sketchSamples = state->sketchSamples / 2;
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_tinylfu_estimate
+// Description  : TinyLFU policy, estimates how often a sector has been used as
+//                the smallest of its counters in the frequency sketch
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                key - the sector
+// Outputs      : the estimated number of uses
+
+int fs3_tinylfu_estimate(FS3PolicyState *state, uint32_t key) {
+    int estimate = FS3_SKETCH_MAX_COUNT;
+    int row;
+    for(row = 0; row < FS3_SKETCH_ROWS; row++){
+        uint32_t hash = (key + row) * FS3_POLICY_HASH_MULTIPLIER;
+        hash = hash ^ (hash >> 15);
+        int count = state->sketchCounts[(row * (state->sketchMask + 1)) + (hash & state->sketchMask)];
+        if(count < estimate){
+            estimate = count;
+        }
+    }
+
+    return(estimate);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_tinylfu_place
+// Description  : TinyLFU policy, picks the line for a new sector as LRU does, but
+//                when the cache is full the sector is only let in if it has been
+//                used more often than the least recently used line it would evict
+//
+// Inputs       : state - the replacement policy state of the cache lines
+//                trk - the track number of the new sector
+//                sct - the sector number of the new sector
+//                freeLine - an empty line, -1 if every line is in use
+// Outputs      : index of the cache line, -1 if the sector is kept out of the cache or every line is pinned
+
+int fs3_tinylfu_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine) {
+    if(freeLine == -1){
+        int victim = fs3_policy_list_victim(state, 0);
+        if(victim == -1){
+            return(-1);
+        }
+        if(fs3_tinylfu_estimate(state, FS3_POLICY_KEY(trk, sct)) < fs3_tinylfu_estimate(state, state->keys[victim])){
+            return(-1);
+        }
+    }
+
+    return(fs3_lru_place(state, trk, sct, freeLine));
+}
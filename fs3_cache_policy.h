@@ -0,0 +1,214 @@
+#ifndef FS3_CACHE_POLICY_INCLUDED
+#define FS3_CACHE_POLICY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cache_policy.h
+//  Description    : This is the interface for the replacement policies of the
+//                   sector cache in the FS3 filesystem.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/9/2021
+//
+
+// Include
+#include <stdint.h>
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_CACHE_POLICY_LRU 0     // evicts the least recently used line
+#define FS3_CACHE_POLICY_CLOCK 1   // evicts the first line the clock hand finds unreferenced
+#define FS3_CACHE_POLICY_2Q 2      // keeps lines used once apart from lines used again
+#define FS3_CACHE_POLICY_ARC 3     // balances recency against frequency from recently evicted sectors
+#define FS3_CACHE_POLICY_TINYLFU 4 // LRU, only letting in sectors used more often than the victim
+#define FS3_CACHE_POLICY_COUNT 5   // number of replacement policies
+
+// Type Definitions
+    // list of line (or ghost entry) indexes, linked through separate prev and next arrays
+    typedef struct {
+        int head; // most recently added, -1 if empty
+        int tail; // least recently added, -1 if empty
+        int size;
+    } FS3PolicyList;
+
+    // ghost entries, sectors recently evicted that 2Q and ARC remember without their data
+    typedef struct {
+        int capacity;
+        uint32_t *keys;
+        int *prev;
+        int *next;
+        int *hashNext;
+        int *listOf;
+        int *hashTable;       // first ghost entry in each hash bucket, -1 if empty
+        uint32_t hashMask;
+        int *freeNodes;       // stack of ghost entries not in use
+        int freeCount;
+        FS3PolicyList lists[2];
+    } FS3GhostSet;
+
+    // everything a replacement policy keeps about one set of cache lines
+    typedef struct {
+        // per line state shared by the list based policies
+        int lines;            // number of cache lines
+        int *prev;            // previous line in the line's list
+        int *next;            // next line in the line's list
+        int *listOf;          // which of the policy's lists the line is in
+        uint32_t *keys;       // sector held by the line
+        FS3PolicyList lists[2];
+        const int *pins;      // readers holding each line, never evicted while above 0 (NULL if none pinned)
+
+        // CLOCK policy
+        uint8_t *clockReferenced; // set when a line is used, cleared as the hand passes it
+        int clockHand;
+
+        // 2Q policy
+        int twoQInLimit;      // most lines in the first-use FIFO before it is evicted from
+        int twoQOutLimit;     // most sectors remembered after leaving the first-use FIFO
+
+        // ARC policy
+        int arcTarget;        // target number of lines for sectors used once
+
+        // 2Q and ARC evicted sectors
+        FS3GhostSet ghosts;
+
+        // TinyLFU frequency sketch
+        uint8_t *sketchCounts;  // FS3_SKETCH_ROWS rows of counters
+        uint32_t sketchMask;    // number of counters in a row minus one (a power of 2 minus one)
+        int sketchSamples;      // uses counted since the counts were last halved
+        int sketchSampleLimit;
+    } FS3PolicyState;
+
+    // replacement policy struct, the functions the cache calls as its lines are used
+    typedef struct {
+        const char *name;
+        int (*init)(FS3PolicyState *state, int lines);                    // set up for a set of empty lines
+        int (*close)(FS3PolicyState *state);                              // free everything the policy holds
+        int (*access)(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct); // a sector was looked up (may be NULL)
+        int (*hit)(FS3PolicyState *state, int line);                      // a line holding a looked up sector was used
+        int (*place)(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine); // pick the line for a new sector, skipping pinned lines (-1 if none)
+        int (*evict)(FS3PolicyState *state);                             // take the next line to evict out of the policy (-1 if none)
+    } FS3CachePolicy;
+
+// Global data
+extern FS3CachePolicy fs3_cache_policies[FS3_CACHE_POLICY_COUNT]; // Every replacement policy, by number
+
+// Policy Functions
+
+int fs3_find_cache_policy(const char *name);
+    // Find the number of a replacement policy from its name (returns -1 if not found)
+
+int fs3_policy_list_init(FS3PolicyList *list);
+    // Empty a policy list
+
+int fs3_policy_list_push(FS3PolicyList *list, int *prev, int *next, int i);
+    // Add an index at the head of a policy list
+
+int fs3_policy_list_remove(FS3PolicyList *list, int *prev, int *next, int i);
+    // Remove an index from a policy list
+
+int fs3_policy_line_pinned(FS3PolicyState *state, int line);
+    // Check if a cache line is pinned, so it cannot be evicted
+
+int fs3_policy_list_victim(FS3PolicyState *state, int list);
+    // Find the oldest line of a policy list that is not pinned (returns -1 if all are pinned)
+
+int fs3_policy_lines_init(FS3PolicyState *state, int lines);
+    // Allocate the per line state shared by the list based policies
+
+int fs3_policy_lines_close(FS3PolicyState *state);
+    // Free the per line state shared by the list based policies
+
+int fs3_ghost_init(FS3GhostSet *ghosts, int capacity);
+    // Allocate the ghost entries recording sectors recently evicted
+
+int fs3_ghost_close(FS3GhostSet *ghosts);
+    // Free the ghost entries
+
+int fs3_ghost_find(FS3GhostSet *ghosts, uint32_t key);
+    // Find the ghost entry of a sector (returns -1 if not found)
+
+int fs3_ghost_add(FS3GhostSet *ghosts, int list, uint32_t key);
+    // Record a sector at the head of a ghost list
+
+int fs3_ghost_remove(FS3GhostSet *ghosts, int node);
+    // Remove a ghost entry
+
+int fs3_ghost_remove_lru(FS3GhostSet *ghosts, int list);
+    // Remove the oldest entry of a ghost list
+
+int fs3_lru_init(FS3PolicyState *state, int lines);
+    // LRU policy, set up
+
+int fs3_lru_close(FS3PolicyState *state);
+    // LRU policy, free
+
+int fs3_lru_hit(FS3PolicyState *state, int line);
+    // LRU policy, make a line the most recently used
+
+int fs3_lru_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine);
+    // LRU policy, pick the line for a new sector
+
+int fs3_lru_evict(FS3PolicyState *state);
+    // LRU policy, take the least recently used line out, when shrinking
+
+int fs3_clock_init(FS3PolicyState *state, int lines);
+    // CLOCK policy, set up
+
+int fs3_clock_close(FS3PolicyState *state);
+    // CLOCK policy, free
+
+int fs3_clock_hit(FS3PolicyState *state, int line);
+    // CLOCK policy, mark a line referenced
+
+int fs3_clock_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine);
+    // CLOCK policy, pick the line for a new sector
+
+int fs3_clock_evict(FS3PolicyState *state);
+    // CLOCK policy, take the next unreferenced line out, when shrinking
+
+int fs3_2q_init(FS3PolicyState *state, int lines);
+    // 2Q policy, set up
+
+int fs3_2q_close(FS3PolicyState *state);
+    // 2Q policy, free
+
+int fs3_2q_hit(FS3PolicyState *state, int line);
+    // 2Q policy, record the use of a line
+
+int fs3_2q_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine);
+    // 2Q policy, pick the line for a new sector
+
+int fs3_2q_evict(FS3PolicyState *state);
+    // 2Q policy, take the line it would evict next out, when shrinking
+
+int fs3_arc_init(FS3PolicyState *state, int lines);
+    // ARC policy, set up
+
+int fs3_arc_close(FS3PolicyState *state);
+    // ARC policy, free
+
+int fs3_arc_hit(FS3PolicyState *state, int line);
+    // ARC policy, record the use of a line
+
+int fs3_arc_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine);
+    // ARC policy, pick the line for a new sector
+
+int fs3_arc_evict(FS3PolicyState *state);
+    // ARC policy, take the line it would evict next out, when shrinking
+
+int fs3_tinylfu_init(FS3PolicyState *state, int lines);
+    // TinyLFU policy, set up
+
+int fs3_tinylfu_close(FS3PolicyState *state);
+    // TinyLFU policy, free
+
+int fs3_tinylfu_access(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct);
+    // TinyLFU policy, count a use of a sector in the frequency sketch
+
+int fs3_tinylfu_place(FS3PolicyState *state, FS3TrackIndex trk, FS3SectorIndex sct, int freeLine);
+    // TinyLFU policy, pick the line for a new sector, or keep it out of the cache
+
+int fs3_tinylfu_estimate(FS3PolicyState *state, uint32_t key);
+    // TinyLFU policy, estimate how often a sector has been used
+
+#endif
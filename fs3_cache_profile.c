@@ -0,0 +1,330 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cache_profile.c
+//  Description    : This is the implementation of the miss ratio curve profiler
+//                   of the cache for the FS3 filesystem interface. It records the
+//                   sectors looked up and put in the cache, and works out in one
+//                   pass the hit ratio an LRU cache of every size would have had
+//                   (Mattson stack distances). For long traces only a hashed
+//                   sample of the sectors is followed (SHARDS), scaling the
+//                   distances back up by the sampling rate.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/9/2021
+//
+
+// Includes
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_cache_profile.h>
+#include <fs3_network.h>
+#include <fs3_driver.h>
+
+// Defines
+#define FS3_PROFILE_KEY(trk, sct) (((uint32_t)(trk) * FS3_TRACK_SIZE) + (uint32_t)(sct)) // one number for a sector
+#define FS3_PROFILE_TIMES (2 * FS3_PROFILE_KEYS)    // reference times used before they are renumbered
+#define FS3_PROFILE_HASH_MULTIPLIER 2654435761u     // spreads sector keys across the sampling range
+#define FS3_PROFILE_SAMPLE_BITS 24                  // bits of a sector's hash compared against the sampling threshold
+
+// Static Global Variables
+    int profileCreated = 0;
+    pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+    uint32_t profileThreshold;    // sectors whose hash is below this are followed
+    uint32_t *lastTime;           // time each sector was last referenced, 0 if never
+    int32_t *timeKey;             // sector referenced at each time
+    int32_t *timeTree;            // tree of the sectors whose last reference is at each time (Fenwick tree)
+    uint32_t profileClock;        // time of the last reference
+    uint32_t profileMarks;        // number of sectors followed
+    uint64_t *distanceCounts;     // gets at each scaled stack distance, from 1 to FS3_PROFILE_KEYS
+    uint32_t profileMaxDistance;  // largest scaled stack distance seen
+    uint64_t profileGets;         // every get, followed or not
+    uint64_t profileSampledGets;  // gets of followed sectors
+    uint64_t profileColdGets;     // gets of followed sectors never referenced before
+    uint64_t profileReferences;   // references to followed sectors
+
+// Global Variables
+    double fs3_cache_profile_rate = 0; // Share of sectors profiled, 1 for every sector, 0 for no profiling
+
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_init_cache_profile
+// Description  : Start recording the sector references made to the cache
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_init_cache_profile(void) {
+    // checks that the profiler is not created, and that the sampling rate makes sense
+    if((profileCreated == 1) || (fs3_cache_profile_rate <= 0) || (fs3_cache_profile_rate > 1)){
+        return(-1);
+    }
+
+    // allocates the per sector and per time state
+    lastTime = calloc(FS3_PROFILE_KEYS, sizeof(uint32_t));
+    timeKey = calloc(FS3_PROFILE_TIMES + 1, sizeof(int32_t));
+    timeTree = calloc(FS3_PROFILE_TIMES + 1, sizeof(int32_t));
+    distanceCounts = calloc(FS3_PROFILE_KEYS + 1, sizeof(uint64_t));
+    if((lastTime == NULL) || (timeKey == NULL) || (timeTree == NULL) || (distanceCounts == NULL)){
+        free(lastTime);
+        free(timeKey);
+        free(timeTree);
+        free(distanceCounts);
+        return(-1);
+    }
+
+    // works out the hash threshold of the followed sectors from the sampling rate
+    profileThreshold = (uint32_t)(fs3_cache_profile_rate * (1 << FS3_PROFILE_SAMPLE_BITS));
+    if(profileThreshold == 0){
+        profileThreshold = 1;
+    }
+
+    // sets global variables
+    profileClock = 0;
+    profileMarks = 0;
+    profileMaxDistance = 0;
+    profileGets = 0;
+    profileSampledGets = 0;
+    profileColdGets = 0;
+    profileReferences = 0;
+    profileCreated = 1;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_close_cache_profile
+// Description  : Stop recording, freeing everything the profiler holds
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_close_cache_profile(void) {
+    // checks that the profiler is created
+    if(profileCreated == 0){
+        return(-1);
+    }
+
+    free(lastTime);
+    free(timeKey);
+    free(timeTree);
+    free(distanceCounts);
+    profileCreated = 0;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_profile_cache_reference
+// Description  : Record a sector being looked up or put in the cache. Both move
+//                the sector to the top of the LRU stack, but only gets are
+//                counted as hits or misses, as the cache does
+//
+// Inputs       : trk - the track number of the sector
+//                sct - the sector number of the sector
+//                isGet - 1 if the sector is being looked up, 0 if it is being put
+// Outputs      : 0 if successful, -1 if the profiler is not created
+
+int fs3_profile_cache_reference(FS3TrackIndex trk, FS3SectorIndex sct, int isGet) {
+    // checks that the profiler is created
+    if(profileCreated == 0){
+        return(-1);
+    }
+
+    uint32_t key = FS3_PROFILE_KEY(trk, sct);
+    uint32_t hash = (key * FS3_PROFILE_HASH_MULTIPLIER) >> (32 - FS3_PROFILE_SAMPLE_BITS);
+
+    pthread_mutex_lock(&profileLock);
+    if(isGet == 1){
+        profileGets = profileGets + 1;
+    }
+
+    // only follows the sampled sectors
+    if(hash >= profileThreshold){
+        pthread_mutex_unlock(&profileLock);
+        return(0);
+    }
+    profileReferences = profileReferences + 1;
+
+    // once every time has been used, the last reference times are renumbered from 1
+    if(profileClock == FS3_PROFILE_TIMES){
+        fs3_profile_renumber();
+    }
+    profileClock = profileClock + 1;
+
+    uint32_t last = lastTime[key];
+    if(last != 0){
+        // the stack distance is the number of followed sectors referenced since this one was,
+        //  plus itself, scaled up by the sampling rate
+        uint64_t distance = (uint64_t)fs3_profile_distance(last) + 1;
+        distance = ((distance << FS3_PROFILE_SAMPLE_BITS) + profileThreshold - 1) / profileThreshold;
+        if(distance > FS3_PROFILE_KEYS){
+            distance = FS3_PROFILE_KEYS;
+        }
+        fs3_profile_mark(last, -1);
+
+        if(isGet == 1){
+            distanceCounts[distance] = distanceCounts[distance] + 1;
+            profileSampledGets = profileSampledGets + 1;
+            if(distance > profileMaxDistance){
+                profileMaxDistance = (uint32_t)distance;
+            }
+        }
+    } else {
+        // a sector never referenced before misses in a cache of any size
+        profileMarks = profileMarks + 1;
+        if(isGet == 1){
+            profileColdGets = profileColdGets + 1;
+            profileSampledGets = profileSampledGets + 1;
+        }
+    }
+
+    // moves the sector to the top of the stack
+    fs3_profile_mark(profileClock, 1);
+    lastTime[key] = profileClock;
+    timeKey[profileClock] = (int32_t)key;
+
+    pthread_mutex_unlock(&profileLock);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_profile_distance
+// Description  : Count the followed sectors last referenced after a reference
+//                time, from the tree of last reference times
+//
+// Inputs       : time - the reference time
+// Outputs      : number of sectors referenced since
+
+int fs3_profile_distance(uint32_t time) {
+    // every followed sector has one mark, so the ones after the time are the rest
+    //  of the marks once those up to it are counted
+    int32_t upTo = 0;
+    while(time > 0){
+        upTo = upTo + timeTree[time];
+        time = time & (time - 1);
+    }
+
+    return((int)profileMarks - upTo);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_profile_mark
+// Description  : Add to the count of sectors last referenced at a reference time
+//
+// Inputs       : time - the reference time
+//                change - 1 to mark a sector referenced at the time, -1 to unmark it
+// Outputs      : 0 if successful
+
+int fs3_profile_mark(uint32_t time, int change) {
+    while(time <= FS3_PROFILE_TIMES){
+        timeTree[time] = timeTree[time] + change;
+        time = time + (time & (~time + 1));
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_profile_renumber
+// Description  : Renumber the last reference times of the followed sectors from
+//                1 in the same order, and rebuild the tree over them
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int fs3_profile_renumber(void) {
+    // walks the times in order, keeping the ones still a sector's last reference
+    uint32_t time;
+    uint32_t count = 0;
+    for(time = 1; time <= profileClock; time++){
+        int32_t key = timeKey[time];
+        if(lastTime[key] == time){
+            count = count + 1;
+            lastTime[key] = count;
+            timeKey[count] = key;
+        }
+    }
+
+    // rebuilds the tree with one mark at each of the first count times
+    memset(timeTree, 0, (FS3_PROFILE_TIMES + 1) * sizeof(int32_t));
+    for(time = 1; time <= FS3_PROFILE_TIMES; time++){
+        if(time <= count){
+            timeTree[time] = timeTree[time] + 1;
+        }
+        uint32_t parent = time + (time & (~time + 1));
+        if(parent <= FS3_PROFILE_TIMES){
+            timeTree[parent] = timeTree[parent] + timeTree[time];
+        }
+    }
+    profileClock = count;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_cache_profile
+// Description  : Log the hit ratio an LRU cache of each size would have had, and
+//                the network round trips the run would then have taken. Round
+//                trips not made for missed gets (writes, seeks, mounts) are taken
+//                as they were
+//
+// Inputs       : observedHits - gets the cache actually hit this run
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_cache_profile(int observedHits) {
+    // checks that the profiler is created, and saw a get
+    if(profileCreated == 0){
+        return(-1);
+    }
+    if(profileSampledGets == 0){
+        logMessage(FS3DriverLLevel, "** FS3 cache profile ** (no gets profiled)");
+        return(0);
+    }
+
+    // works out the round trips made other than for the gets that missed
+    int64_t observedMisses = (int64_t)profileGets - observedHits;
+    int64_t otherTrips = (int64_t)fs3_network_round_trips - observedMisses;
+
+    logMessage(FS3DriverLLevel, "** FS3 cache profile **");
+    logMessage(FS3DriverLLevel, "Sampling rate    [%8.2f%]",fs3_cache_profile_rate * 100);
+    logMessage(FS3DriverLLevel, "References       [%9lu]",(unsigned long)profileReferences);
+    logMessage(FS3DriverLLevel, "Gets             [%9lu]",(unsigned long)profileGets);
+    logMessage(FS3DriverLLevel, "Sectors touched  [%9lu]",(unsigned long)((profileMarks * (uint64_t)(1 << FS3_PROFILE_SAMPLE_BITS)) / profileThreshold));
+    logMessage(FS3DriverLLevel, "Round trips      [%9lu]",(unsigned long)fs3_network_round_trips);
+    logMessage(FS3DriverLLevel, "    Lines  Hit ratio     Misses  Round trips");
+
+    // adds up the gets hitting within each size, logging a row at every power of 2 until
+    //  the largest distance seen is covered
+    uint64_t hits = 0;
+    uint32_t distance = 1;
+    uint32_t lines;
+    for(lines = FS3_PROFILE_MIN_LINES; lines <= FS3_PROFILE_KEYS; lines = lines * 2){
+        while(distance <= lines){
+            hits = hits + distanceCounts[distance];
+            distance = distance + 1;
+        }
+
+        double hitRatio = (double)hits / (double)profileSampledGets;
+        int64_t misses = (int64_t)((double)profileGets * (1 - hitRatio) + 0.5);
+        logMessage(FS3DriverLLevel, "%9u  %8.2f%%  %9ld  %11ld", lines, hitRatio * 100,
+            (long)misses, (long)(otherTrips + misses));
+
+        if(lines >= profileMaxDistance){
+            break;
+        }
+    }
+
+    return(0);
+}
@@ -0,0 +1,48 @@
+#ifndef FS3_CACHE_PROFILE_INCLUDED
+#define FS3_CACHE_PROFILE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cache_profile.h
+//  Description    : This is the interface for the miss ratio curve profiler of
+//                   the sector cache in the FS3 filesystem.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/9/2021
+//
+
+// Include
+#include <stdint.h>
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_PROFILE_KEYS (FS3_MAX_TRACKS * FS3_TRACK_SIZE) // one key for every sector on the disk
+#define FS3_PROFILE_MIN_LINES 8                             // smallest cache size in the profile table
+
+// Global data
+extern double fs3_cache_profile_rate; // Share of sectors profiled, 1 for every sector, 0 for no profiling
+
+// Profile Functions
+
+int fs3_init_cache_profile(void);
+    // Start recording the sector references made to the cache
+
+int fs3_close_cache_profile(void);
+    // Stop recording, freeing everything the profiler holds
+
+int fs3_profile_cache_reference(FS3TrackIndex trk, FS3SectorIndex sct, int isGet);
+    // Record a sector being looked up (isGet 1) or put (isGet 0) in the cache
+
+int fs3_profile_distance(uint32_t time);
+    // Count the sectors referenced since a reference time
+
+int fs3_profile_mark(uint32_t time, int change);
+    // Add to the count of sectors referenced at a reference time
+
+int fs3_profile_renumber(void);
+    // Renumber the last reference times from 1, once every time has been used
+
+int fs3_log_cache_profile(int observedHits);
+    // Log the predicted hit ratio and network round trips of each cache size
+
+#endif
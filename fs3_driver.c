@@ -9,9 +9,11 @@
 //
 
 // Includes
+#define _GNU_SOURCE // for the recursive disk lock
 #include <string.h>
 #include <cmpsc311_log.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 // Project Includes
 #include <fs3_driver.h>
@@ -20,13 +22,46 @@
 #include <fs3_network.h>
 
 // Defines
-#define SECTOR_INDEX_NUMBER(x) ((int)(x/FS3_SECTOR_SIZE))
+#define SECTOR_INDEX_NUMBER(x) ((int)((x)/FS3_SECTOR_SIZE))
+#define FS3_INITIAL_SECTOR_MAP_SIZE 16 // number of sector map entries first allocated for a file
+#define FS3_FILE_INDEX_SIZE (FS3_MAX_TOTAL_FILES*2) // number of slots in the filename hash index (power of 2)
+#define FS3_SECTOR_POOL_SIZE 4 // number of sector buffers in the sector buffer pool
+#define FS3_SECTOR_POOL_ALIGNMENT 4096 // byte alignment of the sector buffer pool
+#define FS3_BITMAP_WORD_BITS 64 // number of sectors tracked by each word of the free sector bitmap
+#define FS3_TRACK_BITMAP_WORDS (FS3_TRACK_SIZE/FS3_BITMAP_WORD_BITS) // bitmap words per track
+#define FS3_DISK_BITMAP_WORDS ((FS3_MAX_TRACKS+FS3_BITMAP_WORD_BITS-1)/FS3_BITMAP_WORD_BITS) // words of the track summary
+#define FS3_READAHEAD_MIN_WINDOW 4 // sectors read ahead when a file is first seen being read sequentially
+#define FS3_TRACK_FILL_MAX_BACKOFF 64 // most read misses of a file let go by without a fill, after fills went unused
+#define FS3_CONNECTION_STRIPE 16   // sectors in a row of a track sent over the same connection to the disk
 
 // Static Global Variables
 	bool diskMounted = false;
 	FS3File FS3FileArray[FS3_MAX_TOTAL_FILES];
-	int FS3DiskMap[FS3_MAX_TRACKS][FS3_TRACK_SIZE];
-	int currentDiskTrack;
+	int16_t FS3FileIndex[FS3_FILE_INDEX_SIZE];       // file handle for each filename hash slot, -1 if empty
+	int16_t FS3FreeHandles[FS3_MAX_TOTAL_FILES];     // stack of file handles not yet given to a file
+	int freeHandleCount;                             // number of file handles on the free handle stack
+	uint64_t FS3FreeSectorMap[FS3_MAX_TRACKS][FS3_TRACK_BITMAP_WORDS]; // set bit means the sector is free
+	int FS3TrackFreeCount[FS3_MAX_TRACKS];                              // number of free sectors on each track
+	uint64_t FS3FreeTrackMap[FS3_DISK_BITMAP_WORDS];                    // set bit means the track has a free sector
+	int connectionTracks[FS3_MAX_CONNECTIONS];       // track the head of each connection to the disk is on, -1 if not known
+	pthread_mutex_t diskLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // serializes use of the disk with the cache flusher, taken again by the cache to write back a line it evicts
+	void *sectorPool = NULL;                         // memory of every buffer in the sector buffer pool
+	void *freeSectorBuffers[FS3_SECTOR_POOL_SIZE];   // stack of sector buffers not in use
+	int freeSectorBufferCount;                       // number of sector buffers on the free stack
+	FS3SectorRequest *FS3RequestPlan = NULL;         // every sector touched by the read or write being done
+	int requestPlanSize = 0;                         // number of entries allocated for the request plan
+	int planHeadTrack;                               // track the elevator sweep of the request plan starts at
+	FS3StagingArea readStaging = {NULL, 0};          // sectors of a read not going straight into the user's buffers
+	FS3StagingArea prefetchStaging = {NULL, 0};      // sectors being read ahead or filled from a track into the cache
+	FS3SectorLocation fillSectors[FS3_TRACK_SIZE];   // sectors being filled from a track into the cache
+	bool pipelineFailed = false;                     // a reply to a command sent ahead reported a failure
+	int diskRequestDepth = 0;                        // number of reads and writes waiting on commands sent ahead, nested
+
+// Global Variables
+	uint16_t fs3_reservation_size = FS3_DEFAULT_RESERVATION_SIZE; // sectors reserved for a file at a time
+	uint16_t fs3_readahead_max = FS3_DEFAULT_READAHEAD_MAX;       // most sectors read ahead of a sequential reader
+	uint16_t fs3_track_fill_max = FS3_DEFAULT_TRACK_FILL;         // most used sectors of a track read in on a read miss
+	char *fs3_telemetry_path = NULL;                              // file the cache telemetry is written to at unmount
 
 // Implementation
 
@@ -44,40 +79,59 @@ int32_t fs3_mount_disk(void) {
 		return(-1);
 	}
 
+	// allocates the buffers used to move sectors to and from the disk, before the connections are
+	//  opened so each can register them
+	if(init_sector_pool() == -1){
+		return(-1);
+	}
+	network_fs3_register_buffers(sectorPool, FS3_SECTOR_POOL_SIZE * FS3_SECTOR_SIZE);
+
 	// constructs command block for the mount opcode
 	FS3CmdBlk cmdblock = construct_fs3_cmdblock(FS3_OP_MOUNT, 0, 0, 0);
 
 	// creates a return command block and preforms the network system call with the command block
 	FS3CmdBlk returnCmdblock;
 	if(network_fs3_syscall(cmdblock, &returnCmdblock, NULL) == -1){
-		// if the network call was a failure, returns -1
+		// if the network call was a failure, frees the pool and returns -1
+		free_sector_pool();
 		return(-1);
 	}
 
 	// makes sure the system call went successfully
 	if (getReturnBit(returnCmdblock) != 0){
+		free_sector_pool();
 		return(-1);
 	}
 
 	// sets the global disk mounted variable to true
 	diskMounted = true;
 
-	// sets the global current track variable to -1
-	currentDiskTrack = -1;
-
-	// sets each file in the file array to not have been created yet
+	// sets the track of every connection's head to -1, as none has seeked yet
 	int i;
+	for(i = 0; i<FS3_MAX_CONNECTIONS; i++){
+		connectionTracks[i] = -1;
+	}
+
+	// sets each file in the file array to not have been created yet, with an empty sector map
 	for(i = 0; i<FS3_MAX_TOTAL_FILES; i++){
 		FS3FileArray[i].created = false;
+		FS3FileArray[i].sectorMap = NULL;
+		FS3FileArray[i].sectorCount = 0;
+		FS3FileArray[i].sectorMapSize = 0;
+		FS3FileArray[i].reservedCount = 0;
 	}
 
-	// sets each entry in the disk map to -1 (meaning there is no file there)
-	int j;
-	for(i = 0; i<FS3_MAX_TRACKS; i++){
-		for(j = 0; j<FS3_TRACK_SIZE; j++){
-			FS3DiskMap[i][j] = -1;
-		}
+	// empties the filename index and puts every file handle on the free handle stack, lowest on top
+	for(i = 0; i<FS3_FILE_INDEX_SIZE; i++){
+		FS3FileIndex[i] = -1;
+	}
+	for(i = 0; i<FS3_MAX_TOTAL_FILES; i++){
+		FS3FreeHandles[i] = (int16_t) (FS3_MAX_TOTAL_FILES - 1 - i);
 	}
+	freeHandleCount = FS3_MAX_TOTAL_FILES;
+
+	// marks every sector on the disk as free
+	init_free_sector_map();
 
 	return(0);
 }
@@ -92,11 +146,39 @@ int32_t fs3_mount_disk(void) {
 // Outputs      : 0 if successful, -1 if failure
 
 int32_t fs3_unmount_disk(void) {
+	// holds the disk lock so the background cache flusher does not use the disk at the same time
+	pthread_mutex_lock(&diskLock);
+	int32_t result = unmount_disk();
+	pthread_mutex_unlock(&diskLock);
+
+	return(result);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unmount_disk
+// Description  : Unmounts the disk and closes all files, with the disk lock held
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t unmount_disk(void) {
 	// checks that the disk is mounted
 	if(diskMounted == false){
 		return(-1);
 	}
 
+	// writes any data held in the cache back to the disk before it is unmounted
+	if(fs3_flush_cache() == -1){
+		return(-1);
+	}
+
+	// writes the cache telemetry out while the files are still known, if it was asked for
+	if(fs3_telemetry_path != NULL){
+		write_cache_telemetry(fs3_telemetry_path);
+	}
+
 	// constructs command block for the unmount opcode
 	FS3CmdBlk cmdblock = construct_fs3_cmdblock(FS3_OP_UMOUNT, 0, 0, 0);
 
@@ -115,11 +197,19 @@ int32_t fs3_unmount_disk(void) {
 	// updates the global variable
 	diskMounted = false;
 
-	// closes every file in the file array that has been created
+	// deallocates the sector buffer pool
+	free_sector_pool();
+
+	// closes every file in the file array that has been created, freeing its sector map
 	int i;
 	for(i = 0; i<FS3_MAX_TOTAL_FILES; i++){
 		if(FS3FileArray[i].created == true){
 			FS3FileArray[i].open = false;
+			free(FS3FileArray[i].sectorMap);
+			FS3FileArray[i].sectorMap = NULL;
+			FS3FileArray[i].sectorCount = 0;
+			FS3FileArray[i].sectorMapSize = 0;
+			FS3FileArray[i].reservedCount = 0;
 		} else {
 			break;
 		}
@@ -138,46 +228,44 @@ int32_t fs3_unmount_disk(void) {
 // Outputs      : file handle if successful, -1 if failure
 
 int16_t fs3_open(char *path) {
-	bool fileExists = false;
+	// checks that the filename will fit in the file's metadata
+	if((path == NULL) || (strlen(path) >= FS3_MAX_PATH_LENGTH)){
+		return(-1);
+	}
+
 	int16_t fileHandle;
-	
-	int i;
 
-	// checks if the file already exists, keeping track of its' file handle if it does
-	for(i = 0; i<FS3_MAX_TOTAL_FILES; i++){
-		if (strcmp(FS3FileArray[i].name,path) == 0){
-			fileExists = true;
-			fileHandle = (int16_t) i;
-			break;
-		}
-	}
+	// finds the slot of the filename index that either holds the file or where it would go
+	int indexSlot = find_file_index_slot(path);
 
-	if (fileExists == true){
+	if (FS3FileIndex[indexSlot] != -1){
 		// if the file exists, it opens the file and sets the position to 0
+		fileHandle = FS3FileIndex[indexSlot];
 		FS3FileArray[fileHandle].open = true;
 		FS3FileArray[fileHandle].position = 0;
+		reset_file_readahead(fileHandle);
 		return(fileHandle);	
 	} else {
 		// if the file does not exist, will attempt to create a new file
 		// checks that max number of files are not already in disk
-		if(FS3FileArray[FS3_MAX_TOTAL_FILES].created == true){
+		if(freeHandleCount == 0){
 			return(-1);
 		}
 
-		// finds the next avaliable file handle for the new file
-		for(i = 0; i<FS3_MAX_TOTAL_FILES; i++){
-			if(FS3FileArray[i].created == false){
-				fileHandle = (int16_t) i;
-				break;
-			}
-		}
+		// takes the next avaliable file handle for the new file and adds it to the filename index
+		freeHandleCount = freeHandleCount - 1;
+		fileHandle = FS3FreeHandles[freeHandleCount];
+		FS3FileIndex[indexSlot] = fileHandle;
 
 		// intializes all variables for the new file
 		FS3FileArray[fileHandle].created = true;
 		FS3FileArray[fileHandle].length = 0;
 		FS3FileArray[fileHandle].position = 0;
 		FS3FileArray[fileHandle].open = true;
+		FS3FileArray[fileHandle].cacheGets = 0;
+		FS3FileArray[fileHandle].cacheHits = 0;
 		strcpy(FS3FileArray[fileHandle].name,path);
+		reset_file_readahead(fileHandle);
 
 		return(fileHandle);
 	}
@@ -194,15 +282,24 @@ int16_t fs3_open(char *path) {
 
 int16_t fs3_close(int16_t fd) {
 	// checks that the file handle is within the bounds of the maximum number of files
-	if((fd > FS3_MAX_TOTAL_FILES) || (fd < (int16_t)0)){
+	if((fd >= FS3_MAX_TOTAL_FILES) || (fd < (int16_t)0)){
 		return(-1);
 	}
 	// checks that the file has already been created
 	if(FS3FileArray[fd].created == false){
 		return(-1);
 	}
-	// checks that the file is not already open
-	if(FS3FileArray[fd].open == true){
+	// checks that the file is not already closed
+	if(FS3FileArray[fd].open == false){
+		return(-1);
+	}
+
+	// writes the file's data held in the cache back to the disk, leaving other files' writes
+	//	to be written back on eviction, by the flusher, or at unmount
+	pthread_mutex_lock(&diskLock);
+	int flushResult = flush_file_sectors(fd);
+	pthread_mutex_unlock(&diskLock);
+	if(flushResult == -1){
 		return(-1);
 	}
 
@@ -224,99 +321,82 @@ int16_t fs3_close(int16_t fd) {
 // Outputs      : bytes read if successful, -1 if failure
 
 int32_t fs3_read(int16_t fd, void *buf, int32_t count) {
-	// checks that the disk is mounted
-	if(diskMounted == false){
-		return(-1);
-	}
-	// checks that the file handle is within the bounds of the maximum number of files
-	if((fd > FS3_MAX_TOTAL_FILES) || (fd < (int16_t)0)){
-		return(-1);
-	}
-	// checks that the file has already been created
-	if(FS3FileArray[fd].created == false){
-		return(-1);
-	}
-	// checks that the file is not closed
-	if(FS3FileArray[fd].open == false){
-		return(-1);
-	}
-	// checks that there are any bytes to even read
-	if((FS3FileArray[fd].length - FS3FileArray[fd].position) == 0){
-		return(0);
-	}
+	// holds the disk lock so the background cache flusher does not use the disk at the same time
+	pthread_mutex_lock(&diskLock);
+	int32_t bytesRead = read_file_data(fd, buf, count);
+	pthread_mutex_unlock(&diskLock);
+
+	return(bytesRead);
+}
 
-	// initializes the number of bytes read as 0
-	int bytesRead = 0;
 
-	// while there are more bytes to read, the function will continue to preform read operations
-	while(count > 0){
-		// sets the number of bits to be read on this read operation
-		int diskBitCount = count;
-		// finds the position the file is on inside the sector its overall position is in
-		int positionInSector = FS3FileArray[fd].position % FS3_SECTOR_SIZE;
-		// saves the track and sector the position of the file is on
-		int currentFileTrack = find_current_track(fd);
-		int currentFileSector = find_current_sector(fd);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_file_data
+// Description  : Reads "count" bytes from the file handle "fh" into the 
+//                buffer "buf", with the disk lock held
+//
+// Inputs       : fd - filename of the file to read from
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+// Outputs      : bytes read if successful, -1 if failure
 
-		//switches to the correct track
-		if(currentDiskTrack != currentFileTrack){
-			switch_disk_track(currentFileTrack);
-		}
+int32_t read_file_data(int16_t fd, void *buf, int32_t count) {
+	// checks that the file can be read from
+	if(check_open_file(fd) == -1){
+		return(-1);
+	}
 
-		// allocates memory for a new buffer for the data from the disk
-		void *diskBuf = malloc(FS3_SECTOR_SIZE);
+	// reads from the file's position, then moves the position past the bytes read
+	struct iovec userBuffer = { buf, count };
+	int32_t bytesRead = read_file_vector(fd, &userBuffer, 1, FS3FileArray[fd].position);
+	if(bytesRead > 0){
+		FS3FileArray[fd].position = FS3FileArray[fd].position + bytesRead;
+	}
 
-		// tries to get the data from the cache
-		void *cacheData = fs3_get_cache((FS3TrackIndex)currentFileTrack, (FS3SectorIndex)currentFileSector);
+	return(bytesRead);
+}
 
-		// if the data was not in the cache, preform a read system call and get it fomr the disk
-		if(cacheData == NULL){
-			// constructs command block for the read opcode
-			FS3CmdBlk cmdblock = construct_fs3_cmdblock(FS3_OP_RDSECT, currentFileSector, 0, 0);
 
-			// creates a return command block and preforms the network system call with the command block and buffer
-			FS3CmdBlk returnCmdblock;
-			if(network_fs3_syscall(cmdblock, &returnCmdblock, diskBuf) == -1){
-				// if the network call was a failure, returns -1
-				return(-1);
-			}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_pread
+// Description  : Reads "count" bytes from the file handle "fh" at "offset" into
+//                the buffer "buf", without using or moving the file's position
+//
+// Inputs       : fd - filename of the file to read from
+//                buf - pointer to buffer to read into
+//                count - number of bytes to read
+//                offset - position in the file to read from
+// Outputs      : bytes read if successful, -1 if failure
 
-			// makes sure the system call went successfully
-			if (getReturnBit(returnCmdblock) != 0){
-				return(-1);
-			}
-		} else {
-			// if the data was in the cache, copy it over to the disk Buffer
-			memcpy(diskBuf, cacheData, FS3_SECTOR_SIZE);
-		}
+int32_t fs3_pread(int16_t fd, void *buf, int32_t count, uint32_t offset) {
+	struct iovec userBuffer = { buf, count };
 
-		// checks the make sure the amount of bytes trying to be read will not go past the size of the sector
-		if((FS3_SECTOR_SIZE - positionInSector) < diskBitCount){
-			diskBitCount = FS3_SECTOR_SIZE - positionInSector;
-		}
-		// first checks if the end of the file is in the same sector as the current position
-		if((FS3FileArray[fd].length / FS3_SECTOR_SIZE) == (FS3FileArray[fd].position / FS3_SECTOR_SIZE)){
-			// checks the make sure the amount of bytes trying to be read will not go past the length of the file
-			if(((FS3FileArray[fd].length % FS3_SECTOR_SIZE) - positionInSector) < diskBitCount){
-				diskBitCount = (FS3FileArray[fd].length % FS3_SECTOR_SIZE) - positionInSector;
-			}
-		}
+	pthread_mutex_lock(&diskLock);
+	int32_t bytesRead = read_file_vector(fd, &userBuffer, 1, offset);
+	pthread_mutex_unlock(&diskLock);
+
+	return(bytesRead);
+}
 
-		// copies diskBitCount bytes from the current position of the file to the user's buffer 
-		memcpy(buf + bytesRead, diskBuf + positionInSector, diskBitCount);
 
-		// updates metadata
-		FS3FileArray[fd].position = FS3FileArray[fd].position + diskBitCount;
-		if(FS3FileArray[fd].position > FS3FileArray[fd].length){
-			FS3FileArray[fd].length = FS3FileArray[fd].position;
-		}
-		bytesRead = bytesRead + diskBitCount;
-		count = count - diskBitCount;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_preadv
+// Description  : Reads from the file handle "fh" at "offset" into each of the
+//                buffers of "iov" in turn, without using or moving the file's position
+//
+// Inputs       : fd - filename of the file to read from
+//                iov - the buffers to read into
+//                iovcnt - number of buffers
+//                offset - position in the file to read from
+// Outputs      : bytes read if successful, -1 if failure
 
-		// deallocates the memory of the disk buffer
-		free(diskBuf);
-		
-	}
+int32_t fs3_preadv(int16_t fd, const struct iovec *iov, int iovcnt, uint32_t offset) {
+	pthread_mutex_lock(&diskLock);
+	int32_t bytesRead = read_file_vector(fd, iov, iovcnt, offset);
+	pthread_mutex_unlock(&diskLock);
 
 	return(bytesRead);
 }
@@ -324,211 +404,242 @@ int32_t fs3_read(int16_t fd, void *buf, int32_t count) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : fs3_write
-// Description  : Writes "count" bytes to the file handle "fh" from the 
-//                buffer  "buf"
-//the count
-// Inputs       : fd - filename of the file to write to
-//                buf - pointer to buffer to write from
-//                count - number of bytes to write
-// Outputs      : bytes written if successful, -1 if failure
+// Function     : read_file_vector
+// Description  : Reads from the file handle "fh" at "offset" into each of the
+//                buffers of "iov" in turn, with the disk lock held
+//
+// Inputs       : fd - filename of the file to read from
+//                iov - the buffers to read into
+//                iovcnt - number of buffers
+//                offset - position in the file to read from
+// Outputs      : bytes read if successful, -1 if failure
 
-int32_t fs3_write(int16_t fd, void *buf, int32_t count) {
-	// checks that the disk is mounted
-	if(diskMounted == false){
+int32_t read_file_vector(int16_t fd, const struct iovec *iov, int iovcnt, uint32_t offset) {
+	// checks that the file can be read from
+	if(check_open_file(fd) == -1){
 		return(-1);
 	}
-	// checks that the file handle is within the bounds of the maximum number of files
-	if((fd > FS3_MAX_TOTAL_FILES) || (fd < (int16_t)0)){
+	int32_t count = total_iovec_length(iov, iovcnt);
+	if(count == -1){
 		return(-1);
 	}
-	// checks that the file has already been created
-	if(FS3FileArray[fd].created == false){
-		return(-1);
+	// checks that the read will not go past the end of the file
+	if(offset >= (uint32_t)FS3FileArray[fd].length){
+		return(0);
 	}
-	// checks that the file is not closed
-	if(FS3FileArray[fd].open == false){
-		return(-1);
+	if(count > (FS3FileArray[fd].length - (int)offset)){
+		count = FS3FileArray[fd].length - (int)offset;
+	}
+	if(count <= 0){
+		return(0);
 	}
 
-	// initializes the number of bytes written as 0
-	int bytesWritten = 0;
-
-	// while there are more bytes to write, the function will continue to preform write operations
-	while(count > 0){
-		// sets the number of bits to be written on this write operation
-		int diskBitCount = count;
-		// finds the position the file is on inside the sector its overall position is in
-		int positionInSector = FS3FileArray[fd].position % FS3_SECTOR_SIZE;
-		// saves the track and sector the position of the file is on
-		int sectorToWriteTo = find_current_sector(fd);
-		int trackToWriteTo = find_current_track(fd);
-
-		// if the position is at the beginning of a new sector, it will find an empty sector to write more data to
-		if((sectorToWriteTo==-1)||(trackToWriteTo==-1)){
-			trackToWriteTo = find_open_track();
-
-			//switches to the new track
-			if(currentDiskTrack != trackToWriteTo){
-				switch_disk_track(trackToWriteTo);
-			}
-
-			sectorToWriteTo = find_open_sector();
-		}
+	// works out every sector the read touches, and orders them to sweep across the tracks once
+	int planCount = plan_file_request(fd, offset, count, false);
+	if(planCount == -1){
+		return(-1);
+	}
+	order_request_plan(planCount);
 
-		//switches to the file's position's current track
-		if(currentDiskTrack != trackToWriteTo){
-			switch_disk_track(trackToWriteTo);
+	// works out where each sector is read to if it is not in the cache: straight into the user's
+	//	buffer if the whole sector goes in one, otherwise into a staging buffer of its own, as
+	//	every read is sent before any of them arrive
+	int i;
+	int stagedCount = 0;
+	for(i = 0; i<planCount; i++){
+		FS3SectorRequest *request = &FS3RequestPlan[i];
+		request->diskData = NULL;
+		if(request->byteCount == FS3_SECTOR_SIZE){
+			request->diskData = find_iovec_data(iov, iovcnt, request->bufferOffset, request->byteCount);
 		}
-
-		// allocates memory for a new buffer for the data for the disk
-		void *diskBuf = malloc(FS3_SECTOR_SIZE);
-
-		// if there is data already written in the sector about to be written to,
-		//	it will read the data already there into the buffer
-		if(FS3DiskMap[trackToWriteTo][sectorToWriteTo] != -1){
-
-			// tries to get the data from the cache
-			void *cacheData = fs3_get_cache(trackToWriteTo, sectorToWriteTo);
-
-			// if the data was not in the cache, preform a read system call and get it fomr the disk
-			if(cacheData == NULL){
-				// constructs command block for the read opcode
-				FS3CmdBlk readCmdblock = construct_fs3_cmdblock(FS3_OP_RDSECT, sectorToWriteTo, 0, 0);
-
-				// creates a return command block and preforms the network system call with the command block and buffer
-				FS3CmdBlk returnReadCmdblock;
-				if(network_fs3_syscall(readCmdblock, &returnReadCmdblock, diskBuf) == -1){
-					// if the network call was a failure, returns -1
-					return(-1);
-				}
-
-				// makes sure the system call went successfully
-				if (getReturnBit(returnReadCmdblock) != 0){
-					return(-1);
-				}
-			} else {
-				// if the data was in the cache, copy it over to the disk buffer
-				memcpy(diskBuf, cacheData, FS3_SECTOR_SIZE);
-			}
-
+		request->staged = (request->diskData == NULL) ? true : false;
+		if(request->staged == true){
+			stagedCount = stagedCount + 1;
 		}
-
-		// checks the make sure the amount of bytes trying to be written will not go past the size of the sector
-		if((FS3_SECTOR_SIZE - positionInSector) < count){
-			diskBitCount = FS3_SECTOR_SIZE - positionInSector;
+	}
+	void *staging = reserve_staging_area(&readStaging, stagedCount);
+	if(staging == NULL){
+		return(-1);
+	}
+	stagedCount = 0;
+	for(i = 0; i<planCount; i++){
+		if(FS3RequestPlan[i].staged == true){
+			FS3RequestPlan[i].diskData = staging + ((size_t)stagedCount * FS3_SECTOR_SIZE);
+			stagedCount = stagedCount + 1;
 		}
+	}
 
-		// copies diskBitCount bytes from the buffer into the disk buffer at the position the file is at
-		memcpy(diskBuf+positionInSector, buf+bytesWritten, diskBitCount);
-
-		// put the new data into the cahce
-		fs3_put_cache(trackToWriteTo, sectorToWriteTo, diskBuf);
-
-		// constructs command block for the write opcode
-		FS3CmdBlk writeCmdblock = construct_fs3_cmdblock(FS3_OP_WRSECT, sectorToWriteTo, 0, 0);
-
-		// creates a return command block and preforms the network system call with the command block and buffer
-		FS3CmdBlk returnWriteCmdblock;
-		if(network_fs3_syscall(writeCmdblock, &returnWriteCmdblock, diskBuf) == -1){
-			// if the network call was a failure, returns -1
+	// copies each sector the cache holds into the user's buffers, and sends the disk reads of
+	//	the rest one after another without waiting for each reply. A failure of any command sent
+	//	while the read is done, such as the write back of a line the cache evicts, is kept until
+	//	the read's last wait
+	begin_disk_requests();
+	for(i = 0; i<planCount; i++){
+		if(read_request_sector(fd, &FS3RequestPlan[i], iov, iovcnt) == -1){
+			end_disk_requests();
 			return(-1);
 		}
+	}
 
-		// makes sure the system call went successfully
-		if (getReturnBit(returnWriteCmdblock) != 0){
+	// waits for every read to arrive, then finishes the sectors read from the disk
+	if(complete_disk_requests() == -1){
+		end_disk_requests();
+		return(-1);
+	}
+	for(i = 0; i<planCount; i++){
+		if(finish_request_sector(&FS3RequestPlan[i], iov, iovcnt) == -1){
+			end_disk_requests();
 			return(-1);
 		}
-
-		// updates metadata
-		FS3DiskMap[trackToWriteTo][sectorToWriteTo] = fd;
-		FS3FileArray[fd].position = FS3FileArray[fd].position + diskBitCount;
-		if(FS3FileArray[fd].position > FS3FileArray[fd].length){
-			FS3FileArray[fd].length = FS3FileArray[fd].position;
-		}
-		count = count - diskBitCount;
-		bytesWritten = bytesWritten + diskBitCount;
-
-		// deallocates the memory used for the disk buffer
-		free(diskBuf);
 	}
 
-	return(bytesWritten);
-}
-
-
-////////////////////////////////////////////////////////////////////////////////
-//
-// Function     : fs3_seek
-// Description  : Seek to specific point in the file
-//
-// Inputs       : fd - filename of the file to write to
-//                loc - offfset of file in relation to beginning of file
-// Outputs      : 0 if successful, -1 if failure
-
-int32_t fs3_seek(int16_t fd, uint32_t loc) {
-	// checks that the file handle is within the bounds of the maximum number of files
-	if((fd > FS3_MAX_TOTAL_FILES) || (fd < (int16_t)0)){
+	// fills the cache from the tracks the read missed on
+	if(fill_tracks_after_misses(fd, offset, planCount) == -1){
+		end_disk_requests();
 		return(-1);
 	}
-	// checks that the file has already been created
-	if(FS3FileArray[fd].created == false){
+
+	// if the file is being read sequentially, reads the sectors after this read into the cache
+	if(readahead_file(fd, offset, count) == -1){
+		end_disk_requests();
 		return(-1);
 	}
-	// checks that the location is not beyond the end of the file
-	if(loc > FS3FileArray[fd].length){
+	if(end_disk_requests() == -1){
 		return(-1);
 	}
-	// checks that the file is not closed
-	if(FS3FileArray[fd].open == false){
+
+	// lets the cache grow if it is missing too often
+	if(fs3_tune_cache() == -1){
 		return(-1);
 	}
 
-	// sets the position of the file to loc
-	FS3FileArray[fd].position = loc;
+	return(count);
+}
 
-	return (0);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reset_file_readahead
+// Description  : Forgets how a file has been read, so it is not treated as a
+//                sequential stream until it is seen being read sequentially again
+//
+// Inputs       : fd - the file descriptor
+// Outputs      : 0 if successful
+
+int reset_file_readahead(int16_t fd){
+	FS3FileArray[fd].lastReadEnd = -1;
+	FS3FileArray[fd].readaheadWindow = 0;
+	FS3FileArray[fd].readaheadEnd = 0;
+	FS3FileArray[fd].fillStart = 0;
+	FS3FileArray[fd].fillEnd = 0;
+	FS3FileArray[fd].fillBackoff = 0;
+	FS3FileArray[fd].fillSkips = 0;
+
+	return(0);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : switch_disk_track
-// Description  : Switches the track the disk in on to a new track
+// Function     : readahead_file
+// Description  : Watches the reads of a file, and once a read starts where the last
+//                one ended, reads the sectors after it into the cache. The window of
+//                sectors read ahead doubles each time a read uses data read ahead for
+//                it, and is dropped when the file is read anywhere else
 //
-// Inputs       : trackNum - the track number to switch to
+// Inputs       : fd - the file descriptor
+//                offset - the file position the read started at
+//                count - number of bytes read
 // Outputs      : 0 if successful, -1 if failure
 
-int switch_disk_track(int trackNum){
-	// checks that the disk is mounted
-	if(diskMounted == false){
-		return(-1);
+int readahead_file(int16_t fd, int offset, int count){
+	FS3File *file = &FS3FileArray[fd];
+	int readEnd = offset + count;
+
+	// works out the largest window, keeping read ahead sectors to a quarter of the cache so
+	//	they do not push out the sectors the reader is about to use
+	int maxWindow = fs3_cache_lines() / 4;
+	if(maxWindow > fs3_readahead_max){
+		maxWindow = fs3_readahead_max;
 	}
-	// checks to make sure the trackNum is valid
-	if((trackNum<0) || (trackNum>FS3_MAX_TRACKS)){
-		return(-1);
+
+	// a read anywhere but where the last one ended is not sequential, so nothing is read ahead
+	if((offset != file->lastReadEnd) || (maxWindow == 0)){
+		file->lastReadEnd = readEnd;
+		file->readaheadWindow = 0;
+		file->readaheadEnd = readEnd;
+		return(0);
 	}
+	file->lastReadEnd = readEnd;
 
-	// creates trackInt to be able to send it to construct_fs3_cmdblock
-	uint_fast32_t trackInt = (uint_fast32_t) trackNum;
+	// opens the window when a stream is first seen, and grows it when the read used data read ahead
+	if(file->readaheadWindow == 0){
+		file->readaheadWindow = FS3_READAHEAD_MIN_WINDOW;
+	} else if(offset < file->readaheadEnd){
+		file->readaheadWindow = file->readaheadWindow * 2;
+	}
+	if(file->readaheadWindow > maxWindow){
+		file->readaheadWindow = maxWindow;
+	}
 
-	// constructs command block for the seek opcode
-	FS3CmdBlk cmdblock = construct_fs3_cmdblock(FS3_OP_TSEEK, 0, trackInt, 0);
+	// waits until the reader is at least half way through the data already read ahead
+	int windowBytes = file->readaheadWindow * FS3_SECTOR_SIZE;
+	if((file->readaheadEnd - readEnd) >= (windowBytes / 2)){
+		return(0);
+	}
 
-	// creates a return command block and preforms the network system call with the command block
-	FS3CmdBlk returnCmdblock;
-	if(network_fs3_syscall(cmdblock, &returnCmdblock, NULL) == -1){
-		// if the network call was a failure, returns -1
+	// works out the sectors after the data already read ahead, up to the end of the file
+	int prefetchStart = file->readaheadEnd;
+	if(prefetchStart < readEnd){
+		prefetchStart = readEnd;
+	}
+	prefetchStart = SECTOR_INDEX_NUMBER(prefetchStart) * FS3_SECTOR_SIZE;
+	int prefetchEnd = readEnd + windowBytes;
+	if(prefetchEnd > file->length){
+		prefetchEnd = file->length;
+	}
+	if(prefetchStart >= prefetchEnd){
+		return(0);
+	}
+	file->readaheadEnd = prefetchEnd;
+
+	// plans the sectors, and orders them to sweep across the tracks once
+	int planCount = plan_file_request(fd, prefetchStart, prefetchEnd - prefetchStart, false);
+	if(planCount == -1){
 		return(-1);
 	}
+	order_request_plan(planCount);
 
-	// makes sure the system call went successfully
-	if (getReturnBit(returnCmdblock) != 0){
+	// sends a read for each sector not already in the cache without waiting for each reply
+	void *staging = reserve_staging_area(&prefetchStaging, planCount);
+	if(staging == NULL){
 		return(-1);
 	}
+	int i;
+	for(i = 0; i<planCount; i++){
+		FS3SectorRequest *request = &FS3RequestPlan[i];
+		request->diskData = NULL;
+		if(fs3_cache_contains(request->track, request->sector) == 1){
+			continue;
+		}
+
+		request->diskData = staging + ((size_t)i * FS3_SECTOR_SIZE);
+		if(queue_disk_sector_read(request->track, request->sector, request->diskData) == -1){
+			complete_disk_requests();
+			return(-1);
+		}
+	}
 
-	// updates global current disk track variable
-	currentDiskTrack = trackNum;
+	// puts the sectors in the cache once every read has arrived
+	if(complete_disk_requests() == -1){
+		return(-1);
+	}
+	for(i = 0; i<planCount; i++){
+		FS3SectorRequest *request = &FS3RequestPlan[i];
+		if(request->diskData != NULL){
+			fs3_put_cache_prefetch(request->track, request->sector, request->diskData);
+		}
+	}
 
 	return(0);
 }
@@ -536,84 +647,1373 @@ int switch_disk_track(int trackNum){
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : find_open_track
-// Description  : Finds a track in which there is a sector with no data in it
+// Function     : fill_tracks_after_misses
+// Description  : Puts the sectors a read missed in the cache, then, while the disk
+//                is still on the tracks the read missed on, reads the file's next
+//                sectors past the read on those tracks into the cache as well, so
+//                a cold scan of a file laid out on one track seeks to it once and
+//                misses once rather than once a sector. The reads of every track
+//                are sent together and waited for once. Sectors of other files on
+//                the tracks are left alone, as each costs a read of its own and is
+//                rarely wanted soon, and a sequential reader is left to read ahead.
+//                When the next read of the file does not start in the sectors
+//                filled, the misses let go by before the file is filled again
+//                double, so a random reader soon stops paying for fills
 //
-// Outputs      : first track number with open sector, or -1 if all sectors full
+// Inputs       : fd - the file descriptor being read
+//                offset - the file position the read started at
+//                planCount - number of sectors in the read's plan
+// Outputs      : 0 if successful, -1 if failure
 
-int find_open_track(){
-	int i;
-	int j;
+int fill_tracks_after_misses(int16_t fd, int offset, int planCount){
+	FS3File *file = &FS3FileArray[fd];
 
-	// loops through the entire disk map
-	for(i = 0; i<FS3_MAX_TRACKS; i++){
-		for(j = 0; j<FS3_TRACK_SIZE; j++){
-			// if a sector has no file data in it, it returns that track number
-			if(FS3DiskMap[i][j] == -1){
-				return(i);
+	// works out the most sectors to fill, keeping them to a quarter of the cache like
+	//	read ahead, so they do not push out the sectors being used
+	int maxFill = fs3_cache_lines() / 4;
+	if(maxFill > fs3_track_fill_max){
+		maxFill = fs3_track_fill_max;
+	}
+	if(maxFill > FS3_TRACK_SIZE){
+		maxFill = FS3_TRACK_SIZE;
+	}
+	if(maxFill == 0){
+		return(0);
+	}
+
+	// a read starting in the sectors filled last time used them, so the file is filled on every
+	//	miss again, while one starting anywhere else doubles the misses let go by without a fill
+	if(file->fillEnd > file->fillStart){
+		if((offset >= file->fillStart) && (offset < file->fillEnd)){
+			file->fillBackoff = 0;
+		} else {
+			file->fillBackoff = (file->fillBackoff * 2) + 1;
+			if(file->fillBackoff > FS3_TRACK_FILL_MAX_BACKOFF){
+				file->fillBackoff = FS3_TRACK_FILL_MAX_BACKOFF;
 			}
 		}
+		file->fillSkips = file->fillBackoff;
+		file->fillStart = 0;
+		file->fillEnd = 0;
 	}
 
-	return(-1);
-}
-
-
-////////////////////////////////////////////////////////////////////////////////
+	// finds the tracks the read missed on, and the last sector of the file the read covers
+	bool missedTracks[FS3_MAX_TRACKS];
+	memset(missedTracks, 0, sizeof(missedTracks));
+	int missed = 0;
+	int lastPlanned = -1;
+	int i;
+	for(i = 0; i<planCount; i++){
+		FS3SectorRequest *request = &FS3RequestPlan[i];
+		if(request->diskData != NULL){
+			missedTracks[request->track] = true;
+			missed = missed + 1;
+		}
+		if(request->fileSector > lastPlanned){
+			lastPlanned = request->fileSector;
+		}
+	}
+	if((missed == 0) || (offset == file->lastReadEnd)){
+		return(0);
+	}
+	if(file->fillSkips > 0){
+		file->fillSkips = file->fillSkips - 1;
+		return(0);
+	}
+
+	// keeps every sector the read missed before any is filled, so none of them is read again
+	for(i = 0; i<planCount; i++){
+		FS3SectorRequest *request = &FS3RequestPlan[i];
+		if(request->diskData != NULL){
+			fs3_put_cache(request->track, request->sector, request->diskData);
+		}
+	}
+
+	// finds each of the file's sectors past the read on those tracks not already in the cache,
+	//	looking no further through the file than a track's worth of sectors, and sends their
+	//	reads without waiting for each reply
+	int partNum;
+	int lastPart = lastPlanned + 1 + FS3_TRACK_SIZE;
+	if(lastPart > file->sectorCount){
+		lastPart = file->sectorCount;
+	}
+	void *staging = reserve_staging_area(&prefetchStaging, maxFill);
+	if(staging == NULL){
+		return(-1);
+	}
+	int filled = 0;
+	int queued = 0;
+	for(partNum = lastPlanned + 1; (partNum < lastPart) && (filled < maxFill); partNum++){
+		FS3SectorLocation *location = &file->sectorMap[partNum];
+		if(missedTracks[location->track] == false){
+			continue;
+		}
+		filled = filled + 1;
+		file->fillEnd = (partNum + 1) * FS3_SECTOR_SIZE;
+		if(fs3_cache_contains(location->track, location->sector) == 1){
+			continue;
+		}
+
+		if(queue_disk_sector_read(location->track, location->sector, staging + ((size_t)queued * FS3_SECTOR_SIZE)) == -1){
+			complete_disk_requests();
+			return(-1);
+		}
+		fillSectors[queued] = *location;
+		queued = queued + 1;
+	}
+
+	// remembers where the fill starts, to see if the next read uses it
+	if(file->fillEnd > 0){
+		file->fillStart = (lastPlanned + 1) * FS3_SECTOR_SIZE;
+	}
+
+	// puts the sectors in the cache once every read has arrived
+	if(complete_disk_requests() == -1){
+		return(-1);
+	}
+	for(i = 0; i<queued; i++){
+		fs3_put_cache_prefetch(fillSectors[i].track, fillSectors[i].sector, staging + ((size_t)i * FS3_SECTOR_SIZE));
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_write
+// Description  : Writes "count" bytes to the file handle "fh" from the 
+//                buffer  "buf"
+//
+// Inputs       : fd - filename of the file to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+// Outputs      : bytes written if successful, -1 if failure
+
+int32_t fs3_write(int16_t fd, void *buf, int32_t count) {
+	// holds the disk lock so the background cache flusher does not use the disk at the same time
+	pthread_mutex_lock(&diskLock);
+	int32_t bytesWritten = write_file_data(fd, buf, count);
+	pthread_mutex_unlock(&diskLock);
+
+	return(bytesWritten);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_file_data
+// Description  : Writes "count" bytes to the file handle "fh" from the 
+//                buffer  "buf", with the disk lock held
+//
+// Inputs       : fd - filename of the file to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+// Outputs      : bytes written if successful, -1 if failure
+
+int32_t write_file_data(int16_t fd, void *buf, int32_t count) {
+	// checks that the file can be written to
+	if(check_open_file(fd) == -1){
+		return(-1);
+	}
+
+	// writes at the file's position, then moves the position past the bytes written
+	struct iovec userBuffer = { buf, count };
+	int32_t bytesWritten = write_file_vector(fd, &userBuffer, 1, FS3FileArray[fd].position);
+	if(bytesWritten > 0){
+		FS3FileArray[fd].position = FS3FileArray[fd].position + bytesWritten;
+	}
+
+	return(bytesWritten);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_pwrite
+// Description  : Writes "count" bytes to the file handle "fh" at "offset" from
+//                the buffer "buf", without using or moving the file's position
+//
+// Inputs       : fd - filename of the file to write to
+//                buf - pointer to buffer to write from
+//                count - number of bytes to write
+//                offset - position in the file to write at
+// Outputs      : bytes written if successful, -1 if failure
+
+int32_t fs3_pwrite(int16_t fd, void *buf, int32_t count, uint32_t offset) {
+	struct iovec userBuffer = { buf, count };
+
+	pthread_mutex_lock(&diskLock);
+	int32_t bytesWritten = write_file_vector(fd, &userBuffer, 1, offset);
+	pthread_mutex_unlock(&diskLock);
+
+	return(bytesWritten);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_pwritev
+// Description  : Writes to the file handle "fh" at "offset" from each of the
+//                buffers of "iov" in turn, without using or moving the file's position
+//
+// Inputs       : fd - filename of the file to write to
+//                iov - the buffers to write from
+//                iovcnt - number of buffers
+//                offset - position in the file to write at
+// Outputs      : bytes written if successful, -1 if failure
+
+int32_t fs3_pwritev(int16_t fd, const struct iovec *iov, int iovcnt, uint32_t offset) {
+	pthread_mutex_lock(&diskLock);
+	int32_t bytesWritten = write_file_vector(fd, iov, iovcnt, offset);
+	pthread_mutex_unlock(&diskLock);
+
+	return(bytesWritten);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_file_vector
+// Description  : Writes to the file handle "fh" at "offset" from each of the
+//                buffers of "iov" in turn, with the disk lock held
+//
+// Inputs       : fd - filename of the file to write to
+//                iov - the buffers to write from
+//                iovcnt - number of buffers
+//                offset - position in the file to write at
+// Outputs      : bytes written if successful, -1 if failure
+
+int32_t write_file_vector(int16_t fd, const struct iovec *iov, int iovcnt, uint32_t offset) {
+	// checks that the file can be written to
+	if(check_open_file(fd) == -1){
+		return(-1);
+	}
+	int32_t count = total_iovec_length(iov, iovcnt);
+	if(count == -1){
+		return(-1);
+	}
+	// checks that the write does not start past the end of the file, which would leave a hole
+	if(offset > (uint32_t)FS3FileArray[fd].length){
+		return(-1);
+	}
+	if(count <= 0){
+		return(0);
+	}
+
+	// works out every sector the write touches, allocating any new ones, and orders
+	//	them to sweep across the tracks once. If the write fails, the sectors allocated
+	//	for it are given back, so the file keeps no sectors past its length
+	int oldSectorCount = FS3FileArray[fd].sectorCount;
+	int planCount = plan_file_request(fd, offset, count, true);
+	if(planCount == -1){
+		release_file_sectors(fd, oldSectorCount);
+		return(-1);
+	}
+	order_request_plan(planCount);
+
+	// writes each sector from its place in the user's buffers, then waits for the writes sent
+	//	through to the disk
+	int i;
+	begin_disk_requests();
+	for(i = 0; i<planCount; i++){
+		if(write_request_sector(fd, &FS3RequestPlan[i], iov, iovcnt) == -1){
+			end_disk_requests();
+			release_file_sectors(fd, oldSectorCount);
+			return(-1);
+		}
+	}
+	if(end_disk_requests() == -1){
+		release_file_sectors(fd, oldSectorCount);
+		return(-1);
+	}
+
+	// updates metadata
+	if((int)offset + count > FS3FileArray[fd].length){
+		FS3FileArray[fd].length = (int)offset + count;
+	}
+
+	// lets the cache grow if it is missing too often
+	if(fs3_tune_cache() == -1){
+		return(-1);
+	}
+
+	return(count);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_open_file
+// Description  : Checks that a file handle is one of an open file on a mounted disk
+//
+// Inputs       : fd - the file descriptor
+// Outputs      : 0 if the file can be used, -1 if not
+
+int check_open_file(int16_t fd){
+	// checks that the disk is mounted
+	if(diskMounted == false){
+		return(-1);
+	}
+	// checks that the file handle is within the bounds of the maximum number of files
+	if((fd >= FS3_MAX_TOTAL_FILES) || (fd < (int16_t)0)){
+		return(-1);
+	}
+	// checks that the file has already been created
+	if(FS3FileArray[fd].created == false){
+		return(-1);
+	}
+	// checks that the file is not closed
+	if(FS3FileArray[fd].open == false){
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : total_iovec_length
+// Description  : Adds up the number of bytes in a list of user buffers
+//
+// Inputs       : iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : total number of bytes, or -1 if the list is not valid or too long
+
+int32_t total_iovec_length(const struct iovec *iov, int iovcnt){
+	if((iovcnt < 0) || ((iov == NULL) && (iovcnt > 0))){
+		return(-1);
+	}
+
+	int64_t total = 0;
+	int i;
+	for(i = 0; i<iovcnt; i++){
+		total = total + iov[i].iov_len;
+		if(total > INT32_MAX){
+			return(-1);
+		}
+	}
+
+	return((int32_t)total);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_iovec_data
+// Description  : Finds where a run of bytes of a request is in the user's buffers,
+//                if the whole run is inside one buffer
+//
+// Inputs       : iov - the user's buffers
+//                iovcnt - number of buffers
+//                offset - where the run starts, counting through the buffers in turn
+//                count - number of bytes in the run
+// Outputs      : pointer to the run, or NULL if it is split across buffers
+
+void * find_iovec_data(const struct iovec *iov, int iovcnt, int offset, int count){
+	int i;
+	for(i = 0; i<iovcnt; i++){
+		if(offset < (int)iov[i].iov_len){
+			if(offset + count <= (int)iov[i].iov_len){
+				return((char *)iov[i].iov_base + offset);
+			}
+			return(NULL);
+		}
+		offset = offset - iov[i].iov_len;
+	}
+
+	return(NULL);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : copy_to_iovec
+// Description  : Copies bytes into the user's buffers, starting "offset" bytes in
+//                and carrying on into the next buffer when one is full
+//
+// Inputs       : iov - the user's buffers
+//                iovcnt - number of buffers
+//                offset - where to start, counting through the buffers in turn
+//                src - the bytes to copy
+//                count - number of bytes to copy
+// Outputs      : 0 if successful
+
+int copy_to_iovec(const struct iovec *iov, int iovcnt, int offset, const void *src, int count){
+	int i;
+	for(i = 0; (i<iovcnt) && (count > 0); i++){
+		// skips the buffers before the start
+		if(offset >= (int)iov[i].iov_len){
+			offset = offset - iov[i].iov_len;
+			continue;
+		}
+
+		int copyCount = iov[i].iov_len - offset;
+		if(copyCount > count){
+			copyCount = count;
+		}
+		memcpy((char *)iov[i].iov_base + offset, src, copyCount);
+		src = (const char *)src + copyCount;
+		count = count - copyCount;
+		offset = 0;
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : copy_from_iovec
+// Description  : Copies bytes out of the user's buffers, starting "offset" bytes in
+//                and carrying on into the next buffer when one runs out
+//
+// Inputs       : dest - where to copy the bytes to
+//                iov - the user's buffers
+//                iovcnt - number of buffers
+//                offset - where to start, counting through the buffers in turn
+//                count - number of bytes to copy
+// Outputs      : 0 if successful
+
+int copy_from_iovec(void *dest, const struct iovec *iov, int iovcnt, int offset, int count){
+	int i;
+	for(i = 0; (i<iovcnt) && (count > 0); i++){
+		// skips the buffers before the start
+		if(offset >= (int)iov[i].iov_len){
+			offset = offset - iov[i].iov_len;
+			continue;
+		}
+
+		int copyCount = iov[i].iov_len - offset;
+		if(copyCount > count){
+			copyCount = count;
+		}
+		memcpy(dest, (const char *)iov[i].iov_base + offset, copyCount);
+		dest = (char *)dest + copyCount;
+		count = count - copyCount;
+		offset = 0;
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : plan_file_request
+// Description  : Works out the disk location and part of the user's buffers of every
+//                sector touched by a read or write, in file order, into FS3RequestPlan
+//
+// Inputs       : fd - the file descriptor
+//                position - the file position the request starts at
+//                count - number of bytes in the request
+//                allocate - true if sectors past the end of the file are allocated (writes)
+// Outputs      : number of sectors in the plan, or -1 if failure
+
+int plan_file_request(int16_t fd, int position, int count, bool allocate){
+	// grows the plan so it can hold every sector of the request
+	int planCount = SECTOR_INDEX_NUMBER(position + count - 1) - SECTOR_INDEX_NUMBER(position) + 1;
+	if(planCount > requestPlanSize){
+		FS3SectorRequest *newPlan = realloc(FS3RequestPlan, planCount * sizeof(FS3SectorRequest));
+		if(newPlan == NULL){
+			return(-1);
+		}
+		FS3RequestPlan = newPlan;
+		requestPlanSize = planCount;
+	}
+
+	int i;
+	int bufferOffset = 0;
+	for(i = 0; i<planCount; i++){
+		FS3SectorRequest *request = &FS3RequestPlan[i];
+		int partNum = SECTOR_INDEX_NUMBER(position);
+
+		// works out the part of the sector and of the user's buffer the request covers
+		request->positionInSector = position % FS3_SECTOR_SIZE;
+		request->byteCount = count;
+		if((FS3_SECTOR_SIZE - request->positionInSector) < request->byteCount){
+			request->byteCount = FS3_SECTOR_SIZE - request->positionInSector;
+		}
+		request->bufferOffset = bufferOffset;
+		request->newSector = false;
+
+		// finds the sector in the file's sector map, or allocates it if it is past the end of the file
+		request->fileSector = partNum;
+		if(partNum < FS3FileArray[fd].sectorCount){
+			request->track = FS3FileArray[fd].sectorMap[partNum].track;
+			request->sector = FS3FileArray[fd].sectorMap[partNum].sector;
+		} else if(allocate == true){
+			if(allocate_file_sector(fd, &request->track, &request->sector) == -1){
+				// if there are no free sectors left on the disk, the request fails
+				return(-1);
+			}
+			request->newSector = true;
+		} else {
+			return(-1);
+		}
+
+		// works out if any of the file's data already in the sector will be left after a write, which
+		//	is not the case for new sectors or writes covering all of the file's data in the sector
+		int fileEndInSector = FS3FileArray[fd].length - (position - request->positionInSector);
+		if(fileEndInSector > FS3_SECTOR_SIZE){
+			fileEndInSector = FS3_SECTOR_SIZE;
+		}
+		request->keepsOldData = (request->newSector == false) && ((request->positionInSector > 0) || (request->byteCount < fileEndInSector));
+
+		position = position + request->byteCount;
+		bufferOffset = bufferOffset + request->byteCount;
+		count = count - request->byteCount;
+	}
+
+	return(planCount);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : order_request_plan
+// Description  : Orders the sectors of FS3RequestPlan as an elevator sweep, first up
+//                through the tracks from the current track and then back down, so
+//                each track is only seeked to once. The heads of every connection
+//                sweep the tracks together, so the first one's stands for them all
+//
+// Inputs       : planCount - number of sectors in the plan
+// Outputs      : 0 if successful
+
+int order_request_plan(int planCount){
+	// if the disk is not on a track yet, the sweep starts from the first track
+	planHeadTrack = connectionTracks[0];
+	if(planHeadTrack < 0){
+		planHeadTrack = 0;
+	}
+
+	qsort(FS3RequestPlan, planCount, sizeof(FS3SectorRequest), compare_sector_requests);
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_sector_requests
+// Description  : Orders two sector requests for the elevator sweep
+//
+// Inputs       : a - pointer to the first sector request
+//                b - pointer to the second sector request
+// Outputs      : negative, zero, or positive as the first request comes before, with, or after the second
+
+int compare_sector_requests(const void *a, const void *b){
+	const FS3SectorRequest *requestA = a;
+	const FS3SectorRequest *requestB = b;
+
+	// tracks at or above the head are visited first in rising order, then the ones below in falling order
+	int sweepA = (requestA->track >= planHeadTrack) ? (requestA->track - planHeadTrack) : (FS3_MAX_TRACKS + planHeadTrack - requestA->track);
+	int sweepB = (requestB->track >= planHeadTrack) ? (requestB->track - planHeadTrack) : (FS3_MAX_TRACKS + planHeadTrack - requestB->track);
+
+	if(sweepA != sweepB){
+		return(sweepA - sweepB);
+	}
+	return(requestA->sector - requestB->sector);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_request_sector
+// Description  : Copies one sector of a planned read from the cache into its place in the
+//                user's buffers, or sends its read to the disk if the cache does not hold it
+//
+// Inputs       : fd - the file descriptor being read
+//                request - the planned sector
+//                iov - the user's buffers for the whole read
+//                iovcnt - number of buffers
+// Outputs      : 0 if successful, -1 if failure
+
+int read_request_sector(int16_t fd, FS3SectorRequest *request, const struct iovec *iov, int iovcnt){
+	// tries to get the data from the cache, pinning its line while it is copied
+	FS3CacheRef cacheRef;
+
+	FS3FileArray[fd].cacheGets = FS3FileArray[fd].cacheGets + 1;
+
+	if(fs3_get_cache_ref((FS3TrackIndex)request->track, (FS3SectorIndex)request->sector, &cacheRef) == 0){
+		// if the data was in the cache, copies the bytes wanted from it straight to the user's buffers
+		FS3FileArray[fd].cacheHits = FS3FileArray[fd].cacheHits + 1;
+		copy_to_iovec(iov, iovcnt, request->bufferOffset, cacheRef.data + request->positionInSector, request->byteCount);
+		fs3_release_cache_ref(&cacheRef);
+		request->diskData = NULL;
+		return(0);
+	}
+
+	// otherwise sends the read of the sector to the disk without waiting for it, to be finished
+	//	by finish_request_sector once every read of the plan has arrived
+	return(queue_disk_sector_read(request->track, request->sector, request->diskData));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : finish_request_sector
+// Description  : Finishes a sector of a planned read that was read from the disk,
+//                copying the part wanted out of its staging buffer
+//
+// Inputs       : request - the planned sector
+//                iov - the user's buffers for the whole read
+//                iovcnt - number of buffers
+// Outputs      : 0 if successful, -1 if failure
+
+int finish_request_sector(FS3SectorRequest *request, const struct iovec *iov, int iovcnt){
+	// a sector found in the cache is already in the user's buffers
+	if(request->diskData == NULL){
+		return(0);
+	}
+
+	// a sector read into a staging buffer has the part wanted copied to the user's buffers
+	if(request->staged == true){
+		copy_to_iovec(iov, iovcnt, request->bufferOffset, request->diskData + request->positionInSector, request->byteCount);
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_request_sector
+// Description  : Writes one sector of a planned write from its place in the user's buffers
+//
+// Inputs       : fd - the file descriptor being written
+//                request - the planned sector
+//                iov - the user's buffers for the whole write
+//                iovcnt - number of buffers
+// Outputs      : 0 if successful, -1 if failure
+
+int write_request_sector(int16_t fd, FS3SectorRequest *request, const struct iovec *iov, int iovcnt){
+	// if the whole sector is being written from one buffer it is sent straight from the
+	//	user's buffer, otherwise it is put together in a pool buffer
+	void *diskBuf = NULL;
+	bool pooled = false;
+	if(request->byteCount == FS3_SECTOR_SIZE){
+		diskBuf = find_iovec_data(iov, iovcnt, request->bufferOffset, request->byteCount);
+	}
+	if(diskBuf == NULL){
+		diskBuf = get_sector_buffer();
+		if(diskBuf == NULL){
+			return(-1);
+		}
+		pooled = true;
+
+		if(request->byteCount == FS3_SECTOR_SIZE){
+			// if the whole sector is being written, none of it needs filling in
+		} else if(request->keepsOldData == false){
+			// if none of the data already there is kept, the part of the sector not being written is filled with zeros
+			memset(diskBuf, 0, FS3_SECTOR_SIZE);
+		} else {
+			// if part of a sector with data already written in it is being written to,
+			//	it will read the data already there into the buffer
+
+			// tries to get the data from the cache, pinning its line while it is copied
+			FS3CacheRef cacheRef;
+			FS3FileArray[fd].cacheGets = FS3FileArray[fd].cacheGets + 1;
+
+			// if the data was not in the cache, get it from the disk
+			if(fs3_get_cache_ref(request->track, request->sector, &cacheRef) == -1){
+				if(read_disk_sector(request->track, request->sector, diskBuf) == -1){
+					release_sector_buffer(diskBuf);
+					return(-1);
+				}
+			} else {
+				// if the data was in the cache, copy it over to the disk buffer, then releases the line
+				//	before the sector is put back in the cache
+				FS3FileArray[fd].cacheHits = FS3FileArray[fd].cacheHits + 1;
+				memcpy(diskBuf, cacheRef.data, FS3_SECTOR_SIZE);
+				fs3_release_cache_ref(&cacheRef);
+			}
+		}
+
+		// copies the bytes being written into the disk buffer at their place in the sector
+		copy_from_iovec(diskBuf + request->positionInSector, iov, iovcnt, request->bufferOffset, request->byteCount);
+	}
+
+	// in write-back mode the cache holds the new data until it is flushed, otherwise
+	//	the data is put in the cache and sent through to the disk, without waiting for the reply
+	int writeResult = 0;
+	if(fs3_put_cache_dirty(request->track, request->sector, diskBuf) == -1){
+		fs3_put_cache(request->track, request->sector, diskBuf);
+		writeResult = queue_disk_sector_write(request->track, request->sector, diskBuf);
+
+		// a pool buffer is reused by the next sector, so the writes held are sent before it is given back
+		if((pooled == true) && (writeResult == 0)){
+			writeResult = network_fs3_flush();
+		}
+	}
+
+	// gives the pool buffer back
+	if(pooled == true){
+		release_sector_buffer(diskBuf);
+	}
+
+	return(writeResult);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_seek
+// Description  : Seek to specific point in the file
+//
+// Inputs       : fd - filename of the file to write to
+//                loc - offfset of file in relation to beginning of file
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t fs3_seek(int16_t fd, uint32_t loc) {
+	// checks that the file handle is within the bounds of the maximum number of files
+	if((fd >= FS3_MAX_TOTAL_FILES) || (fd < (int16_t)0)){
+		return(-1);
+	}
+	// checks that the file has already been created
+	if(FS3FileArray[fd].created == false){
+		return(-1);
+	}
+	// checks that the location is not beyond the end of the file
+	if(loc > FS3FileArray[fd].length){
+		return(-1);
+	}
+	// checks that the file is not closed
+	if(FS3FileArray[fd].open == false){
+		return(-1);
+	}
+
+	// sets the position of the file to loc
+	FS3FileArray[fd].position = loc;
+
+	return (0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_file_cache_stats
+// Description  : Gets how many sectors of a file its reads and partial writes
+//                looked up in the cache, and how many were found there
+//
+// Inputs       : fd - the file descriptor
+//                gets - set to the number of sectors looked up
+//                hits - set to the number of sectors found in the cache
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_file_cache_stats(int16_t fd, int *gets, int *hits){
+	// checks that the file handle is one of a created file
+	if((fd < 0) || (fd >= FS3_MAX_TOTAL_FILES) || (FS3FileArray[fd].created == false)){
+		return(-1);
+	}
+
+	*gets = FS3FileArray[fd].cacheGets;
+	*hits = FS3FileArray[fd].cacheHits;
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_cache_telemetry
+// Description  : Writes the cache telemetry to a file as JSON, the cache's metrics
+//                with the hit ratio of every file that looked up a sector
+//
+// Inputs       : path - the file to write to
+// Outputs      : 0 if successful, -1 if failure
+
+int write_cache_telemetry(char *path){
+	FILE *out = fopen(path, "w");
+	if(out == NULL){
+		logMessage(LOG_ERROR_LEVEL, "FS3 cache telemetry could not be written to %s", path);
+		return(-1);
+	}
+
+	fprintf(out, "{\n\"cache\": ");
+	fs3_write_cache_metrics_json(out);
+	fprintf(out, ",\n\"files\": [");
+
+	// writes the files in handle order, which is the order they were created in
+	int i;
+	int written = 0;
+	for(i = 0; i<FS3_MAX_TOTAL_FILES; i++){
+		if(FS3FileArray[i].created == false){
+			break;
+		}
+		if(FS3FileArray[i].cacheGets == 0){
+			continue;
+		}
+
+		fprintf(out, "%s\n    {\"name\": ", (written > 0) ? "," : "");
+		write_json_string(out, FS3FileArray[i].name);
+		fprintf(out, ", \"length\": %d, \"gets\": %d, \"hits\": %d, \"hitRatio\": %.4f}",
+			FS3FileArray[i].length, FS3FileArray[i].cacheGets, FS3FileArray[i].cacheHits,
+			(double)FS3FileArray[i].cacheHits / FS3FileArray[i].cacheGets);
+		written = written + 1;
+	}
+	fprintf(out, "%s]\n}\n", (written > 0) ? "\n" : "");
+
+	if(fclose(out) != 0){
+		logMessage(LOG_ERROR_LEVEL, "FS3 cache telemetry could not be written to %s", path);
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_json_string
+// Description  : Writes a string as a quoted JSON string, escaping the characters
+//                JSON does not allow in one
+//
+// Inputs       : out - the file to write to
+//                str - the string
+// Outputs      : 0 if successful
+
+int write_json_string(FILE *out, const char *str){
+	fputc('"', out);
+	for(; *str != '\0'; str++){
+		unsigned char c = (unsigned char) *str;
+		if((c == '"') || (c == '\\')){
+			fputc('\\', out);
+			fputc(c, out);
+		} else if(c < 0x20){
+			fprintf(out, "\\u%04x", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_file_name
+// Description  : Hashes a filename for the filename index (FNV-1a)
+//
+// Inputs       : path - the filename to hash
+// Outputs      : the 32 bit hash of the filename
+
+uint32_t hash_file_name(char *path){
+	uint32_t hash = 2166136261u;
+
+	// mixes each character of the filename into the hash
+	while(*path != '\0'){
+		hash = hash ^ (uint8_t)(*path);
+		hash = hash * 16777619u;
+		path++;
+	}
+
+	return(hash);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_file_index_slot
+// Description  : Finds the slot of the filename index holding a file, or the
+//                empty slot the file would be placed in
+//
+// Inputs       : path - the filename to look for
+// Outputs      : the index slot number
+
+int find_file_index_slot(char *path){
+	int slot = (int) (hash_file_name(path) & (FS3_FILE_INDEX_SIZE - 1));
+
+	// probes the following slots until the file or an empty slot is found, the index
+	//	is never more than half full so an empty slot always exists
+	while(FS3FileIndex[slot] != -1){
+		if(strcmp(FS3FileArray[FS3FileIndex[slot]].name, path) == 0){
+			return(slot);
+		}
+		slot = (slot + 1) & (FS3_FILE_INDEX_SIZE - 1);
+	}
+
+	return(slot);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : switch_disk_track
+// Description  : Switches the track the disk in on to a new track, on every connection
+//
+// Inputs       : trackNum - the track number to switch to
+// Outputs      : 0 if successful, -1 if failure
+
+int switch_disk_track(int trackNum){
+	// sends the seek on each connection, then waits for them
+	int conn;
+	for(conn = 0; conn < network_fs3_connection_count(); conn++){
+		if(queue_disk_track_switch(conn, trackNum) == -1){
+			complete_disk_requests();
+			return(-1);
+		}
+	}
+
+	return(complete_disk_requests());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_disk_sector
+// Description  : Reads a sector from the disk into a buffer, seeking to its track first if needed
+//
+// Inputs       : trackNum - the track number of the sector
+//                sectorNum - the sector number of the sector
+//                buf - buffer of FS3_SECTOR_SIZE bytes to read the sector into
+// Outputs      : 0 if successful, -1 if failure
+
+int read_disk_sector(int trackNum, int sectorNum, void *buf){
+	// sends the read, then waits for it
+	if(queue_disk_sector_read(trackNum, sectorNum, buf) == -1){
+		complete_disk_requests();
+		return(-1);
+	}
+
+	return(complete_disk_requests());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_disk_sector
+// Description  : Writes a buffer to a sector on the disk, seeking to its track first if needed
+//
+// Inputs       : trackNum - the track number of the sector
+//                sectorNum - the sector number of the sector
+//                buf - buffer of FS3_SECTOR_SIZE bytes to write to the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int write_disk_sector(int trackNum, int sectorNum, void *buf){
+	// sends the write, then waits for it
+	if(queue_disk_sector_write(trackNum, sectorNum, buf) == -1){
+		complete_disk_requests();
+		return(-1);
+	}
+
+	return(complete_disk_requests());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : send_disk_sector_write
+// Description  : Sends a write of a sector on to the disk without waiting for its
+//                reply, so the buffer can change as soon as this returns. A failure
+//                is reported by the next complete_disk_requests
+//
+// Inputs       : trackNum - the track number of the sector
+//                sectorNum - the sector number of the sector
+//                buf - buffer of FS3_SECTOR_SIZE bytes to write to the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int send_disk_sector_write(int trackNum, int sectorNum, void *buf){
+	if(queue_disk_sector_write(trackNum, sectorNum, buf) == -1){
+		return(-1);
+	}
+
+	return(network_fs3_flush());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queue_disk_track_switch
+// Description  : Sends a seek to a new track on a connection without waiting for its reply
+//
+// Inputs       : conn - the connection whose head is moved
+//                trackNum - the track number
+// Outputs      : 0 if successful, -1 if failure
+
+int queue_disk_track_switch(int conn, int trackNum){
+	// checks that the disk is mounted
+	if(diskMounted == false){
+		return(-1);
+	}
+	// checks to make sure the trackNum is valid
+	if((trackNum<0) || (trackNum>=FS3_MAX_TRACKS)){
+		return(-1);
+	}
+
+	// constructs command block for the seek opcode
+	FS3CmdBlk cmdblock = construct_fs3_cmdblock(FS3_OP_TSEEK, 0, (uint_fast32_t) trackNum, 0);
+	if(queue_disk_command(conn, cmdblock, NULL) == -1){
+		return(-1);
+	}
+
+	// the connection's head is on the new track for every command sent on it after the seek
+	connectionTracks[conn] = trackNum;
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queue_disk_sector_read
+// Description  : Sends a read of a sector without waiting for its reply, seeking
+//                to its track first if needed. The buffer is filled by the time
+//                complete_disk_requests returns
+//
+// Inputs       : trackNum - the track number of the sector
+//                sectorNum - the sector number of the sector
+//                buf - buffer of FS3_SECTOR_SIZE bytes to read the sector into
+// Outputs      : 0 if successful, -1 if failure
+
+int queue_disk_sector_read(int trackNum, int sectorNum, void *buf){
+	// switches the head of the sector's connection to the sector's track
+	int conn = find_disk_connection(trackNum, sectorNum);
+	if(connectionTracks[conn] != trackNum){
+		if(queue_disk_track_switch(conn, trackNum) == -1){
+			return(-1);
+		}
+	}
+
+	// constructs command block for the read opcode
+	FS3CmdBlk cmdblock = construct_fs3_cmdblock(FS3_OP_RDSECT, sectorNum, 0, 0);
+
+	return(queue_disk_command(conn, cmdblock, buf));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queue_disk_sector_write
+// Description  : Sends a write of a sector without waiting for its reply, seeking
+//                to its track first if needed. The buffer is written to the socket
+//                with the commands sent after it, so it must not change until
+//                complete_disk_requests returns or network_fs3_flush is called.
+//                Every command for a sector goes over the same connection, so a
+//                read sent after a write is answered after it
+//
+// Inputs       : trackNum - the track number of the sector
+//                sectorNum - the sector number of the sector
+//                buf - buffer of FS3_SECTOR_SIZE bytes to write to the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int queue_disk_sector_write(int trackNum, int sectorNum, void *buf){
+	// switches the head of the sector's connection to the sector's track
+	int conn = find_disk_connection(trackNum, sectorNum);
+	if(connectionTracks[conn] != trackNum){
+		if(queue_disk_track_switch(conn, trackNum) == -1){
+			return(-1);
+		}
+	}
+
+	// constructs command block for the write opcode
+	FS3CmdBlk cmdblock = construct_fs3_cmdblock(FS3_OP_WRSECT, sectorNum, 0, 0);
+
+	return(queue_disk_command(conn, cmdblock, buf));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_disk_connection
+// Description  : Works out the connection the commands for a sector are sent on.
+//                Each track is split into rows of FS3_CONNECTION_STRIPE sectors
+//                dealt out to the connections in turn, so a long run of sectors is
+//                moved over all of them at once
+//
+// Inputs       : trackNum - the track number of the sector
+//                sectorNum - the sector number of the sector
+// Outputs      : the index of the connection
+
+int find_disk_connection(int trackNum, int sectorNum){
+	int stripe = ((trackNum * FS3_TRACK_SIZE) + sectorNum) / FS3_CONNECTION_STRIPE;
+
+	return(stripe % network_fs3_connection_count());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queue_disk_command
+// Description  : Sends a command to the disk on a connection without waiting for
+//                its reply, first reading the connection's oldest replies if its
+//                pipeline is full
+//
+// Inputs       : conn - the connection to send the command on
+//                cmdblock - the command block
+//                buf - the sector buffer of the command, NULL if none
+// Outputs      : 0 if successful, -1 if failure
+
+int queue_disk_command(int conn, FS3CmdBlk cmdblock, void *buf){
+	// works out how many commands may wait for replies on the connection, 1 waiting for each reply
+	//	before the next is sent
+	int depth = fs3_network_pipeline_depth;
+	if(depth > FS3_MAX_PIPELINE_DEPTH){
+		depth = FS3_MAX_PIPELINE_DEPTH;
+	}
+	if(depth < 1){
+		depth = 1;
+	}
+
+	// once the pipeline is full, reads replies until it is half empty, so the commands sent
+	//	next go out together in one write rather than one at a time as each reply is read
+	if(network_fs3_pending(conn) >= depth){
+		while(network_fs3_pending(conn) > depth / 2){
+			collect_disk_reply(conn);
+		}
+	}
+
+	return(network_fs3_send(conn, cmdblock, buf));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : collect_disk_reply
+// Description  : Reads the reply to the oldest command sent ahead on a connection,
+//                remembering a failure for complete_disk_requests to report
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the command failed
+
+int collect_disk_reply(int conn){
+	FS3CmdBlk returnCmdblock;
+	if((network_fs3_receive(conn, &returnCmdblock) == -1) || (getReturnBit(returnCmdblock) != 0)){
+		// after a failure the connection's head may not be on the track it was thought to be,
+		//	so the next command on it seeks again
+		pipelineFailed = true;
+		connectionTracks[conn] = -1;
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : complete_disk_requests
+// Description  : Waits for the reply to every command sent ahead, on every connection
+//
+// Inputs       : none
+// Outputs      : 0 if every command succeeded, -1 if any failed
+
+int complete_disk_requests(void){
+	// the first reply collected writes every connection's commands held before waiting on any,
+	//	so they are all worked on at once, and lets the transport send its own with the read
+	int conn;
+	for(conn = 0; conn < network_fs3_connection_count(); conn++){
+		while(network_fs3_pending(conn) > 0){
+			collect_disk_reply(conn);
+		}
+	}
+
+	// a failure is kept for the outermost read or write to report once it is done, so one
+	//	collected by a wait nested inside it is not lost
+	int result = (pipelineFailed == true) ? -1 : 0;
+	if(diskRequestDepth == 0){
+		pipelineFailed = false;
+	}
+
+	return(result);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : find_open_sector
-// Description  : Finds a sector with no data in it on the current track
+// Function     : begin_disk_requests
+// Description  : Starts a read or write of the disk that sends commands ahead,
+//                so waits nested inside it keep any failure for it to report
 //
-// Outputs      : number of first open sector, or -1 if all sectors on track are full
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int begin_disk_requests(void){
+	diskRequestDepth = diskRequestDepth + 1;
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : end_disk_requests
+// Description  : Finishes a read or write started by begin_disk_requests, waiting
+//                for every command still sent ahead
+//
+// Inputs       : none
+// Outputs      : 0 if every command sent during it succeeded, -1 if any failed
+
+int end_disk_requests(void){
+	diskRequestDepth = diskRequestDepth - 1;
+
+	return(complete_disk_requests());
+}
 
-int find_open_sector(){
-	int i;
 
-	// loops through the entire current track
-	for(i = 0; i<FS3_TRACK_SIZE; i++){
-		// if a sector has no file data in it, it returns that sector number
-		if(FS3DiskMap[currentDiskTrack][i] == -1){
-			return(i);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserve_staging_area
+// Description  : Makes sure a staging area holds a number of sectors, growing it
+//                if needed. Whatever it held before is lost when it grows
+//
+// Inputs       : area - the staging area
+//                sectors - number of sectors it must hold
+// Outputs      : pointer to the first sector of the area, NULL if failure
+
+void * reserve_staging_area(FS3StagingArea *area, int sectors){
+	if((sectors > area->size) || (area->sectors == NULL)){
+		free(area->sectors);
+		area->size = (sectors > FS3_SECTOR_POOL_SIZE) ? sectors : FS3_SECTOR_POOL_SIZE;
+		if(posix_memalign(&area->sectors, FS3_SECTOR_POOL_ALIGNMENT, (size_t)area->size * FS3_SECTOR_SIZE) != 0){
+			area->sectors = NULL;
+			area->size = 0;
+			return(NULL);
 		}
 	}
 
-	return(-1);
+	return(area->sectors);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_sector_pool
+// Description  : Allocates the pool of aligned sector buffers used to move sectors
+//                to and from the disk, so reads and writes do not allocate memory
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int init_sector_pool(){
+	// allocates every buffer of the pool in one aligned block of memory
+	if(sectorPool == NULL){
+		if(posix_memalign(&sectorPool, FS3_SECTOR_POOL_ALIGNMENT, FS3_SECTOR_POOL_SIZE * FS3_SECTOR_SIZE) != 0){
+			sectorPool = NULL;
+			return(-1);
+		}
+	}
+
+	// puts every buffer on the free stack
+	int i;
+	for(i = 0; i<FS3_SECTOR_POOL_SIZE; i++){
+		freeSectorBuffers[i] = sectorPool + (i * FS3_SECTOR_SIZE);
+	}
+	freeSectorBufferCount = FS3_SECTOR_POOL_SIZE;
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_sector_pool
+// Description  : Deallocates the pool of sector buffers, and the staging areas
+//
+// Outputs      : 0 if successful
+
+int free_sector_pool(){
+	network_fs3_register_buffers(NULL, 0);
+	free(sectorPool);
+	sectorPool = NULL;
+	freeSectorBufferCount = 0;
+
+	// frees the staging areas too
+	free(readStaging.sectors);
+	readStaging.sectors = NULL;
+	readStaging.size = 0;
+	free(prefetchStaging.sectors);
+	prefetchStaging.sectors = NULL;
+	prefetchStaging.size = 0;
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_sector_buffer
+// Description  : Takes a sector buffer from the pool
+//
+// Outputs      : pointer to a buffer of FS3_SECTOR_SIZE bytes, or NULL if none are free
+
+void * get_sector_buffer(){
+	if(freeSectorBufferCount == 0){
+		return(NULL);
+	}
+
+	freeSectorBufferCount = freeSectorBufferCount - 1;
+	return(freeSectorBuffers[freeSectorBufferCount]);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_sector_buffer
+// Description  : Gives a sector buffer back to the pool
+//
+// Inputs       : sectorBuf - the buffer taken from get_sector_buffer
+// Outputs      : 0 if successful, -1 if failure
+
+int release_sector_buffer(void *sectorBuf){
+	if((sectorBuf == NULL) || (freeSectorBufferCount == FS3_SECTOR_POOL_SIZE)){
+		return(-1);
+	}
+
+	freeSectorBuffers[freeSectorBufferCount] = sectorBuf;
+	freeSectorBufferCount = freeSectorBufferCount + 1;
+	return(0);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : find_current_track
-// Description  : Finds the track number in which the position of the file is on
+// Function     : init_free_sector_map
+// Description  : Marks every sector on the disk as free
 //
-// Inputs 		: fd - the file descriptor
-// Outputs      : Current track number, or -1 if failure to find
+// Outputs      : 0 if successful
 
-int find_current_track(int16_t fd){
-	// sees what part of the file the position is in
-	int partNum = (int) (FS3FileArray[fd].position/FS3_SECTOR_SIZE);
-	
+int init_free_sector_map(){
 	int i;
 	int j;
-	int count = -1;
 
-	// loops through the entire disk map
+	// sets every bit of every track's bitmap, and each track's free count to the full track
 	for(i = 0; i<FS3_MAX_TRACKS; i++){
-		for(j = 0; j<FS3_TRACK_SIZE; j++){
-			// if a match is found, it increases the count
-			if(FS3DiskMap[i][j] == fd){
-				count = count + 1;
-
-				// if the count equals the partNum, it returns the track number
-				if(count == partNum){
-					return(i);
-				}
-			}
+		for(j = 0; j<FS3_TRACK_BITMAP_WORDS; j++){
+			FS3FreeSectorMap[i][j] = ~((uint64_t)0);
+		}
+		FS3TrackFreeCount[i] = FS3_TRACK_SIZE;
+	}
 
-			// if it reaches the point where there are no more files, it ends the function
-			if(FS3DiskMap[i][j] == -1){
-				return(-1);
-			}
+	// sets the bit of every track in the track summary
+	for(i = 0; i<FS3_DISK_BITMAP_WORDS; i++){
+		FS3FreeTrackMap[i] = 0;
+	}
+	for(i = 0; i<FS3_MAX_TRACKS; i++){
+		FS3FreeTrackMap[i/FS3_BITMAP_WORD_BITS] |= ((uint64_t)1 << (i%FS3_BITMAP_WORD_BITS));
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_open_track
+// Description  : Finds a track in which there is a sector with no data in it
+//
+// Outputs      : first track number with open sector, or -1 if all sectors full
+
+int find_open_track(){
+	int i;
+
+	// finds the first word of the track summary with a track that has a free sector
+	for(i = 0; i<FS3_DISK_BITMAP_WORDS; i++){
+		if(FS3FreeTrackMap[i] != 0){
+			// the lowest set bit of the word is the first track with a free sector
+			return((i*FS3_BITMAP_WORD_BITS) + __builtin_ctzll(FS3FreeTrackMap[i]));
 		}
 	}
 
@@ -623,41 +2023,352 @@ int find_current_track(int16_t fd){
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : find_current_sector
-// Description  : Finds the sector number in which the position of the file is on
+// Function     : claim_disk_sector
+// Description  : Marks a free sector on the disk as used
+//
+// Inputs		: trackNum - the track number of the sector
+//				  sectorNum - the sector number of the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int claim_disk_sector(int trackNum, int sectorNum){
+	// checks that the track and sector are valid
+	if((trackNum < 0) || (trackNum >= FS3_MAX_TRACKS) || (sectorNum < 0) || (sectorNum >= FS3_TRACK_SIZE)){
+		return(-1);
+	}
+
+	uint64_t sectorBit = (uint64_t)1 << (sectorNum%FS3_BITMAP_WORD_BITS);
+
+	// checks that the sector is not already used
+	if((FS3FreeSectorMap[trackNum][sectorNum/FS3_BITMAP_WORD_BITS] & sectorBit) == 0){
+		return(-1);
+	}
+
+	// clears the sector's bit and updates the track's free count
+	FS3FreeSectorMap[trackNum][sectorNum/FS3_BITMAP_WORD_BITS] &= ~sectorBit;
+	FS3TrackFreeCount[trackNum] = FS3TrackFreeCount[trackNum] - 1;
+
+	// if the track is now full, it is removed from the track summary
+	if(FS3TrackFreeCount[trackNum] == 0){
+		FS3FreeTrackMap[trackNum/FS3_BITMAP_WORD_BITS] &= ~((uint64_t)1 << (trackNum%FS3_BITMAP_WORD_BITS));
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_disk_sector
+// Description  : Marks a used sector on the disk as free
+//
+// Inputs		: trackNum - the track number of the sector
+//				  sectorNum - the sector number of the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int release_disk_sector(int trackNum, int sectorNum){
+	// checks that the track and sector are valid
+	if((trackNum < 0) || (trackNum >= FS3_MAX_TRACKS) || (sectorNum < 0) || (sectorNum >= FS3_TRACK_SIZE)){
+		return(-1);
+	}
+
+	uint64_t sectorBit = (uint64_t)1 << (sectorNum%FS3_BITMAP_WORD_BITS);
+
+	// checks that the sector is not already free
+	if((FS3FreeSectorMap[trackNum][sectorNum/FS3_BITMAP_WORD_BITS] & sectorBit) != 0){
+		return(-1);
+	}
+
+	// sets the sector's bit, updates the track's free count and adds the track to the track summary
+	FS3FreeSectorMap[trackNum][sectorNum/FS3_BITMAP_WORD_BITS] |= sectorBit;
+	FS3TrackFreeCount[trackNum] = FS3TrackFreeCount[trackNum] + 1;
+	FS3FreeTrackMap[trackNum/FS3_BITMAP_WORD_BITS] |= ((uint64_t)1 << (trackNum%FS3_BITMAP_WORD_BITS));
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_free_run
+// Description  : Finds the first run of free sectors on a track
+//
+// Inputs		: trackNum - the track number to search
+//				  maxLength - the longest run to return
+//				  startSector - pointer to where the first sector of the run will be written to
+// Outputs      : length of the run found, or 0 if the track is full
+
+int find_free_run(int trackNum, int maxLength, int *startSector){
+	int i;
+	int start = -1;
+
+	// finds the first free sector on the track
+	for(i = 0; i<FS3_TRACK_BITMAP_WORDS; i++){
+		if(FS3FreeSectorMap[trackNum][i] != 0){
+			start = (i*FS3_BITMAP_WORD_BITS) + __builtin_ctzll(FS3FreeSectorMap[trackNum][i]);
+			break;
+		}
+	}
+	if(start == -1){
+		return(0);
+	}
+
+	// extends the run for as long as the following sectors are free
+	int length = 1;
+	while((length < maxLength) && (start + length < FS3_TRACK_SIZE)){
+		int sectorNum = start + length;
+		if((FS3FreeSectorMap[trackNum][sectorNum/FS3_BITMAP_WORD_BITS] & ((uint64_t)1 << (sectorNum%FS3_BITMAP_WORD_BITS))) == 0){
+			break;
+		}
+		length = length + 1;
+	}
+
+	*startSector = start;
+	return(length);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserve_file_sectors
+// Description  : Reserves a run of free sectors on one track for a file to grow into,
+//                keeping the file on the track of its last sector when it can
 //
 // Inputs		: fd - the file descriptor
-// Outputs      : Current sector number, or -1 if failure to find
+// Outputs      : 0 if successful, -1 if the disk is full
 
-int find_current_sector(int16_t fd){
-	// sees what part of the file the position is in
-	int partNum = (int) (FS3FileArray[fd].position/FS3_SECTOR_SIZE);
-	
+int reserve_file_sectors(int16_t fd){
+	int trackNum = -1;
 	int i;
-	int j;
-	int count = -1;
 
-	// loops through the entire disk map
-	for(i = 0; i<FS3_MAX_TRACKS; i++){
-		for(j = 0; j<FS3_TRACK_SIZE; j++){
-			// if a match is found, it increases the count
-			if(FS3DiskMap[i][j] == fd){
-				count = count + 1;
-				
-				// if the count equals the partNum, it returns the sector number
-				if(count == partNum){
-					return(j);
-				}
-			}
+	// prefers the track the file's last sector is on, so the file stays on as few tracks as possible
+	if(FS3FileArray[fd].sectorCount > 0){
+		int lastTrack = FS3FileArray[fd].sectorMap[FS3FileArray[fd].sectorCount - 1].track;
+		if(FS3TrackFreeCount[lastTrack] > 0){
+			trackNum = lastTrack;
+		}
+	}
 
-			// if it reaches the point where there are no more files, it ends the function
-			if(FS3DiskMap[i][j] == -1){
-				return(-1);
+	// otherwise moves the file to the first track with room
+	if(trackNum == -1){
+		trackNum = find_open_track();
+	}
+
+	// if the disk is full, gives back the sectors reserved by every file and tries again
+	if(trackNum == -1){
+		for(i = 0; i<FS3_MAX_TOTAL_FILES; i++){
+			if(FS3FileArray[i].created == true){
+				release_file_reservation((int16_t) i);
 			}
 		}
+		trackNum = find_open_track();
+		if(trackNum == -1){
+			return(-1);
+		}
 	}
 
-	return(-1);
+	// finds a run of free sectors on the track, reserving at least one sector
+	int runSize = fs3_reservation_size;
+	if(runSize < 1){
+		runSize = 1;
+	}
+	int startSector;
+	int runLength = find_free_run(trackNum, runSize, &startSector);
+
+	// marks every sector of the run as used so no other file is given them
+	for(i = 0; i<runLength; i++){
+		claim_disk_sector(trackNum, startSector + i);
+	}
+
+	// saves the run as the file's reservation
+	FS3FileArray[fd].reservedTrack = trackNum;
+	FS3FileArray[fd].reservedSector = startSector;
+	FS3FileArray[fd].reservedCount = runLength;
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_file_reservation
+// Description  : Gives back the unused sectors reserved for a file
+//
+// Inputs		: fd - the file descriptor
+// Outputs      : 0 if successful
+
+int release_file_reservation(int16_t fd){
+	int i;
+
+	// marks each unused reserved sector as free again
+	for(i = 0; i<FS3FileArray[fd].reservedCount; i++){
+		release_disk_sector(FS3FileArray[fd].reservedTrack, FS3FileArray[fd].reservedSector + i);
+	}
+	FS3FileArray[fd].reservedCount = 0;
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocate_file_sector
+// Description  : Gives a file the next sector of its reservation, and adds it to
+//                the end of the file's sector map
+//
+// Inputs		: fd - the file descriptor
+//				  trackNum - pointer to where the track number of the sector will be written to
+//				  sectorNum - pointer to where the sector number of the sector will be written to
+// Outputs      : 0 if successful, -1 if failure
+
+int allocate_file_sector(int16_t fd, int *trackNum, int *sectorNum){
+	// reserves a new run of sectors if the file has used up its reservation
+	if(FS3FileArray[fd].reservedCount == 0){
+		if(reserve_file_sectors(fd) == -1){
+			return(-1);
+		}
+	}
+
+	// takes the first sector of the reservation
+	*trackNum = FS3FileArray[fd].reservedTrack;
+	*sectorNum = FS3FileArray[fd].reservedSector;
+	FS3FileArray[fd].reservedSector = FS3FileArray[fd].reservedSector + 1;
+	FS3FileArray[fd].reservedCount = FS3FileArray[fd].reservedCount - 1;
+
+	// records it at the end of the file's sector map, giving it back to the reservation if it cannot be
+	if(add_file_sector(fd, *trackNum, *sectorNum) == -1){
+		FS3FileArray[fd].reservedSector = FS3FileArray[fd].reservedSector - 1;
+		FS3FileArray[fd].reservedCount = FS3FileArray[fd].reservedCount + 1;
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_file_sectors
+// Description  : Takes the sectors past the first "sectorCount" off the end of a
+//                file's sector map, as a failed write leaves them. A sector just
+//                before the file's reservation goes back to the reservation, and
+//                any other is marked free
+//
+// Inputs		: fd - the file descriptor
+//				  sectorCount - number of sectors the file keeps
+// Outputs      : 0 if successful
+
+int release_file_sectors(int16_t fd, int sectorCount){
+	// gives the sectors back from the last one allocated, so each is just before the reservation
+	//	if it came from it
+	while(FS3FileArray[fd].sectorCount > sectorCount){
+		FS3SectorLocation *last = &FS3FileArray[fd].sectorMap[FS3FileArray[fd].sectorCount - 1];
+		if((last->track == FS3FileArray[fd].reservedTrack) && (last->sector == FS3FileArray[fd].reservedSector - 1)){
+			FS3FileArray[fd].reservedSector = FS3FileArray[fd].reservedSector - 1;
+			FS3FileArray[fd].reservedCount = FS3FileArray[fd].reservedCount + 1;
+		} else {
+			release_disk_sector(last->track, last->sector);
+		}
+		FS3FileArray[fd].sectorCount = FS3FileArray[fd].sectorCount - 1;
+	}
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : add_file_sector
+// Description  : Adds a newly allocated disk sector to the end of a file's sector map
+//
+// Inputs		: fd - the file descriptor
+//				  trackNum - the track number of the new sector
+//				  sectorNum - the sector number of the new sector
+// Outputs      : 0 if successful, -1 if failure
+
+int add_file_sector(int16_t fd, int trackNum, int sectorNum){
+	// checks that the track and sector are valid
+	if((trackNum < 0) || (trackNum >= FS3_MAX_TRACKS) || (sectorNum < 0) || (sectorNum >= FS3_TRACK_SIZE)){
+		return(-1);
+	}
+
+	// grows the sector map if it is full, doubling its size each time
+	if(FS3FileArray[fd].sectorCount == FS3FileArray[fd].sectorMapSize){
+		int newSize = FS3FileArray[fd].sectorMapSize * 2;
+		if(newSize == 0){
+			newSize = FS3_INITIAL_SECTOR_MAP_SIZE;
+		}
+
+		FS3SectorLocation *newMap = realloc(FS3FileArray[fd].sectorMap, newSize * sizeof(FS3SectorLocation));
+		if(newMap == NULL){
+			return(-1);
+		}
+		FS3FileArray[fd].sectorMap = newMap;
+		FS3FileArray[fd].sectorMapSize = newSize;
+	}
+
+	// adds the location to the end of the sector map
+	FS3FileArray[fd].sectorMap[FS3FileArray[fd].sectorCount].track = trackNum;
+	FS3FileArray[fd].sectorMap[FS3FileArray[fd].sectorCount].sector = sectorNum;
+	FS3FileArray[fd].sectorCount = FS3FileArray[fd].sectorCount + 1;
+
+	return(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_file_sectors
+// Description  : Writes back the sectors of one file the cache holds writes of,
+//                sending them all before waiting for the replies. If a write
+//                fails the sectors are put back in the cache as dirty
+//
+// Inputs		: fd - the file descriptor
+// Outputs      : 0 if successful, -1 if failure
+
+int flush_file_sectors(int16_t fd){
+	FS3File *file = &FS3FileArray[fd];
+	if(file->sectorCount == 0){
+		return(0);
+	}
+
+	uint8_t *staged = malloc((size_t)file->sectorCount * FS3_SECTOR_SIZE);
+	int *stagedSectors = malloc(file->sectorCount * sizeof(int));
+	if((staged == NULL) || (stagedSectors == NULL)){
+		free(staged);
+		free(stagedSectors);
+		return(-1);
+	}
+
+	// copies out each of the file's dirty sectors and sends its write
+	int flushResult = 0;
+	int stagedCount = 0;
+	int i;
+	for(i = 0; i < file->sectorCount; i++){
+		FS3SectorLocation *location = &file->sectorMap[i];
+		uint8_t *data = &staged[(size_t)stagedCount * FS3_SECTOR_SIZE];
+		if(fs3_take_cache_dirty(location->track, location->sector, data) != 1){
+			continue;
+		}
+		stagedSectors[stagedCount] = i;
+		stagedCount = stagedCount + 1;
+		if(queue_disk_sector_write(location->track, location->sector, data) == -1){
+			flushResult = -1;
+			break;
+		}
+	}
+	if(complete_disk_requests() == -1){
+		flushResult = -1;
+	}
+
+	// the writes did not all reach the disk, so the cache keeps holding them
+	for(i = 0; (i < stagedCount) && (flushResult == -1); i++){
+		FS3SectorLocation *location = &file->sectorMap[stagedSectors[i]];
+		fs3_put_cache_dirty(location->track, location->sector, &staged[(size_t)i * FS3_SECTOR_SIZE]);
+	}
+
+	free(staged);
+	free(stagedSectors);
+	return(flushResult);
 }
 
 
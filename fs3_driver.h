@@ -12,13 +12,19 @@
 //
 
 // Include files
+#include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include <fs3_controller.h>
 #include <fs3_common.h>
 
 // Defines
 #define FS3_MAX_TOTAL_FILES 1024 // Maximum number of files ever
 #define FS3_MAX_PATH_LENGTH 128 // Maximum length of filename length
+#define FS3_DEFAULT_RESERVATION_SIZE 1 // Sectors reserved on a track for a growing file, by default
+#define FS3_DEFAULT_READAHEAD_MAX 32 // Most sectors read ahead of a sequential reader, by default
+#define FS3_DEFAULT_TRACK_FILL 0     // Most sectors of a file on a read miss's track read into the cache, by default (none)
 
 // Type Definitions
 	// simple boolean enum
@@ -27,6 +33,12 @@
 		true = 1 
 	} bool;
 
+	// struct for keeping track of where a sector of a file is on the disk
+	typedef struct {
+		int track;
+		int sector;
+	} FS3SectorLocation;
+
 	// struct for keeping track of a file and its metadata
 	typedef struct {
 		bool created;
@@ -34,8 +46,50 @@
 		char name[FS3_MAX_PATH_LENGTH];
 		int length;
 		int position;
+		FS3SectorLocation *sectorMap; // disk location of each sector of the file, in file order
+		int sectorCount;              // number of sectors in the sector map
+		int sectorMapSize;            // number of entries allocated for the sector map
+		int reservedTrack;            // track of the sectors reserved for the file to grow into
+		int reservedSector;           // next sector reserved for the file
+		int reservedCount;            // number of reserved sectors the file has not used yet
+		int lastReadEnd;              // file position just after the last read, -1 if none
+		int readaheadWindow;          // sectors read ahead of a sequential reader, 0 if not sequential
+		int readaheadEnd;             // file position the data read ahead goes up to
+		int fillStart;                // file position the sectors filled after the last read start at
+		int fillEnd;                  // file position the sectors filled after the last read go up to, fillStart if none
+		int fillBackoff;              // read misses let go by without a fill each time a fill goes unused
+		int fillSkips;                // read misses still to let go by before the file is filled again
+		int cacheGets;                // sectors of the file read looked up in the cache
+		int cacheHits;                // sectors of the file read found in the cache
 	} FS3File;
 
+	// struct for keeping track of one sector touched by a read or write
+	typedef struct {
+		int track;            // track of the sector
+		int sector;           // sector number on the track
+		int positionInSector; // first byte of the sector being read or written
+		int byteCount;        // number of bytes of the sector being read or written
+		int bufferOffset;     // where the bytes are in the user's buffers, counting through them in turn
+		bool newSector;       // true if the sector was just allocated for the write
+		bool keepsOldData;    // true if some of the file's data already in the sector is kept
+		int fileSector;       // index of the sector in the file's sector map
+		void *diskData;       // where the sector is read to from the disk, NULL if it is not read from the disk
+		bool staged;          // true if the sector is read into a staging buffer, not straight into the user's
+	} FS3SectorRequest;
+
+	// struct for a growable block of sector buffers, for sectors whose reads are all sent before any arrive
+	typedef struct {
+		void *sectors;        // the sector buffers, one after another
+		int size;             // number of sectors the block holds
+	} FS3StagingArea;
+
+// Global data
+extern uint16_t fs3_reservation_size; // Sectors reserved on a track for a growing file
+extern uint16_t fs3_readahead_max;    // Most sectors read ahead of a sequential reader, 0 for none
+extern uint16_t fs3_track_fill_max;   // Most sectors of a file on a read miss's track read into the cache, 0 for none
+extern pthread_mutex_t diskLock;      // Serializes use of the disk with the cache flusher (recursive)
+extern char *fs3_telemetry_path;      // File the cache telemetry is written to as JSON at unmount, NULL for none
+
 // Interface functions
 
 int32_t fs3_mount_disk(void);
@@ -44,6 +98,9 @@ int32_t fs3_mount_disk(void);
 int32_t fs3_unmount_disk(void);
 	// FS3 interface, unmount the disk, close all files
 
+int32_t unmount_disk(void);
+	// Unmounts the disk and closes all files, with the disk lock held
+
 int16_t fs3_open(char *path);
 	// This function opens a file and returns a file handle
 
@@ -53,26 +110,179 @@ int16_t fs3_close(int16_t fd);
 int32_t fs3_read(int16_t fd, void *buf, int32_t count);
 	// Reads "count" bytes from the file handle "fh" into the buffer  "buf"
 
+int32_t read_file_data(int16_t fd, void *buf, int32_t count);
+	// Reads "count" bytes from the file handle "fh" into the buffer "buf", with the disk lock held
+
+int32_t fs3_pread(int16_t fd, void *buf, int32_t count, uint32_t offset);
+	// Reads "count" bytes from the file handle "fh" at "offset" into the buffer "buf", leaving the file position alone
+
+int32_t fs3_preadv(int16_t fd, const struct iovec *iov, int iovcnt, uint32_t offset);
+	// Reads from the file handle "fh" at "offset" into each buffer of "iov" in turn, leaving the file position alone
+
+int32_t read_file_vector(int16_t fd, const struct iovec *iov, int iovcnt, uint32_t offset);
+	// Reads from the file handle "fh" at "offset" into each buffer of "iov" in turn, with the disk lock held
+
+int reset_file_readahead(int16_t fd);
+	// Forgets how a file has been read, ending any sequential stream
+
+int readahead_file(int16_t fd, int offset, int count);
+	// Reads the sectors after a sequential read into the cache, adapting the window to the reader
+
+int fill_tracks_after_misses(int16_t fd, int offset, int planCount);
+	// Reads the file's next sectors past a read on the tracks it missed on into the cache, all at once
+
 int32_t fs3_write(int16_t fd, void *buf, int32_t count);
 	// Writes "count" bytes to the file handle "fh" from the buffer  "buf"
 
+int32_t write_file_data(int16_t fd, void *buf, int32_t count);
+	// Writes "count" bytes to the file handle "fh" from the buffer "buf", with the disk lock held
+
+int32_t fs3_pwrite(int16_t fd, void *buf, int32_t count, uint32_t offset);
+	// Writes "count" bytes to the file handle "fh" at "offset" from the buffer "buf", leaving the file position alone
+
+int32_t fs3_pwritev(int16_t fd, const struct iovec *iov, int iovcnt, uint32_t offset);
+	// Writes to the file handle "fh" at "offset" from each buffer of "iov" in turn, leaving the file position alone
+
+int32_t write_file_vector(int16_t fd, const struct iovec *iov, int iovcnt, uint32_t offset);
+	// Writes to the file handle "fh" at "offset" from each buffer of "iov" in turn, with the disk lock held
+
+int check_open_file(int16_t fd);
+	// Checks that a file handle is one of an open file on a mounted disk
+
+int32_t total_iovec_length(const struct iovec *iov, int iovcnt);
+	// Adds up the number of bytes in a list of user buffers
+
+void * find_iovec_data(const struct iovec *iov, int iovcnt, int offset, int count);
+	// Finds where a run of bytes is in the user's buffers, if it is all inside one buffer
+
+int copy_to_iovec(const struct iovec *iov, int iovcnt, int offset, const void *src, int count);
+	// Copies bytes into the user's buffers, starting "offset" bytes in
+
+int copy_from_iovec(void *dest, const struct iovec *iov, int iovcnt, int offset, int count);
+	// Copies bytes out of the user's buffers, starting "offset" bytes in
+
+int plan_file_request(int16_t fd, int position, int count, bool allocate);
+	// Works out the disk location and buffer position of every sector touched by a read or write
+
+int order_request_plan(int planCount);
+	// Orders the planned sectors as an elevator sweep across the tracks
+
+int compare_sector_requests(const void *a, const void *b);
+	// Orders two sector requests for the elevator sweep
+
+int read_request_sector(int16_t fd, FS3SectorRequest *request, const struct iovec *iov, int iovcnt);
+	// Copies one sector of a planned read from the cache to the user's buffers, or sends its read to the disk
+
+int finish_request_sector(FS3SectorRequest *request, const struct iovec *iov, int iovcnt);
+	// Copies a sector of a planned read that was read from the disk to the user's buffers
+
+int write_request_sector(int16_t fd, FS3SectorRequest *request, const struct iovec *iov, int iovcnt);
+	// Writes one sector of a planned write from its place in the user's buffers
+
 int32_t fs3_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int fs3_file_cache_stats(int16_t fd, int *gets, int *hits);
+	// Gets how many sectors of a file were looked up in the cache, and how many were found there
+
+int write_cache_telemetry(char *path);
+	// Writes the cache telemetry, with the hit ratio of every file, to a file as JSON
+
+int write_json_string(FILE *out, const char *str);
+	// Writes a string as a quoted JSON string
+
+uint32_t hash_file_name(char *path);
+	// Hashes a filename for the filename index
+
+int find_file_index_slot(char *path);
+	// Finds the filename index slot holding a file, or the empty slot it would go in
+
 int switch_disk_track(int trackNum);
-	// Switches the track the disk in on to a new track
+	// Switches the track the disk in on to a new track, on every connection
+
+int read_disk_sector(int trackNum, int sectorNum, void *buf);
+	// Reads a sector from the disk, seeking to its track first if needed
+
+int write_disk_sector(int trackNum, int sectorNum, void *buf);
+	// Writes a sector to the disk, seeking to its track first if needed
+
+int send_disk_sector_write(int trackNum, int sectorNum, void *buf);
+	// Sends a write of a sector on to the disk without waiting for its reply, leaving the buffer free to change
+
+int queue_disk_track_switch(int conn, int trackNum);
+	// Sends a seek to a new track on a connection without waiting for its reply
+
+int queue_disk_sector_read(int trackNum, int sectorNum, void *buf);
+	// Sends a read of a sector without waiting for its reply, seeking to its track first if needed
+
+int queue_disk_sector_write(int trackNum, int sectorNum, void *buf);
+	// Sends a write of a sector without waiting for its reply, seeking to its track first if needed
+
+int find_disk_connection(int trackNum, int sectorNum);
+	// Works out the connection the commands for a sector are sent on
+
+int queue_disk_command(int conn, FS3CmdBlk cmdblock, void *buf);
+	// Sends a command to the disk on a connection without waiting for its reply, once its pipeline has room
+
+int collect_disk_reply(int conn);
+	// Reads the reply to the oldest command sent ahead on a connection
+
+int complete_disk_requests(void);
+	// Waits for the reply to every command sent ahead on every connection (returns -1 if any failed)
+
+int begin_disk_requests(void);
+	// Starts a read or write that sends commands ahead, so nested waits keep any failure for it
+
+int end_disk_requests(void);
+	// Finishes a read or write started by begin_disk_requests, waiting for every command sent ahead
+
+void * reserve_staging_area(FS3StagingArea *area, int sectors);
+	// Makes sure a staging area holds a number of sectors, growing it if needed
+
+int init_sector_pool();
+	// Allocates the pool of aligned sector buffers used for disk reads and writes
+
+int free_sector_pool();
+	// Deallocates the pool of sector buffers
+
+void * get_sector_buffer();
+	// Takes a sector buffer from the pool
+
+int release_sector_buffer(void *sectorBuf);
+	// Gives a sector buffer back to the pool
+
+int init_free_sector_map();
+	// Marks every sector on the disk as free
 
 int find_open_track();
 	// Finds a track in which there is a sector with no data in it
 
-int find_open_sector();
-	// Finds a sector with no data in it on the current track
+int claim_disk_sector(int trackNum, int sectorNum);
+	// Marks a free sector on the disk as used
+
+int release_disk_sector(int trackNum, int sectorNum);
+	// Marks a used sector on the disk as free
+
+int find_free_run(int trackNum, int maxLength, int *startSector);
+	// Finds the first run of free sectors on a track
+
+int reserve_file_sectors(int16_t fd);
+	// Reserves a run of free sectors on one track for a file to grow into
+
+int release_file_reservation(int16_t fd);
+	// Gives back the unused sectors reserved for a file
+
+int allocate_file_sector(int16_t fd, int *trackNum, int *sectorNum);
+	// Gives a file the next sector of its reservation
+
+int release_file_sectors(int16_t fd, int sectorCount);
+	// Gives back the sectors past the first sectorCount of a file's sector map, as a failed write leaves them
 
-int find_current_track(int16_t fd);
-	// Finds the track number in which the position of the file is on
+int add_file_sector(int16_t fd, int trackNum, int sectorNum);
+	// Adds a newly allocated disk sector to the end of a file's sector map
 
-int find_current_sector(int16_t fd);
-	// Finds the sector number in which the position of the file is on
+int flush_file_sectors(int16_t fd);
+	// Writes back the sectors of one file the cache holds writes of
 
 FS3CmdBlk construct_fs3_cmdblock(uint8_t op, uint16_t sec, uint_fast32_t trk, uint8_t ret);
 	// Create an FS3 array opcode from the variable fields
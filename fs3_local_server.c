@@ -0,0 +1,354 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_local_server.c
+//  Description    : This is a stand-in FS3 controller for a client on the same
+//                   host. It keeps the disk in memory and serves the FS3
+//                   protocol over any transport (an IP address, unix:/path or
+//                   shm:/name), one thread for each connection, each with its
+//                   own disk head, so the transports can be compared.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/13/2021
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_driver.h>
+#include <fs3_network.h>
+#include <fs3_transport.h>
+
+// Defines
+#define FS3_SERVER_ARGUMENTS "hvp:"
+#define FS3_SERVER_BUFFER_SIZE (2 * FS3_MAX_PIPELINE_DEPTH * (FS3_NET_HEADER_SIZE + FS3_SECTOR_SIZE)) // bytes of commands read, and of replies written, at once
+#define USAGE \
+    "USAGE: fs3_local_server [-h] [-v] [-p <port>] [<address>]\n" \
+    "\n" \
+    "where:\n" \
+    "    -h - help mode (display this message)\n" \
+    "    -v - verbose output\n" \
+    "    -p - set the port of a TCP address\n" \
+    "\n" \
+    "    <address> - address to serve: an IP address, unix:<path> or shm:<name> (127.0.0.1 by default)\n" \
+    "\n" \
+
+//
+// Global Data
+    uint8_t    *fs3ServerDisk = NULL;     // every sector of the disk, track by track
+    const char *fs3ServerAddress = NULL;  // address being served
+    int         fs3ServerTransport = FS3_TRANSPORT_TCP; // transport of the address being served
+    int         fs3ServerVerbose = 0;     // 1 to log each connection opened and closed
+
+//
+// Functional Prototypes
+
+void * serve_fs3_connection(void *arg);  // answer the commands of one connection until it closes
+int answer_fs3_command(FS3CmdBlk cmd, uint8_t *data, int *head, uint8_t *reply); // carry out a command, building its reply
+int write_fs3_replies(FS3Channel *channel, uint8_t *buf, size_t length); // write every byte of a buffer of replies
+void stop_fs3_server(int sig);           // remove the address being served and exit
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the stand-in FS3 controller
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+    // Local variables
+    int ch;
+    uint16_t port = FS3_DEFAULT_PORT;
+    const char *target;
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, FS3_SERVER_ARGUMENTS)) != -1){
+        switch(ch){
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'v': // Verbose Flag
+            fs3ServerVerbose = 1;
+            break;
+
+        case 'p': // Set the network port number
+            if(sscanf(optarg, "%hu", &port) != 1){
+                fprintf(stderr, "Bad port number [%s]\n", optarg);
+                return(-1);
+            }
+            break;
+
+        default:  // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+    if(optind < argc){
+        fs3ServerAddress = argv[optind];
+    }
+
+    // Setup the log as needed
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    enableLogLevels(LOG_INFO_LEVEL | LOG_ERROR_LEVEL | LOG_OUTPUT_LEVEL);
+
+    fs3ServerTransport = fs3_find_transport(fs3ServerAddress, &target);
+    if(fs3ServerTransport == -1){
+        logMessage(LOG_ERROR_LEVEL, "Unknown transport of address [%s]", fs3ServerAddress);
+        return(-1);
+    }
+
+    // makes the disk, which starts out zeroed
+    fs3ServerDisk = calloc((size_t)FS3_MAX_TRACKS * FS3_TRACK_SIZE, FS3_SECTOR_SIZE);
+    if(fs3ServerDisk == NULL){
+        logMessage(LOG_ERROR_LEVEL, "Failed allocating the disk");
+        return(-1);
+    }
+
+    FS3Channel listener;
+    fs3_channel_init(&listener);
+    if(fs3_transport_listen(&listener, fs3ServerAddress, port) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Failed serving address [%s]", (fs3ServerAddress == NULL) ? "tcp" : fs3ServerAddress);
+        return(-1);
+    }
+    signal(SIGINT, stop_fs3_server);
+    signal(SIGTERM, stop_fs3_server);
+    signal(SIGPIPE, SIG_IGN);
+    logMessage(LOG_OUTPUT_LEVEL, "FS3 stand-in controller serving [%s], port %u.",
+        (fs3ServerAddress == NULL) ? "tcp" : fs3ServerAddress, port);
+
+    // answers each connection on a thread of its own
+    while(1){
+        FS3Channel *channel = malloc(sizeof(FS3Channel));
+        if(channel == NULL){
+            logMessage(LOG_ERROR_LEVEL, "Failed allocating a connection");
+            return(-1);
+        }
+        fs3_channel_init(channel);
+        if(listener.transport->accept(&listener, channel) == -1){
+            free(channel);
+            continue;
+        }
+
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, serve_fs3_connection, channel) != 0){
+            logMessage(LOG_ERROR_LEVEL, "Failed starting a connection's thread");
+            channel->transport->close(channel);
+            free(channel);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serve_fs3_connection
+// Description  : Answer the commands of one connection until it unmounts or
+//                closes. It reads whatever commands have arrived, answers every
+//                whole one, and writes their replies back together, so a client
+//                pipelining commands is answered a batch at a time
+//
+// Inputs       : arg - the channel of the connection, freed when it closes
+// Outputs      : NULL
+
+void * serve_fs3_connection(void *arg) {
+    FS3Channel *channel = arg;
+    uint8_t *commands = malloc(FS3_SERVER_BUFFER_SIZE);
+    uint8_t *replies = malloc(FS3_SERVER_BUFFER_SIZE);
+    size_t commandLength = 0;
+    int head = -1;
+    int done = 0;
+    uint64_t answered = 0;
+
+    if(fs3ServerVerbose == 1){
+        logMessage(LOG_INFO_LEVEL, "Connection opened.");
+    }
+
+    while((done == 0) && (commands != NULL) && (replies != NULL)){
+        // reads what has arrived after the part of a command left over last time
+        struct iovec iov = {commands + commandLength, FS3_SERVER_BUFFER_SIZE - commandLength};
+        ssize_t got = channel->transport->readv(channel, &iov, 1);
+        if(got <= 0){
+            break;
+        }
+        commandLength = commandLength + (size_t)got;
+
+        // answers every whole command read, the data of a write following its header
+        size_t used = 0;
+        size_t replyLength = 0;
+        while(commandLength - used >= FS3_NET_HEADER_SIZE){
+            FS3CmdBlk cmd;
+            uint8_t op, ret;
+            uint16_t sec;
+            uint32_t trk;
+            memcpy(&cmd, commands + used, FS3_NET_HEADER_SIZE);
+            cmd = ntohll64(cmd);
+            deconstruct_fs3_cmdblock(cmd, &op, &sec, &trk, &ret);
+            size_t size = FS3_NET_HEADER_SIZE + ((op == FS3_OP_WRSECT) ? FS3_SECTOR_SIZE : 0);
+            if(commandLength - used < size){
+                break;
+            }
+
+            // writes the replies so far out first if this one might not fit
+            if(replyLength + FS3_NET_HEADER_SIZE + FS3_SECTOR_SIZE > FS3_SERVER_BUFFER_SIZE){
+                if(write_fs3_replies(channel, replies, replyLength) == -1){
+                    done = 1;
+                    break;
+                }
+                replyLength = 0;
+            }
+
+            replyLength = replyLength + answer_fs3_command(cmd, commands + used + FS3_NET_HEADER_SIZE, &head, replies + replyLength);
+            used = used + size;
+            answered = answered + 1;
+            if(op == FS3_OP_UMOUNT){
+                done = 1;
+                break;
+            }
+        }
+
+        if((replyLength > 0) && (write_fs3_replies(channel, replies, replyLength) == -1)){
+            break;
+        }
+
+        // keeps the part of a command not read yet for next time
+        memmove(commands, commands + used, commandLength - used);
+        commandLength = commandLength - used;
+    }
+
+    if(fs3ServerVerbose == 1){
+        logMessage(LOG_INFO_LEVEL, "Connection closed after %llu commands.", (unsigned long long)answered);
+    }
+    channel->transport->close(channel);
+    free(channel);
+    free(commands);
+    free(replies);
+
+    return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : answer_fs3_command
+// Description  : Carry out a command on the disk, building its reply: the
+//                command with its return bit set if it failed, followed by the
+//                sector for a read
+//
+// Inputs       : cmd - the command, in host byte order
+//                data - the sector sent with a write
+//                head - the track the connection's disk head is on, -1 if none
+//                reply - where the reply is built
+// Outputs      : bytes of reply built
+
+int answer_fs3_command(FS3CmdBlk cmd, uint8_t *data, int *head, uint8_t *reply) {
+    uint8_t op, ret;
+    uint16_t sec;
+    uint32_t trk;
+    deconstruct_fs3_cmdblock(cmd, &op, &sec, &trk, &ret);
+
+    int failed = 0;
+    int size = FS3_NET_HEADER_SIZE;
+    switch(op){
+    case FS3_OP_MOUNT:
+    case FS3_OP_UMOUNT:
+        break;
+
+    case FS3_OP_TSEEK:
+        if(trk >= FS3_MAX_TRACKS){
+            failed = 1;
+        } else {
+            *head = (int)trk;
+        }
+        break;
+
+    case FS3_OP_RDSECT:
+    case FS3_OP_WRSECT:
+        if((*head == -1) || (sec >= FS3_TRACK_SIZE)){
+            failed = 1;
+            break;
+        }
+        uint8_t *sector = fs3ServerDisk + (((size_t)*head * FS3_TRACK_SIZE) + sec) * FS3_SECTOR_SIZE;
+        if(op == FS3_OP_RDSECT){
+            memcpy(reply + FS3_NET_HEADER_SIZE, sector, FS3_SECTOR_SIZE);
+            size = size + FS3_SECTOR_SIZE;
+        } else {
+            memcpy(sector, data, FS3_SECTOR_SIZE);
+        }
+        break;
+
+    default:
+        failed = 1;
+        break;
+    }
+
+    FS3CmdBlk answer = htonll64(construct_fs3_cmdblock(op, sec, trk, (uint8_t)failed));
+    memcpy(reply, &answer, FS3_NET_HEADER_SIZE);
+
+    return(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_fs3_replies
+// Description  : Write every byte of a buffer of replies to a connection
+//
+// Inputs       : channel - the channel of the connection
+//                buf - the replies
+//                length - bytes of replies
+// Outputs      : 0 if successful, -1 if failure
+
+int write_fs3_replies(FS3Channel *channel, uint8_t *buf, size_t length) {
+    while(length > 0){
+        struct iovec iov = {buf, length};
+        ssize_t written = channel->transport->writev(channel, &iov, 1);
+        if(written <= 0){
+            return(-1);
+        }
+        buf = buf + written;
+        length = length - (size_t)written;
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stop_fs3_server
+// Description  : Remove the socket path or shared memory object being served,
+//                so the next controller can serve it, and exit
+//
+// Inputs       : sig - the signal stopping the controller
+// Outputs      : none
+
+void stop_fs3_server(int sig) {
+    (void)sig;
+
+    const char *target;
+    fs3_find_transport(fs3ServerAddress, &target);
+    if(fs3ServerTransport == FS3_TRANSPORT_UNIX){
+        unlink(target);
+    } else if(fs3ServerTransport == FS3_TRANSPORT_SHM){
+        shm_unlink(target);
+    }
+
+    _exit(0);
+}
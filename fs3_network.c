@@ -5,15 +5,12 @@
 //
 //
 //  Author         : Christopher Kurcz
-//  Last Modified  : 12/10/21
+//  Last Modified  : 12/11/21
 //
 
 // Includes
-#include <unistd.h>
 #include <errno.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <sys/uio.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
@@ -24,15 +21,24 @@
 //  Global data
     unsigned char     *fs3_network_address = NULL; // Address of FS3 server
     unsigned short     fs3_network_port = 0;       // Port of FS3 serve
-    int socketHandle = -1;
-    struct sockaddr_in FS3address;
+    uint64_t           fs3_network_round_trips = 0; // Number of commands answered by the server
+    uint64_t           fs3_network_syscalls = 0;    // Number of system calls made sending commands and reading replies
+    uint16_t           fs3_network_pipeline_depth = FS3_DEFAULT_PIPELINE_DEPTH; // Most commands sent on a connection before their replies are read
+    uint16_t           fs3_network_connections = FS3_DEFAULT_CONNECTIONS; // Connections made to the server at mount
+
+    // connections to the server, the first made by the mount and the rest opened after it
+    FS3Connection connections[FS3_MAX_CONNECTIONS] = {[0 ... FS3_MAX_CONNECTIONS - 1] = {.channel = {.fd = -1}}};
+    int connectionCount = 0;  // number of connections open
 
 // Network functions
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : network_fs3_syscall
-// Description  : Perform a system call over the network
+// Description  : Perform a system call over the first connection, waiting for
+//                its reply. Every command sent ahead on it with network_fs3_send
+//                must have had its reply read first. A mount also opens the rest
+//                of the connections, and an unmount closes them first
 //
 // Inputs       : cmd - the command block to send
 //                ret - the returned command block
@@ -40,95 +46,612 @@
 // Outputs      : 0 if successful, -1 if failure
 
 int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf){
+    // checks that no reply is still owed, or it would be taken for this one
+    if(connections[0].pendingCount != 0){
+        return(-1);
+    }
+
+    // the other connections are unmounted first, so the first connection's unmount is the last
+    //  command the server sees
+    uint8_t opCodeBits = getOpCodeBits(cmd);
+    if(opCodeBits == FS3_OP_UMOUNT){
+        network_fs3_close_pool();
+    }
+
+    // sends the command, then reads its reply
+    if((network_fs3_send(0, cmd, buf) == -1) || (network_fs3_receive(0, ret) == -1)){
+        return(-1);
+    }
+
+    // once the disk is mounted, opens the other connections
+    if((opCodeBits == FS3_OP_MOUNT) && (getReturnBit(*ret) == 0)){
+        network_fs3_open_pool();
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_send
+// Description  : Send a command on a connection without waiting for its reply,
+//                so more can be sent behind it. Commands are held until their
+//                replies are wanted or network_fs3_flush is called, then written
+//                to the socket together, so a write's sector must not change until
+//                then. The server answers the commands of a connection in the
+//                order they are sent, and network_fs3_receive reads the replies in
+//                that order, but commands on different connections may be answered
+//                in any order
+//
+// Inputs       : conn - the index of the connection
+//                cmd - the command block to send
+//                buf - the sector to send for a write, or the buffer the sector
+//                      read is placed in when the reply is read
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_send(int conn, FS3CmdBlk cmd, void *buf){
+    // checks that the connection exists
+    if((conn < 0) || (conn >= FS3_MAX_CONNECTIONS)){
+        return(-1);
+    }
+    FS3Connection *connection = &connections[conn];
 
     // gets the op code bits from the command block
     uint8_t opCodeBits = getOpCodeBits(cmd);
-    
+
     // if the op code is for mounting the disk, a new connection must be made to the server
     if(opCodeBits == FS3_OP_MOUNT){
-        // sets the protocol family of the address
-        FS3address.sin_family = AF_INET;
-
-        // sets the port of the address
-        if(fs3_network_port == 0){
-            FS3address.sin_port = htons(FS3_DEFAULT_PORT);
-        } else {
-            FS3address.sin_port = htons(fs3_network_port);
+        if(network_fs3_connect(connection) == -1){
+            return(-1);
         }
+    }
 
-        // sets the ip of the address
-        char *ip;
-        if(fs3_network_address == NULL){
-            ip = FS3_DEFAULT_IP;
-        } else {
-            ip = (char *) fs3_network_address;
-        }
+    // checks that the connection is open, and that there is room to remember the command until
+    //  its reply is read
+    if((connection->channel.transport == NULL) || (connection->pendingCount == FS3_MAX_PIPELINE_DEPTH)){
+        return(-1);
+    }
 
-        // creates the UNIX structure for processing from the IPv4 address
-        if ( inet_aton((const char *)ip, &FS3address.sin_addr) == 0 ) { 
-            // error on converting
-            return( -1 );
-        } 
+    // remembers the command in network byte order, to be written with the others held, and
+    //  so its reply is matched to it
+    int slot = (connection->pendingFirst + connection->pendingCount) % FS3_MAX_PIPELINE_DEPTH;
+    connection->pendingCmds[slot].opCode = opCodeBits;
+    connection->pendingCmds[slot].buf = buf;
+    connection->pendingCmds[slot].command = htonll64(cmd);
+    connection->pendingCount = connection->pendingCount + 1;
+    connection->unsentCount = connection->unsentCount + 1;
 
-        // creates the sochet handle
-        socketHandle = socket(PF_INET, SOCK_STREAM, 0); 
-        if (socketHandle == -1) {
-            // error on socket creation
-            return( -1 );
-        } 
+    return(0);
+}
 
-        // connects to the server
-        if ( connect(socketHandle, (const struct sockaddr *)&FS3address, sizeof(FS3address)) == -1 ) { 
-            // error on socket connection
-            return( -1 );
-        } 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_flush
+// Description  : Write the commands held on every connection, so the server works
+//                on all of them while any one's replies are waited for. They are
+//                all sent by the time this returns, so their buffers can change
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
+int network_fs3_flush(void){
+    int result = 0;
+    int conn;
+    for(conn = 0; conn < connectionCount; conn++){
+        if((network_fs3_flush_connection(&connections[conn]) == -1) ||
+            (network_fs3_push_connection(&connections[conn]) == -1)){
+            result = -1;
+        }
     }
 
-    // converts the command block to network byte order
-    uint64_t networkCMD = htonll64(cmd);
+    return(result);
+}
 
-    // writes the command block to the server
-    if (write(socketHandle, &networkCMD, sizeof(networkCMD)) != sizeof(networkCMD) ) { 
-        // error writing network data
-        return( -1 );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_flush_connection
+// Description  : Write every command held on a connection to its socket in one
+//                gathered write, each command block followed by its sector for
+//                a write
+//
+// Inputs       : connection - the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_flush_connection(FS3Connection *connection){
+    if(connection->unsentCount == 0){
+        return(0);
     }
 
-    // if the op code is for a write command, the buffer will also be sent to the server
-    if(opCodeBits == FS3_OP_WRSECT){
-        if (write(socketHandle, buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE) { 
-            // error writing network data
-            return( -1 );
+    // gathers the command blocks and sectors of the held commands, oldest first
+    struct iovec iov[2 * FS3_MAX_PIPELINE_DEPTH];
+    int iovcnt = 0;
+    int i;
+    for(i = connection->pendingCount - connection->unsentCount; i < connection->pendingCount; i++){
+        FS3PendingCmd *pending = &connection->pendingCmds[(connection->pendingFirst + i) % FS3_MAX_PIPELINE_DEPTH];
+        iov[iovcnt].iov_base = &pending->command;
+        iov[iovcnt].iov_len = FS3_NET_HEADER_SIZE;
+        iovcnt = iovcnt + 1;
+
+        // if the op code is for a write command, the buffer will also be sent to the server
+        if(pending->opCode == FS3_OP_WRSECT){
+            iov[iovcnt].iov_base = pending->buf;
+            iov[iovcnt].iov_len = FS3_SECTOR_SIZE;
+            iovcnt = iovcnt + 1;
         }
     }
+    connection->unsentCount = 0;
+
+    if(network_write_vector(connection, iov, iovcnt) == -1){
+        // error writing network data, which leaves the connection unusable, so it is closed and
+        //  reading its replies fails
+        network_fs3_close(connection);
+        return(-1);
+    }
 
-    // reads the return command block from the server
-    if (read(socketHandle, &networkCMD, sizeof(networkCMD)) != sizeof(networkCMD) ) { 
-        // error reading
-        return( -1 );
+    // tells the transport how many replies are owed, which TCP uses to have them acknowledged quickly
+    if(connection->channel.transport->expect != NULL){
+        connection->channel.transport->expect(&connection->channel, connection->pendingCount);
     }
 
-    // if the op code is for a read command, the buffer will also be read from the serber
-    if(opCodeBits == FS3_OP_RDSECT){
-        if (read(socketHandle, buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE) { 
-            // error reading network data
-            return( -1 );
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_push_connection
+// Description  : Send the commands a connection's transport held back from the
+//                last write, for one that sends them with the next read instead
+//
+// Inputs       : connection - the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_push_connection(FS3Connection *connection){
+    if((connection->channel.transport == NULL) || (connection->channel.transport->push == NULL)){
+        return(0);
+    }
+
+    if(connection->channel.transport->push(&connection->channel) == -1){
+        // error sending, so the connection is closed and reading its replies fails
+        network_fs3_close(connection);
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_receive
+// Description  : Read the reply to the oldest command sent on a connection,
+//                placing the sector of a read in the buffer given when it was
+//                sent. The commands held on every connection are written first,
+//                so the others are worked on while this one is waited for
+//
+// Inputs       : conn - the index of the connection
+//                ret - the returned command block
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_receive(int conn, FS3CmdBlk *ret){
+    // checks that the connection exists and a reply is owed on it
+    if((conn < 0) || (conn >= FS3_MAX_CONNECTIONS) || (connections[conn].pendingCount == 0)){
+        return(-1);
+    }
+    FS3Connection *connection = &connections[conn];
+
+    // writes the commands held, as their replies are wanted, along with those of the other
+    //  connections (a connection that fails to write is closed, so its read fails below).
+    //  This connection's may be held back by its transport to go with the read
+    int other;
+    for(other = 0; other < connectionCount; other++){
+        network_fs3_flush_connection(&connections[other]);
+        if(other != conn){
+            network_fs3_push_connection(&connections[other]);
+        }
+    }
+
+    // reads until the oldest command's reply has all arrived, along with as much of the
+    //  replies behind it as has arrived too
+    FS3PendingCmd *pending = &connection->pendingCmds[connection->pendingFirst];
+    size_t replySize = network_fs3_reply_size(pending->opCode);
+    while(connection->replyBytesRead < replySize){
+        if(network_read_replies(connection) == -1){
+            // error reading, which leaves the rest of the replies unreadable
+            network_fs3_reset(connection);
+            return(-1);
         }
     }
 
-    // converts the return command block back from network byte order
-    networkCMD = ntohll64(networkCMD);
+    // takes the oldest command, which the reply is for
+    connection->pendingFirst = (connection->pendingFirst + 1) % FS3_MAX_PIPELINE_DEPTH;
+    connection->pendingCount = connection->pendingCount - 1;
+    connection->replyBytesRead = connection->replyBytesRead - replySize;
 
-    // saves the returned command block to the return command block pointer
-    *ret = networkCMD;
+    // saves the returned command block, converted back from network byte order, to the
+    //  return command block pointer
+    *ret = ntohll64(pending->reply);
+    fs3_network_round_trips = fs3_network_round_trips + 1;
+    connection->commands = connection->commands + 1;
 
     // if the op code is for an unmount command, it closes the connection with the server
-    if(opCodeBits == FS3_OP_UMOUNT){
-        close(socketHandle);
-        socketHandle = -1;
+    if(pending->opCode == FS3_OP_UMOUNT){
+        network_fs3_close(connection);
     }
 
     // Return successfully
     return (0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_pending
+// Description  : Get the number of commands sent on a connection whose replies
+//                have not been read
+//
+// Inputs       : conn - the index of the connection
+// Outputs      : the number of commands
+
+int network_fs3_pending(int conn){
+    return(connections[conn].pendingCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_connection_count
+// Description  : Get the number of connections open to the server, which the
+//                commands are spread across
+//
+// Inputs       : none
+// Outputs      : the number of connections, 1 before the disk is mounted
+
+int network_fs3_connection_count(void){
+    if(connectionCount == 0){
+        return(1);
+    }
+
+    return(connectionCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_register_buffers
+// Description  : Set the memory registered with the io_uring of each connection
+//                opened after, the driver's sector pool, so the sectors sent from
+//                it are not copied. Connections already open keep what they had
+//
+// Inputs       : base - start of the memory, NULL for none
+//                size - bytes of the memory
+// Outputs      : 0 if successful
+
+int network_fs3_register_buffers(void *base, size_t size){
+    fs3_uring_region.iov_base = base;
+    fs3_uring_region.iov_len = (base == NULL) ? 0 : size;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_reply_size
+// Description  : Work out the bytes of the reply to a command, its command block
+//                followed by the sector for a read
+//
+// Inputs       : opCode - the op code of the command
+// Outputs      : the size of the reply in bytes
+
+size_t network_fs3_reply_size(uint8_t opCode){
+    if(opCode == FS3_OP_RDSECT){
+        return(FS3_NET_HEADER_SIZE + FS3_SECTOR_SIZE);
+    }
+
+    return(FS3_NET_HEADER_SIZE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_reset
+// Description  : Forget every pending command of a connection after it has
+//                failed, as their replies can no longer be read
+//
+// Inputs       : connection - the connection
+// Outputs      : 0 if successful
+
+int network_fs3_reset(FS3Connection *connection){
+    connection->pendingFirst = 0;
+    connection->pendingCount = 0;
+    connection->unsentCount = 0;
+    connection->replyBytesRead = 0;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_close
+// Description  : Close a connection's channel to the server, if it is open
+//
+// Inputs       : connection - the connection
+// Outputs      : 0 if successful
+
+int network_fs3_close(FS3Connection *connection){
+    if(connection->channel.transport != NULL){
+        connection->channel.transport->close(&connection->channel);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_connect
+// Description  : Make a new connection to the server, over the transport named by
+//                the scheme of its address, with buffers big enough to hold a full
+//                pipeline of sectors each way, so neither side blocks sending
+//                while the other is still sending too
+//
+// Inputs       : connection - the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_connect(FS3Connection *connection){
+    // closes whatever the connection had open before
+    network_fs3_close(connection);
+
+    // connects to the server
+    int bufferSize = 2 * FS3_MAX_PIPELINE_DEPTH * (FS3_NET_HEADER_SIZE + FS3_SECTOR_SIZE);
+    if(fs3_transport_connect(&connection->channel, (const char *)fs3_network_address, fs3_network_port, bufferSize) == -1){
+        return(-1);
+    }
+
+    connection->commands = 0;
+    network_fs3_reset(connection);
+
+    // a mount on the first connection starts a new pool of connections
+    if(connection == &connections[0]){
+        connectionCount = 1;
+        int conn;
+        for(conn = 1; conn < FS3_MAX_CONNECTIONS; conn++){
+            connections[conn].commands = 0;
+        }
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_open_pool
+// Description  : Open the connections after the first, mounting the disk on each.
+//                A server that only serves one connection at a time never answers
+//                the second's mount, so the pool stops growing at the first
+//                connection the server does not answer
+//
+// Inputs       : none
+// Outputs      : number of connections open
+
+int network_fs3_open_pool(void){
+    int wanted = fs3_network_connections;
+    if(wanted > FS3_MAX_CONNECTIONS){
+        wanted = FS3_MAX_CONNECTIONS;
+    }
+
+    while(connectionCount < wanted){
+        if(network_fs3_mount_connection(connectionCount) == -1){
+            logMessage(LOG_WARNING_LEVEL, "FS3 server did not answer connection %d, using %d connections",
+                connectionCount + 1, connectionCount);
+            break;
+        }
+        connectionCount = connectionCount + 1;
+    }
+
+    return(connectionCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_mount_connection
+// Description  : Open a connection and mount the disk on it, waiting no longer
+//                than FS3_CONNECTION_TIMEOUT for the server to answer
+//
+// Inputs       : conn - the index of the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int network_fs3_mount_connection(int conn){
+    FS3Connection *connection = &connections[conn];
+
+    // sends the mount on its own connection
+    FS3CmdBlk cmd = construct_fs3_cmdblock(FS3_OP_MOUNT, 0, 0, 0);
+    int result = 0;
+    if((network_fs3_send(conn, cmd, NULL) == -1) || (network_fs3_flush_connection(connection) == -1)){
+        result = -1;
+    }
+
+    // waits for the reply to start arriving, then reads it
+    if(result == 0){
+        FS3CmdBlk ret;
+        if((connection->channel.transport->wait(&connection->channel, FS3_CONNECTION_TIMEOUT) != 1) ||
+            (network_fs3_receive(conn, &ret) == -1) ||
+            (getReturnBit(ret) != 0)){
+            result = -1;
+        }
+    }
+
+    // a connection that was not mounted is closed, with the mount left unanswered
+    if(result == -1){
+        network_fs3_close(connection);
+        network_fs3_reset(connection);
+    }
+
+    return(result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_close_pool
+// Description  : Unmount the disk on the connections after the first and close
+//                them, newest first
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if any unmount failed
+
+int network_fs3_close_pool(void){
+    int result = 0;
+    FS3CmdBlk cmd = construct_fs3_cmdblock(FS3_OP_UMOUNT, 0, 0, 0);
+
+    while(connectionCount > 1){
+        int conn = connectionCount - 1;
+        FS3Connection *connection = &connections[conn];
+        FS3CmdBlk ret;
+
+        if((connection->pendingCount != 0) || (network_fs3_send(conn, cmd, NULL) == -1) ||
+            (network_fs3_receive(conn, &ret) == -1) || (getReturnBit(ret) != 0)){
+            result = -1;
+        }
+
+        // closes the connection if the unmount did not
+        network_fs3_close(connection);
+        network_fs3_reset(connection);
+        connectionCount = connectionCount - 1;
+    }
+
+    return(result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_write_vector
+// Description  : Write a list of buffers to the server with gathered writes,
+//                writing the rest again after a short write or an interrupted
+//                call until every byte is sent
+//
+// Inputs       : connection - the connection
+//                iov - the buffers to write, changed as they are written
+//                iovcnt - number of buffers
+// Outputs      : 0 if successful, -1 if failure
+
+int network_write_vector(FS3Connection *connection, struct iovec *iov, int iovcnt){
+    // fails if the connection has been closed
+    if(connection->channel.transport == NULL){
+        return(-1);
+    }
+
+    while(iovcnt > 0){
+        ssize_t written = connection->channel.transport->writev(&connection->channel, iov, iovcnt);
+        if(written == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return(-1);
+        }
+
+        // skips the buffers written, and the part written of the next
+        while((iovcnt > 0) && ((size_t)written >= iov->iov_len)){
+            written = written - (ssize_t)iov->iov_len;
+            iov = iov + 1;
+            iovcnt = iovcnt - 1;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len = iov->iov_len - (size_t)written;
+        }
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_read_replies
+// Description  : Read as much of the replies to a connection's pending commands
+//                as has arrived with one scattered read, each command block into
+//                its pending command and each sector read straight into its buffer
+//
+// Inputs       : connection - the connection
+// Outputs      : 0 if successful, -1 if failure or the server closed the connection
+
+int network_read_replies(FS3Connection *connection){
+    // fails if the connection has been closed
+    if(connection->channel.transport == NULL){
+        return(-1);
+    }
+
+    // lists where the rest of every pending reply goes, past the bytes already read
+    struct iovec iov[2 * FS3_MAX_PIPELINE_DEPTH];
+    int iovcnt = 0;
+    size_t skip = connection->replyBytesRead;
+    int i;
+    for(i = 0; i < connection->pendingCount; i++){
+        FS3PendingCmd *pending = &connection->pendingCmds[(connection->pendingFirst + i) % FS3_MAX_PIPELINE_DEPTH];
+        void *parts[2] = {&pending->reply, pending->buf};
+        size_t partSizes[2] = {FS3_NET_HEADER_SIZE, FS3_SECTOR_SIZE};
+        int partCount = (pending->opCode == FS3_OP_RDSECT) ? 2 : 1;
+
+        int part;
+        for(part = 0; part < partCount; part++){
+            if(skip >= partSizes[part]){
+                skip = skip - partSizes[part];
+                continue;
+            }
+            iov[iovcnt].iov_base = (uint8_t *)parts[part] + skip;
+            iov[iovcnt].iov_len = partSizes[part] - skip;
+            iovcnt = iovcnt + 1;
+            skip = 0;
+        }
+    }
+
+    while(1){
+        ssize_t got = connection->channel.transport->readv(&connection->channel, iov, iovcnt);
+        if(got == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return(-1);
+        }
+        if(got == 0){
+            return(-1);
+        }
+
+        connection->replyBytesRead = connection->replyBytesRead + (size_t)got;
+        return(0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_log_metrics
+// Description  : Log the commands answered by the server and the system calls
+//                made for them
+//
+// Inputs       : none
+// Outputs      : 0 if successful
+
+int network_fs3_log_metrics(void){
+    double callsPerCommand = 0;
+    if(fs3_network_round_trips > 0){
+        callsPerCommand = (double)fs3_network_syscalls / (double)fs3_network_round_trips;
+    }
+
+    // counts the connections that carried commands in the last mount
+    int usedConnections = 0;
+    int conn;
+    for(conn = 0; conn < FS3_MAX_CONNECTIONS; conn++){
+        if(connections[conn].commands > 0){
+            usedConnections = conn + 1;
+        }
+    }
+
+    logMessage(FS3DriverLLevel, "** FS3 network metrics **");
+    logMessage(FS3DriverLLevel, "Pipeline depth   [%9u]",fs3_network_pipeline_depth);
+    logMessage(FS3DriverLLevel, "Connections      [%9d]",usedConnections);
+    logMessage(FS3DriverLLevel, "Commands         [%9lu]",(unsigned long)fs3_network_round_trips);
+    logMessage(FS3DriverLLevel, "System calls     [%9lu]",(unsigned long)fs3_network_syscalls);
+    logMessage(FS3DriverLLevel, "Calls per command[%9.2f]",callsPerCommand);
+
+    // with more than one connection, logs how the commands were spread across them
+    if(usedConnections > 1){
+        for(conn = 0; conn < usedConnections; conn++){
+            logMessage(FS3DriverLLevel, "    Connection %2d[%9lu]",conn,(unsigned long)connections[conn].commands);
+        }
+    }
+
+    return(0);
+}
+
@@ -11,20 +11,51 @@
 //
 
 // Include Files
+#include <stddef.h>
+#include <sys/uio.h>
 
 // Project Include Files
 #include <fs3_controller.h>
+#include <fs3_transport.h>
 
 // Defines
 #define FS3_MAX_BACKLOG 5
 #define FS3_NET_HEADER_SIZE sizeof(FS3CmdBlk)
 #define FS3_DEFAULT_IP "127.0.0.1"
 #define FS3_DEFAULT_PORT 22887
+#define FS3_DEFAULT_PIPELINE_DEPTH 32 // commands sent before their replies are read, by default
+#define FS3_MAX_PIPELINE_DEPTH 64     // most commands sent before their replies are read, on each connection
+#define FS3_DEFAULT_CONNECTIONS 1     // connections made to the server at mount, by default
+#define FS3_MAX_CONNECTIONS 16        // most connections made to the server
+#define FS3_CONNECTION_TIMEOUT 1000   // milliseconds a connection after the first waits for its mount to be answered
 
+// Type Definitions
+    // command sent to the server whose reply has not been read yet
+    typedef struct {
+        uint8_t opCode;  // op code of the command, which says what the reply holds
+        void *buf;       // the sector of a write, or where the sector of a read goes when the reply is read
+        uint64_t command; // the command block, in network byte order
+        uint64_t reply;   // the reply's command block, in network byte order
+    } FS3PendingCmd;
+
+    // connection to the server, with the commands sent on it whose replies have not been read yet
+    typedef struct {
+        FS3Channel channel;       // the transport's end of the connection, its transport NULL while closed
+        FS3PendingCmd pendingCmds[FS3_MAX_PIPELINE_DEPTH]; // oldest first, the newest of which may still be held
+        int pendingFirst;         // index of the oldest pending command
+        int pendingCount;         // number of pending commands
+        int unsentCount;          // number of the newest pending commands not written to the socket yet
+        size_t replyBytesRead;    // bytes of replies read, from the start of the oldest pending command's reply
+        uint64_t commands;        // number of commands answered on the connection
+    } FS3Connection;
 
 // Global data
-extern unsigned char *fs3_network_address;     // Address of FS3 server
+extern unsigned char *fs3_network_address;     // Address of FS3 server (an IP address, unix:/path or shm:/name)
 extern unsigned short fs3_network_port;        // Port of FS3 server
+extern uint64_t fs3_network_round_trips;       // Number of commands answered by the server
+extern uint64_t fs3_network_syscalls;          // Number of system calls made sending commands and reading replies
+extern uint16_t fs3_network_pipeline_depth;    // Most commands sent on a connection before their replies are read, 1 to wait for each
+extern uint16_t fs3_network_connections;       // Connections made to the server at mount, the commands spread across them
 
 //
 // Functional Prototypes
@@ -32,5 +63,59 @@ extern unsigned short fs3_network_port;        // Port of FS3 server
 int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
 	// This is the client/network system call for communicating with controller
 
+int network_fs3_send(int conn, FS3CmdBlk cmd, void *buf);
+	// Send a command on a connection without waiting for its reply, holding it to be written with others
+
+int network_fs3_flush(void);
+	// Write the commands held on every connection to the controller, in one gathered write each
+
+int network_fs3_flush_connection(FS3Connection *connection);
+	// Write every command held on a connection in one gathered write
+
+int network_fs3_push_connection(FS3Connection *connection);
+	// Send the commands a connection's transport held back from the last write
+
+int network_fs3_receive(int conn, FS3CmdBlk *ret);
+	// Read the reply to the oldest command sent on a connection
+
+int network_fs3_pending(int conn);
+	// Get the number of commands sent on a connection whose replies have not been read
+
+int network_fs3_connection_count(void);
+	// Get the number of connections open to the controller
+
+int network_fs3_register_buffers(void *base, size_t size);
+	// Set the memory registered with each io_uring connection opened after, sent from without a copy
+
+size_t network_fs3_reply_size(uint8_t opCode);
+	// Work out the bytes of the reply to a command
+
+int network_fs3_reset(FS3Connection *connection);
+	// Forget every pending command of a connection after it has failed
+
+int network_fs3_close(FS3Connection *connection);
+	// Close a connection's channel to the controller, if it is open
+
+int network_fs3_connect(FS3Connection *connection);
+	// Make a new connection to the controller, over the transport named by its address
+
+int network_fs3_open_pool(void);
+	// Open and mount the connections after the first, as many as the controller answers
+
+int network_fs3_mount_connection(int conn);
+	// Open a connection and mount the disk on it, giving up if the controller does not answer in time
+
+int network_fs3_close_pool(void);
+	// Unmount and close the connections after the first
+
+int network_write_vector(FS3Connection *connection, struct iovec *iov, int iovcnt);
+	// Write a list of buffers to a connection, through short writes
+
+int network_read_replies(FS3Connection *connection);
+	// Read as much of a connection's pending replies as has arrived, straight into their buffers
+
+int network_fs3_log_metrics(void);
+	// Log the commands answered by the controller and the system calls made for them
+
 
 #endif
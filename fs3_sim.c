@@ -25,6 +25,9 @@
 #include <fs3_controller.h>
 #include <fs3_common.h>
 #include <fs3_cache.h>
+#include <fs3_cache_policy.h>
+#include <fs3_cache_profile.h>
+#include <fs3_cache_l2.h>
 #include <fs3_network.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
@@ -32,17 +35,34 @@
 // Defines
 #define FS3_WORKLOAD_DIR "workload"
 #define FS3_SIM_MAX_OPEN_FILES 256
-#define FS3_ARGUMENTS "hvc:l:i:p:"
+#define FS3_ARGUMENTS "hvwtua:b:c:d:e:f:g:j:k:l:i:m:n:p:q:r:s:x:"
 #define USAGE \
-	"USAGE: fs3_sim [-h] [-v] [-c <cache size>] [-l <logfile>] <workload-file>\n" \
+	"USAGE: fs3_sim [-h] [-v] [-w] [-t] [-c <cache size>] [-b <bytes>] [-e <policy>] [-s <shards>] [-m <rate>] [-j <file>] [-d <file>] [-g <sectors>] [-x <epoch>] [-f <msecs>] [-r <sectors>] [-a <sectors>] [-k <sectors>] [-q <depth>] [-n <connections>] [-u] [-l <logfile>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
+	"    -w - write-back cache mode (writes held in the cache until flushed)\n" \
 	"    -c - set the cache size (in number of sectors)\n" \
+	"    -b - set the most memory the cache may use (in bytes, or with a k, m or g suffix)\n" \
+	"    -t - auto-tune the cache, growing it from its size up to the memory budget while it helps\n" \
+	"    -e - set the cache replacement policy (lru, clock, 2q, arc, tinylfu)\n" \
+	"    -s - set the most shards the cache is split into (a power of 2)\n" \
+	"    -j - write the cache telemetry (evictions, track heat, histograms, file hit ratios) as JSON to <file> at unmount\n" \
+	"    -d - keep sectors evicted from the cache in a second level cache in <file>, reused by later runs\n" \
+	"    -g - set the number of sectors the second level cache file holds\n" \
+	"    -x - set the epoch of the remote disk, discarding a second level cache file from any other\n" \
+	"    -m - profile the hit ratio of every cache size, following <rate> of the sectors (0 to 1, 1 for all)\n" \
+	"    -f - flush the write-back cache in the background every <msecs> milliseconds\n" \
+	"    -r - set the number of sectors reserved on a track for a growing file\n" \
+	"    -a - set the most sectors read ahead of a sequential reader (0 for none)\n" \
+	"    -k - on a read miss, read up to <sectors> more of the file on the same track into the cache (0 for none)\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
-    "    -i - IP address of server to connect to.\n" \
+    "    -i - address of server to connect to: an IP address, unix:<path> or shm:<name>.\n" \
     "    -p - port number of server to connect to.\n" \
+	"    -n - set the number of connections to the server the disk commands are spread across\n" \
+	"    -q - set the most commands sent to the server before their replies are read (1 to wait for each)\n" \
+	"    -u - send commands and read replies with io_uring, if the kernel has it (socket connections only)\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
@@ -56,13 +76,14 @@ typedef struct {
 //
 // Global Data
 int verbose;
-uint16_t fs3CacheSize = FS3_DEFAULT_CACHE_SIZE; 
+uint32_t fs3CacheSize = FS3_DEFAULT_CACHE_SIZE; 
 
 //
 // Functional Prototypes
 
 int simulate_FS3( char *wload );              // control loop of the FS3 simulation
 int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesystem
+int parse_byte_size(char *text, uint64_t *bytes); // Parse a number of bytes with an optional k, m or g suffix
 
 //
 // Functions
@@ -80,6 +101,8 @@ int main( int argc, char *argv[] ) {
 
 	// Local variables
 	int ch, verbose = 0, log_initialized = 0;
+	int transport;
+	const char *target;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, FS3_ARGUMENTS)) != -1) {
@@ -99,15 +122,116 @@ int main( int argc, char *argv[] ) {
 			break;
 
 		case 'c': // Set the cache size
-			if ( sscanf(optarg, "%hu", &fs3CacheSize) != 1) {
+			if ( sscanf(optarg, "%u", &fs3CacheSize) != 1) {
 				logMessage(LOG_ERROR_LEVEL, "Failed parsing cache size [%s]", optarg);
 				return(-1);
 			}
 			break;
 
-		case 'i': // Get the IP address
-			if (inet_addr(optarg) == INADDR_NONE) {
-				logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", argv[optind] );
+		case 'e': // Set the cache replacement policy
+			if ( (fs3_cache_policy = fs3_find_cache_policy(optarg)) == -1 ) {
+				logMessage(LOG_ERROR_LEVEL, "Unknown cache replacement policy [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 's': // Set the most cache shards
+			if ( (sscanf(optarg, "%hu", &fs3_cache_shards) != 1) || (fs3_cache_shards == 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing cache shard count [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'b': // Set the cache memory budget
+			if ( parse_byte_size(optarg, &fs3_cache_budget) == -1 ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing cache memory budget [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'j': // Set the cache telemetry file
+			fs3_telemetry_path = strdup(optarg);
+			break;
+
+		case 'd': // Set the second level cache file
+			fs3_cache_l2_path = strdup(optarg);
+			break;
+
+		case 'g': // Set the size of the second level cache file
+			if ( (sscanf(optarg, "%u", &fs3_cache_l2_lines) != 1) || (fs3_cache_l2_lines < FS3_L2_WAYS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing second level cache size [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'x': // Set the epoch of the remote disk
+			if ( sscanf(optarg, "%lu", &fs3_cache_l2_epoch) != 1 ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing disk epoch [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'm': // Profile the miss ratio curve of the cache
+			if ( (sscanf(optarg, "%lf", &fs3_cache_profile_rate) != 1) ||
+				(fs3_cache_profile_rate <= 0) || (fs3_cache_profile_rate > 1) ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing cache profile sampling rate [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 't': // Auto-tune the cache size
+			fs3_cache_autotune = 1;
+			break;
+
+		case 'u': // Send commands with io_uring
+			fs3_transport_uring = 1;
+			break;
+
+		case 'w': // Write-back cache mode
+			fs3_cache_mode = FS3_CACHE_WRITE_BACK;
+			break;
+
+		case 'f': // Set the background flush interval
+			if ( sscanf(optarg, "%u", &fs3_cache_flush_interval) != 1 ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing flush interval [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'r': // Set the allocation reservation size
+			if ( (sscanf(optarg, "%hu", &fs3_reservation_size) != 1) || (fs3_reservation_size == 0) ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing reservation size [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'a': // Set the most sectors read ahead
+			if ( sscanf(optarg, "%hu", &fs3_readahead_max) != 1 ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing readahead size [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'k': // Set the most sectors filled from a track on a read miss
+			if ( sscanf(optarg, "%hu", &fs3_track_fill_max) != 1 ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing track fill size [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'q': // Set the pipeline depth
+			if ( (sscanf(optarg, "%hu", &fs3_network_pipeline_depth) != 1) || (fs3_network_pipeline_depth == 0) ||
+				(fs3_network_pipeline_depth > FS3_MAX_PIPELINE_DEPTH) ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing pipeline depth [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'i': // Get the server address, and check the transport it names
+			transport = fs3_find_transport(optarg, &target);
+			if ( (transport == -1) || (*target == '\0') ||
+				((transport == FS3_TRANSPORT_TCP) && (inet_addr(target) == INADDR_NONE)) ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad server address [%s]", optarg );
 				return(-1);
 			}
 			fs3_network_address = (unsigned char *)strdup(optarg);
@@ -120,6 +244,14 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
+		case 'n': // Set the number of connections to the server
+			if ( (sscanf(optarg, "%hu", &fs3_network_connections) != 1) || (fs3_network_connections == 0) ||
+				(fs3_network_connections > FS3_MAX_CONNECTIONS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing connection count [%s]", optarg);
+				return(-1);
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -183,6 +315,11 @@ int simulate_FS3( char *wload ) {
 		return( -1 );
 	}
 
+	// With a memory budget the cache uses all of it, unless it is being tuned up from its size
+	if ( (fs3_cache_budget > 0) && (fs3_cache_autotune == 0) ) {
+		fs3CacheSize = fs3_cache_budget_lines(fs3_cache_budget);
+	}
+
 	// Startup the interface
 	if ( (fs3_mount_disk() == -1) || (fs3_init_cache(fs3CacheSize) == -1) ){
 		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed initialization.");
@@ -373,6 +510,7 @@ int simulate_FS3( char *wload ) {
 		logMessage(LOG_ERROR_LEVEL, "FS3 simulation failed, controller metrics failed");
 		return(-1);
 	}
+	network_fs3_log_metrics();
 	if ((fs3_unmount_disk() == -1) || (fs3_close_cache() == -1)) {
 		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed shutdown.");
 		fclose( fhandle );
@@ -466,3 +604,46 @@ int validate_file(char *fname, int16_t mfh) {
 	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
 	return( 0 );
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parse_byte_size
+// Description  : Parse a number of bytes, with an optional k, m or g suffix
+//
+// Inputs       : text - the text to parse
+//                bytes - where to put the number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int parse_byte_size(char *text, uint64_t *bytes) {
+
+	// Local variables
+	unsigned long long number;
+	char suffix = '\0';
+	int fields;
+
+	// Read the number and its suffix, if it has one
+	fields = sscanf(text, "%llu%c", &number, &suffix);
+	if ( fields < 1 ) {
+		return(-1);
+	}
+
+	// Scale the number by its suffix
+	switch (suffix) {
+	case '\0':
+		break;
+	case 'k': case 'K':
+		number = number * 1024;
+		break;
+	case 'm': case 'M':
+		number = number * 1024 * 1024;
+		break;
+	case 'g': case 'G':
+		number = number * 1024 * 1024 * 1024;
+		break;
+	default:
+		return(-1);
+	}
+
+	*bytes = (uint64_t)number;
+	return(0);
+}
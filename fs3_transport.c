@@ -0,0 +1,498 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_transport.c
+//  Description    : This is the implementation of the socket transports of the
+//                   FS3 protocol, TCP and unix domain sockets, and of choosing
+//                   a transport from the scheme of an address.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/13/2021
+//
+
+// Includes
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_transport.h>
+#include <fs3_network.h>
+
+// Global Variables
+    FS3Transport fs3_transports[FS3_TRANSPORT_COUNT] = {
+        { "tcp", fs3_socket_connect, fs3_socket_listen, fs3_socket_accept, fs3_stream_writev, fs3_stream_readv, fs3_stream_wait, fs3_socket_expect, NULL, fs3_stream_close },
+        { "unix", fs3_unix_connect, fs3_unix_listen, fs3_unix_accept, fs3_stream_writev, fs3_stream_readv, fs3_stream_wait, NULL, NULL, fs3_stream_close },
+        { "shm", fs3_shm_connect, fs3_shm_listen, fs3_shm_accept, fs3_shm_writev, fs3_shm_readv, fs3_shm_wait, NULL, NULL, fs3_shm_close },
+    };
+    int fs3_transport_uring = 0; // 1 to carry socket connections with io_uring, when the kernel has it
+
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_find_transport
+// Description  : Find the transport of an address from its scheme, the part
+//                before the first colon. An address with no scheme is an IP
+//                address for TCP, as is no address at all
+//
+// Inputs       : address - the address, NULL for the default
+//                target - set to the part of the address after the scheme
+// Outputs      : number of the transport, -1 if the scheme is not known
+
+int fs3_find_transport(const char *address, const char **target) {
+    *target = address;
+    if(address == NULL){
+        return(FS3_TRANSPORT_TCP);
+    }
+
+    const char *colon = strchr(address, ':');
+    if(colon == NULL){
+        return(FS3_TRANSPORT_TCP);
+    }
+
+    int i;
+    for(i = 0; i < FS3_TRANSPORT_COUNT; i++){
+        if((strlen(fs3_transports[i].scheme) == (size_t)(colon - address)) &&
+            (strncmp(fs3_transports[i].scheme, address, colon - address) == 0)){
+            *target = colon + 1;
+            return(i);
+        }
+    }
+
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_transport_connect
+// Description  : Connect to the controller at an address, over the transport its
+//                scheme names
+//
+// Inputs       : channel - the channel to connect, closed
+//                address - the address of the controller, NULL for the default
+//                port - the port of a TCP controller, 0 for the default
+//                bufferSize - bytes each way the connection should hold unread
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_transport_connect(FS3Channel *channel, const char *address, uint16_t port, int bufferSize) {
+    const char *target;
+    int transport = fs3_find_transport(address, &target);
+    if(transport == -1){
+        return(-1);
+    }
+
+    fs3_channel_init(channel);
+    if(fs3_transports[transport].connect(channel, target, port, bufferSize) == -1){
+        fs3_channel_init(channel);
+        return(-1);
+    }
+    channel->transport = &fs3_transports[transport];
+
+    // carries a socket connection with io_uring if asked to, staying on the socket calls without it
+    if((fs3_transport_uring == 1) && (channel->fd != -1)){
+        fs3_uring_attach(channel);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_transport_listen
+// Description  : Wait for clients at an address, over the transport its scheme
+//                names
+//
+// Inputs       : listener - the channel clients are accepted from, closed
+//                address - the address to listen at, NULL for the default
+//                port - the port of a TCP address, 0 for the default
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_transport_listen(FS3Channel *listener, const char *address, uint16_t port) {
+    const char *target;
+    int transport = fs3_find_transport(address, &target);
+    if(transport == -1){
+        return(-1);
+    }
+
+    fs3_channel_init(listener);
+    listener->server = 1;
+    if(fs3_transports[transport].listen(listener, target, port) == -1){
+        fs3_channel_init(listener);
+        return(-1);
+    }
+    listener->transport = &fs3_transports[transport];
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_channel_init
+// Description  : Set up a closed channel
+//
+// Inputs       : channel - the channel
+// Outputs      : 0 if successful
+
+int fs3_channel_init(FS3Channel *channel) {
+    channel->transport = NULL;
+    channel->fd = -1;
+    channel->area = NULL;
+    channel->sendRing = NULL;
+    channel->receiveRing = NULL;
+    channel->slot = NULL;
+    channel->server = 0;
+    channel->uring = NULL;
+    channel->base = NULL;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_socket_address
+// Description  : Work out the IPv4 address of a TCP controller
+//
+// Inputs       : target - the IP address, NULL for the default
+//                port - the port, 0 for the default
+//                address - the address worked out
+// Outputs      : 0 if successful, -1 if the IP address is not valid
+
+int fs3_socket_address(const char *target, uint16_t port, struct sockaddr_in *address) {
+    memset(address, 0, sizeof(*address));
+
+    // sets the protocol family and port of the address
+    address->sin_family = AF_INET;
+    address->sin_port = htons((port == 0) ? FS3_DEFAULT_PORT : port);
+
+    // creates the UNIX structure for processing from the IPv4 address
+    if((target == NULL) || (target[0] == '\0')){
+        target = FS3_DEFAULT_IP;
+    }
+    if(inet_aton(target, &address->sin_addr) == 0){
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_socket_buffers
+// Description  : Size the buffers of a socket so it holds a number of bytes each
+//                way unread, done before connecting so the window is set up for
+//                them
+//
+// Inputs       : fd - the socket
+//                bufferSize - bytes each way
+// Outputs      : 0 if successful
+
+int fs3_socket_buffers(int fd, int bufferSize) {
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_socket_connect
+// Description  : TCP transport, connect to a controller at an IP address and port.
+//                Each batch of commands is sent as soon as it is written, rather
+//                than a small one being held back until the last is acknowledged
+//
+// Inputs       : channel - the channel to connect
+//                target - the IP address, NULL for the default
+//                port - the port, 0 for the default
+//                bufferSize - bytes each way the socket should hold unread
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_socket_connect(FS3Channel *channel, const char *target, uint16_t port, int bufferSize) {
+    struct sockaddr_in address;
+    if(fs3_socket_address(target, port, &address) == -1){
+        return(-1);
+    }
+
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if(fd == -1){
+        return(-1);
+    }
+    fs3_socket_buffers(fd, bufferSize);
+
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    if(connect(fd, (const struct sockaddr *)&address, sizeof(address)) == -1){
+        close(fd);
+        return(-1);
+    }
+
+    channel->fd = fd;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_socket_listen
+// Description  : TCP transport, listen for clients on a port of an IP address
+//
+// Inputs       : listener - the channel clients are accepted from
+//                target - the IP address, NULL for the default
+//                port - the port, 0 for the default
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_socket_listen(FS3Channel *listener, const char *target, uint16_t port) {
+    struct sockaddr_in address;
+    if(fs3_socket_address(target, port, &address) == -1){
+        return(-1);
+    }
+
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if(fd == -1){
+        return(-1);
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if((bind(fd, (const struct sockaddr *)&address, sizeof(address)) == -1) || (listen(fd, FS3_MAX_BACKLOG) == -1)){
+        close(fd);
+        return(-1);
+    }
+
+    listener->fd = fd;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_socket_accept
+// Description  : TCP transport, take the next client connecting, sending its
+//                replies as soon as they are written
+//
+// Inputs       : listener - the channel clients are accepted from
+//                channel - the channel of the client
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_socket_accept(FS3Channel *listener, FS3Channel *channel) {
+    if(fs3_unix_accept(listener, channel) == -1){
+        return(-1);
+    }
+
+    int noDelay = 1;
+    setsockopt(channel->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_socket_expect
+// Description  : TCP transport, with more than one reply owed, asks for them to
+//                be acknowledged straight away, as the server holds back each
+//                small reply until the one before is acknowledged, and with every
+//                command sent there is nothing going back to carry the
+//                acknowledgement (sending turns this off again, so it is asked
+//                for after each write)
+//
+// Inputs       : channel - the channel
+//                replies - number of replies owed
+// Outputs      : 0 if successful
+
+int fs3_socket_expect(FS3Channel *channel, int replies) {
+    if(replies > 1){
+        int quickAck = 1;
+        setsockopt(channel->fd, IPPROTO_TCP, TCP_QUICKACK, &quickAck, sizeof(quickAck));
+        fs3_network_syscalls = fs3_network_syscalls + 1;
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_unix_address
+// Description  : Work out the address of a unix domain socket from its path
+//
+// Inputs       : target - the path of the socket
+//                address - the address worked out
+// Outputs      : 0 if successful, -1 if the path does not fit
+
+int fs3_unix_address(const char *target, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if((target == NULL) || (target[0] == '\0') || (strlen(target) >= sizeof(address->sun_path))){
+        return(-1);
+    }
+    strcpy(address->sun_path, target);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_unix_connect
+// Description  : Unix transport, connect to a controller's socket path
+//
+// Inputs       : channel - the channel to connect
+//                target - the path of the socket
+//                port - not used
+//                bufferSize - bytes each way the socket should hold unread
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_unix_connect(FS3Channel *channel, const char *target, uint16_t port, int bufferSize) {
+    (void)port;  // a socket path has no port
+
+    struct sockaddr_un address;
+    if(fs3_unix_address(target, &address) == -1){
+        return(-1);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1){
+        return(-1);
+    }
+    fs3_socket_buffers(fd, bufferSize);
+
+    if(connect(fd, (const struct sockaddr *)&address, sizeof(address)) == -1){
+        close(fd);
+        return(-1);
+    }
+
+    channel->fd = fd;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_unix_listen
+// Description  : Unix transport, listen for clients at a socket path. A socket
+//                already at the path that nothing is listening on is left from
+//                a controller that exited, so it is replaced
+//
+// Inputs       : listener - the channel clients are accepted from
+//                target - the path of the socket
+//                port - not used
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_unix_listen(FS3Channel *listener, const char *target, uint16_t port) {
+    (void)port;  // a socket path has no port
+
+    struct sockaddr_un address;
+    if(fs3_unix_address(target, &address) == -1){
+        return(-1);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1){
+        return(-1);
+    }
+
+    // replaces a stale socket, but not one a controller is listening on
+    if(connect(fd, (const struct sockaddr *)&address, sizeof(address)) == 0){
+        close(fd);
+        return(-1);
+    }
+    unlink(target);
+
+    if((bind(fd, (const struct sockaddr *)&address, sizeof(address)) == -1) || (listen(fd, FS3_MAX_BACKLOG) == -1)){
+        close(fd);
+        return(-1);
+    }
+
+    listener->fd = fd;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_unix_accept
+// Description  : Unix transport, take the next client connecting
+//
+// Inputs       : listener - the channel clients are accepted from
+//                channel - the channel of the client
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_unix_accept(FS3Channel *listener, FS3Channel *channel) {
+    int fd;
+    do {
+        fd = accept(listener->fd, NULL, NULL);
+    } while((fd == -1) && (errno == EINTR));
+    if(fd == -1){
+        return(-1);
+    }
+
+    fs3_channel_init(channel);
+    channel->transport = listener->transport;
+    channel->fd = fd;
+    channel->server = 1;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_stream_writev
+// Description  : Socket transports, write a list of buffers with one gathered
+//                write, which may write only some of them
+//
+// Inputs       : channel - the channel
+//                iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : bytes written, -1 if failure
+
+ssize_t fs3_stream_writev(FS3Channel *channel, const struct iovec *iov, int iovcnt) {
+    fs3_network_syscalls = fs3_network_syscalls + 1;
+    return(writev(channel->fd, iov, iovcnt));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_stream_readv
+// Description  : Socket transports, read what has arrived into a list of buffers
+//                with one scattered read
+//
+// Inputs       : channel - the channel
+//                iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : bytes read, 0 if the peer closed the connection, -1 if failure
+
+ssize_t fs3_stream_readv(FS3Channel *channel, const struct iovec *iov, int iovcnt) {
+    fs3_network_syscalls = fs3_network_syscalls + 1;
+    return(readv(channel->fd, iov, iovcnt));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_stream_wait
+// Description  : Socket transports, wait for bytes to arrive
+//
+// Inputs       : channel - the channel
+//                timeout - most milliseconds to wait, -1 for no limit
+// Outputs      : 1 if there are bytes to read, 0 if the timeout passed, -1 if failure
+
+int fs3_stream_wait(FS3Channel *channel, int timeout) {
+    struct pollfd readPoll = {channel->fd, POLLIN, 0};
+    fs3_network_syscalls = fs3_network_syscalls + 1;
+
+    return(poll(&readPoll, 1, timeout));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_stream_close
+// Description  : Socket transports, close the socket
+//
+// Inputs       : channel - the channel
+// Outputs      : 0 if successful
+
+int fs3_stream_close(FS3Channel *channel) {
+    close(channel->fd);
+    fs3_channel_init(channel);
+
+    return(0);
+}
@@ -0,0 +1,321 @@
+#ifndef FS3_TRANSPORT_INCLUDED
+#define FS3_TRANSPORT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_transport.h
+//  Description    : This is the interface for the transports that carry the
+//                   bytes of the FS3 protocol between the client and the
+//                   controller: TCP, unix domain sockets, and a ring in shared
+//                   memory for a controller on the same host. The transport is
+//                   chosen by the scheme of the address (unix:/path, shm:/name,
+//                   or an IP address for TCP). A socket connection can also be
+//                   carried by io_uring, when the kernel has it.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/13/2021
+//
+
+// Include
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+// Defines
+#define FS3_TRANSPORT_TCP 0     // TCP to an IP address and port
+#define FS3_TRANSPORT_UNIX 1    // unix domain stream socket at a path
+#define FS3_TRANSPORT_SHM 2     // pair of byte rings in a shared memory object
+#define FS3_TRANSPORT_COUNT 3   // number of transports
+#define FS3_SHM_RING_SIZE 0x40000   // bytes of each ring of a shared memory connection (a power of 2)
+#define FS3_SHM_SLOTS 16            // connections a shared memory object holds at once
+#define FS3_SHM_SPIN_LIMIT 512      // times a ring is checked before its reader or writer sleeps, with more than one processor
+#define FS3_SHM_WAIT_MSECS 100      // milliseconds slept at a time, after which the peer is checked for
+#define FS3_SHM_ACCEPT_MSECS 1000   // milliseconds a client waits for the controller to accept its slot
+#define FS3_SHM_MAGIC 0x46533353484d3031ULL // "FS3SHM01", marks a shared memory object of the transport
+#define FS3_SHM_SLOT_FREE 0         // slot not in use
+#define FS3_SHM_SLOT_CLAIMING 1     // slot being set up by a client
+#define FS3_SHM_SLOT_CLAIMED 2      // slot waiting for the controller to accept it
+#define FS3_SHM_SLOT_OPEN 3         // slot connecting a client and the controller
+#define FS3_URING_ENTRIES 8         // submission queue entries of a connection's io_uring
+#define FS3_URING_IOVECS 256        // most buffers sent or received by one io_uring operation
+#define FS3_URING_SENDS 6           // most operations sending one batch of commands (entries less the quick acknowledgement and receive)
+#define FS3_URING_QUICKACK 0        // user data of the operation asking for quick acknowledgements
+#define FS3_URING_RECEIVE 1         // user data of the operation receiving replies
+#define FS3_URING_SEND 2            // user data of the first operation sending a batch of commands, the others following it
+#define FS3_URING_OPERATIONS (FS3_URING_SEND + FS3_URING_SENDS) // operations submitted together at most
+#define FS3_URING_FIXED_BUFFER 0    // index of the registered buffer holding the sector pool
+#define FS3_URING_SETSOCKOPT 3      // SOCKET_URING_OP_SETSOCKOPT, for kernel headers older than it
+
+// Type Definitions
+    // one direction of a shared memory connection, a ring of bytes with one writer and one reader
+    typedef struct {
+        _Atomic uint64_t head;        // bytes taken out by the reader
+        _Atomic uint32_t readerWaiting; // 1 while the reader sleeps for bytes
+        _Atomic uint32_t dataSignal;  // bumped to wake the reader
+        uint8_t padding[48];          // keeps the writer's counters off the reader's processor cache line
+        _Atomic uint64_t tail;        // bytes put in by the writer
+        _Atomic uint32_t writerWaiting; // 1 while the writer sleeps for room
+        _Atomic uint32_t spaceSignal; // bumped to wake the writer
+        _Atomic uint32_t closed;      // 1 once the writer has closed its end
+        uint8_t data[FS3_SHM_RING_SIZE];
+    } __attribute__((aligned(64))) FS3ShmRing;
+
+    // a connection slot of a shared memory object, with a ring each way
+    typedef struct {
+        _Atomic uint32_t state;       // FS3_SHM_SLOT_* state of the slot
+        _Atomic int32_t clientPid;    // process of the client using the slot
+        _Atomic uint32_t closedEnds;  // ends of the connection closed, the slot is freed by the second
+        FS3ShmRing toServer;          // commands, written by the client
+        FS3ShmRing toClient;          // replies, written by the server
+    } FS3ShmSlot;
+
+    // start of a shared memory object, created by the controller
+    typedef struct {
+        uint64_t magic;               // FS3_SHM_MAGIC, so other objects are not mistaken for one
+        _Atomic int32_t serverPid;    // process of the controller serving the object
+        _Atomic uint32_t connectSignal; // bumped to wake the controller when a slot is claimed
+        FS3ShmSlot slots[FS3_SHM_SLOTS];
+    } FS3ShmArea;
+
+    // io_uring of a socket connection, a batch of commands sent and its replies received with one system call
+    typedef struct {
+        int fd;                       // the io_uring
+        int fixedFile;                // 1 if the socket is registered with the ring, 0 if used by its descriptor
+        void *sqRing;                 // mapping of the submission queue
+        size_t sqRingSize;
+        void *cqRing;                 // mapping of the completion queue, the submission queue's if shared
+        size_t cqRingSize;
+        struct io_uring_sqe *sqes;    // submission queue entries
+        size_t sqesSize;
+        _Atomic uint32_t *sqTail;     // entries submitted, written by this end
+        uint32_t *sqArray;            // index of the entry in each submission queue slot
+        uint32_t sqMask;
+        _Atomic uint32_t *cqHead;     // completions taken, written by this end
+        _Atomic uint32_t *cqTail;     // completions made, written by the kernel
+        struct io_uring_cqe *cqes;
+        uint32_t cqMask;
+        int zeroCopy;                 // 1 if the ring can send from registered buffers without a copy
+        int fixedBuffers;             // 1 if the sector pool is registered with the ring, and its sectors sent without a copy
+        struct msghdr sendMessages[FS3_URING_SENDS]; // batch of commands written and not sent yet, split between its sends
+        uint8_t sendFixed[FS3_URING_SENDS]; // 1 for a send of one sector of the registered sector pool
+        int sendCount;                // number of sends of the batch
+        struct iovec sendIov[FS3_URING_IOVECS];
+        size_t sendLength;            // bytes of the batch
+        int sendQueued;               // 1 while a batch is waiting to be sent
+        struct msghdr receiveMessage; // where the replies received go
+        struct iovec receiveIov[FS3_URING_IOVECS];
+        int quickAck;                 // 1 to ask for quick acknowledgements after the batch is sent
+        int quickAckRing;             // 1 while the ring can set socket options, 0 once it was found not to
+        int quickAckValue;            // the option value set
+    } FS3Uring;
+
+    struct FS3Transport;
+
+    // one end of a connection over a transport
+    typedef struct {
+        const struct FS3Transport *transport; // the transport carrying the connection, NULL while closed
+        int fd;                       // socket of a socket transport, -1 if none
+        FS3ShmArea *area;             // shared memory object of the shm transport, NULL if none
+        FS3ShmRing *sendRing;         // ring this end writes to
+        FS3ShmRing *receiveRing;      // ring this end reads from
+        FS3ShmSlot *slot;             // slot of the shared memory connection
+        int server;                   // 1 for the controller's end, 0 for the client's
+        FS3Uring *uring;              // io_uring carrying a socket connection, NULL if none
+        const struct FS3Transport *base; // socket transport under the io_uring, NULL if none
+    } FS3Channel;
+
+    // transport struct, the functions a connection's bytes are moved with
+    typedef struct FS3Transport {
+        const char *scheme;           // prefix of the addresses of the transport, before the colon
+        int (*connect)(FS3Channel *channel, const char *target, uint16_t port, int bufferSize); // connect to a controller
+        int (*listen)(FS3Channel *listener, const char *target, uint16_t port);  // wait for clients at an address
+        int (*accept)(FS3Channel *listener, FS3Channel *channel);              // take the next client connecting
+        ssize_t (*writev)(FS3Channel *channel, const struct iovec *iov, int iovcnt); // write some of a list of buffers, blocking until one byte can be
+        ssize_t (*readv)(FS3Channel *channel, const struct iovec *iov, int iovcnt);  // read what has arrived, blocking until one byte has (0 once closed)
+        int (*wait)(FS3Channel *channel, int timeout);  // wait up to timeout milliseconds for bytes to read (1 if there are)
+        int (*expect)(FS3Channel *channel, int replies); // the commands written have replies owed (may be NULL)
+        int (*push)(FS3Channel *channel); // send the bytes a write held back for the next read (may be NULL)
+        int (*close)(FS3Channel *channel);
+    } FS3Transport;
+
+// Global data
+extern FS3Transport fs3_transports[FS3_TRANSPORT_COUNT]; // Every transport, by number
+extern int fs3_shm_spins;                 // Times a shared memory ring is checked before sleeping on it, -1 until worked out
+extern int fs3_transport_uring;           // 1 to carry socket connections with io_uring, when the kernel has it
+extern int fs3_uring_unavailable;         // 1 once io_uring was found missing, and the socket calls used instead
+extern FS3Transport fs3_uring_transport;  // Transport of a socket connection carried by io_uring
+extern struct iovec fs3_uring_region;     // Memory registered with each io_uring (the sector pool), sent from without a copy
+
+// Transport Functions
+
+int fs3_find_transport(const char *address, const char **target);
+    // Find the number of the transport of an address, and the part after its scheme (returns -1 if not found)
+
+int fs3_transport_connect(FS3Channel *channel, const char *address, uint16_t port, int bufferSize);
+    // Connect to the controller at an address, over the transport its scheme names
+
+int fs3_transport_listen(FS3Channel *listener, const char *address, uint16_t port);
+    // Wait for clients at an address, over the transport its scheme names
+
+int fs3_channel_init(FS3Channel *channel);
+    // Set up a closed channel
+
+int fs3_socket_address(const char *target, uint16_t port, struct sockaddr_in *address);
+    // Work out the IPv4 address of a TCP controller
+
+int fs3_socket_buffers(int fd, int bufferSize);
+    // Size the buffers of a socket so it holds a number of bytes each way unread
+
+int fs3_socket_connect(FS3Channel *channel, const char *target, uint16_t port, int bufferSize);
+    // TCP transport, connect to an IP address and port
+
+int fs3_socket_listen(FS3Channel *listener, const char *target, uint16_t port);
+    // TCP transport, listen on a port of an IP address
+
+int fs3_socket_accept(FS3Channel *listener, FS3Channel *channel);
+    // TCP transport, take the next client
+
+int fs3_socket_expect(FS3Channel *channel, int replies);
+    // TCP transport, ask for replies to be acknowledged straight away while more than one is owed
+
+int fs3_unix_address(const char *target, struct sockaddr_un *address);
+    // Work out the address of a unix domain socket from its path
+
+int fs3_unix_connect(FS3Channel *channel, const char *target, uint16_t port, int bufferSize);
+    // Unix transport, connect to a socket path
+
+int fs3_unix_listen(FS3Channel *listener, const char *target, uint16_t port);
+    // Unix transport, listen at a socket path, replacing a stale socket left there
+
+int fs3_unix_accept(FS3Channel *listener, FS3Channel *channel);
+    // Unix transport, take the next client
+
+ssize_t fs3_stream_writev(FS3Channel *channel, const struct iovec *iov, int iovcnt);
+    // Socket transports, write a list of buffers
+
+ssize_t fs3_stream_readv(FS3Channel *channel, const struct iovec *iov, int iovcnt);
+    // Socket transports, read into a list of buffers
+
+int fs3_stream_wait(FS3Channel *channel, int timeout);
+    // Socket transports, wait for bytes to read
+
+int fs3_stream_close(FS3Channel *channel);
+    // Socket transports, close the socket
+
+int fs3_shm_connect(FS3Channel *channel, const char *target, uint16_t port, int bufferSize);
+    // Shared memory transport, claim a slot of the controller's object and wait for it to be accepted
+
+int fs3_shm_listen(FS3Channel *listener, const char *target, uint16_t port);
+    // Shared memory transport, create the object clients claim slots of
+
+int fs3_shm_accept(FS3Channel *listener, FS3Channel *channel);
+    // Shared memory transport, take the next slot claimed by a client
+
+ssize_t fs3_shm_writev(FS3Channel *channel, const struct iovec *iov, int iovcnt);
+    // Shared memory transport, copy a list of buffers into the ring to the peer
+
+ssize_t fs3_shm_readv(FS3Channel *channel, const struct iovec *iov, int iovcnt);
+    // Shared memory transport, copy what has arrived in the ring from the peer into a list of buffers
+
+int fs3_shm_wait(FS3Channel *channel, int timeout);
+    // Shared memory transport, wait for bytes in the ring from the peer
+
+int fs3_shm_close(FS3Channel *channel);
+    // Shared memory transport, close this end of the connection
+
+int fs3_shm_ring_wait(FS3Channel *channel, FS3ShmRing *ring, int forData, int timeout);
+    // Wait until a ring has bytes to read or room to write, spinning before sleeping (returns 1 if so, 0 if timed out, -1 if the peer is gone)
+
+int fs3_shm_spin_limit(void);
+    // Work out how many times a ring is checked before sleeping on it (none with a single processor)
+
+int fs3_shm_ring_ready(FS3Channel *channel, FS3ShmRing *ring, int forData);
+    // Check if a ring has bytes to read, or room to write
+
+int fs3_shm_ring_wake(_Atomic uint32_t *signal, _Atomic uint32_t *waiting);
+    // Wake the peer sleeping on a ring, if it is
+
+int fs3_shm_ring_init(FS3ShmRing *ring);
+    // Empty a ring and open its writer's end
+
+int fs3_shm_ring_copy(uint8_t *data, uint64_t position, void *buf, size_t length, int into);
+    // Copy bytes into or out of a ring's data, wrapping around its end
+
+int fs3_shm_peer_alive(FS3Channel *channel);
+    // Check that the process at the other end of a shared memory connection still exists
+
+int fs3_shm_process_alive(int32_t pid);
+    // Check that a process exists
+
+FS3ShmArea * fs3_shm_map(const char *name, int create);
+    // Open a shared memory object and map it
+
+int fs3_shm_unmap(FS3ShmArea *area);
+    // Unmap a shared memory object
+
+int fs3_shm_futex_wait(_Atomic uint32_t *word, uint32_t value, int timeout);
+    // Sleep while a word of shared memory holds a value, until woken or a timeout passes
+
+int fs3_shm_futex_wake(_Atomic uint32_t *word, int count);
+    // Wake processes sleeping on a word of shared memory
+
+int fs3_uring_attach(FS3Channel *channel);
+    // Carry a connected socket with an io_uring of its own, leaving it on the socket calls if the kernel lacks one (returns -1 if so)
+
+int fs3_uring_setup(FS3Uring *uring, int socketFd);
+    // Create an io_uring and map its queues, registering the socket with it
+
+int fs3_uring_probe(FS3Uring *uring);
+    // Check the io_uring can send and receive socket messages (returns 1 if so), and if it can send without a copy
+
+int fs3_uring_register_buffers(FS3Uring *uring);
+    // Register the sector pool with an io_uring, so sectors in it are sent from it without a copy
+
+int fs3_uring_release(FS3Uring *uring);
+    // Unmap an io_uring's queues and close it
+
+struct io_uring_sqe * fs3_uring_get_sqe(FS3Channel *channel, uint8_t opcode, uint8_t flags, uint64_t userData);
+    // Take the next submission queue entry for an operation on the socket, cleared
+
+int fs3_uring_complete(FS3Uring *uring, int submit, int wanted, int32_t *results);
+    // Submit entries and wait for a number of completions, storing their results by user data
+
+int fs3_uring_split_send(FS3Uring *uring, int iovcnt);
+    // Split a batch of commands between its sends, each sector of the registered sector pool sent on its own
+
+int fs3_uring_add_send(FS3Uring *uring, int first, int count, int fixed);
+    // Add a send of a run of the buffers of a batch
+
+int fs3_uring_fixed(FS3Uring *uring, const struct iovec *iov);
+    // Check if a buffer is inside the memory registered with an io_uring (returns 1 if so)
+
+int fs3_uring_prep_send(FS3Channel *channel, int linked);
+    // Queue the operations sending the batch of commands written, and asking for quick acknowledgements (returns the number queued)
+
+int fs3_uring_push(FS3Channel *channel);
+    // Io_uring transport, send a batch of commands held on its own, waiting for it to be sent
+
+int fs3_uring_check_send(FS3Channel *channel, int32_t *results);
+    // Check the results of sending a batch of commands (returns -1 if it was not all sent)
+
+ssize_t fs3_uring_writev(FS3Channel *channel, const struct iovec *iov, int iovcnt);
+    // Io_uring transport, hold a list of buffers to be sent with the next read or push
+
+ssize_t fs3_uring_readv(FS3Channel *channel, const struct iovec *iov, int iovcnt);
+    // Io_uring transport, send the buffers held and read into a list of buffers, linked in one submission
+
+int fs3_uring_wait(FS3Channel *channel, int timeout);
+    // Io_uring transport, send the buffers held, then wait for bytes to read
+
+int fs3_uring_expect(FS3Channel *channel, int replies);
+    // Io_uring transport, ask for quick acknowledgements with the next send if the socket transport would
+
+int fs3_uring_close(FS3Channel *channel);
+    // Io_uring transport, close the io_uring and then the socket
+
+#endif
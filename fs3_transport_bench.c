@@ -0,0 +1,206 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_transport_bench.c
+//  Description    : This is a benchmark of the transports carrying the driver's
+//                   commands. It writes a file to a controller and reads it
+//                   back, with the commands sent in batches of 1 to 64 (the
+//                   pipeline depth), first with the blocking socket calls and
+//                   then with io_uring, reporting the sectors moved a second
+//                   and the system calls made for each command.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/13/2021
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_driver.h>
+#include <fs3_network.h>
+#include <fs3_transport.h>
+
+// Defines
+#define FS3_TRANSPORT_BENCH_ARGUMENTS "hp:n:c:"
+#define FS3_TRANSPORT_BENCH_SECTORS 4096 // sectors written and read back in each run by default
+#define USAGE \
+    "USAGE: fs3_transport_bench [-h] [-p <port>] [-n <sectors>] [-c <connections>] [<address>]\n" \
+    "\n" \
+    "where:\n" \
+    "    -h - help mode (display this message)\n" \
+    "    -p - set the port of a TCP address\n" \
+    "    -n - set the number of sectors written and read back in each run\n" \
+    "    -c - set the number of connections to the controller\n" \
+    "\n" \
+    "    <address> - address of a running controller: an IP address, unix:<path> or shm:<name> (localhost by default)\n" \
+    "\n" \
+
+//
+// Global Data
+    const uint16_t fs3BenchDepths[] = {1, 4, 16, 64}; // commands sent in a batch in each run
+
+//
+// Functional Prototypes
+
+int bench_transport_run(int uring, uint16_t depth, int sectors); // write a file and read it back once
+double bench_clock(void);                 // seconds on the monotonic clock
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the transport benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+    // Local variables
+    int ch;
+    int sectors = FS3_TRANSPORT_BENCH_SECTORS;
+
+    // Process the command line parameters
+    while((ch = getopt(argc, argv, FS3_TRANSPORT_BENCH_ARGUMENTS)) != -1){
+        switch(ch){
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return(-1);
+
+        case 'p': // Set the network port number
+            if(sscanf(optarg, "%hu", &fs3_network_port) != 1){
+                fprintf(stderr, "Bad port number [%s]\n", optarg);
+                return(-1);
+            }
+            break;
+
+        case 'n': // Set the number of sectors
+            if((sscanf(optarg, "%d", &sectors) != 1) || (sectors <= 0) || (sectors > FS3_MAX_TRACKS * FS3_TRACK_SIZE)){
+                fprintf(stderr, "Bad number of sectors [%s]\n", optarg);
+                return(-1);
+            }
+            break;
+
+        case 'c': // Set the number of connections
+            if((sscanf(optarg, "%hu", &fs3_network_connections) != 1) || (fs3_network_connections == 0)){
+                fprintf(stderr, "Bad number of connections [%s]\n", optarg);
+                return(-1);
+            }
+            break;
+
+        default:  // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return(-1);
+        }
+    }
+    if(optind < argc){
+        fs3_network_address = (unsigned char *)argv[optind];
+    }
+
+    // Setup the log as needed
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    enableLogLevels(LOG_ERROR_LEVEL);
+
+    // runs every batch size with the socket calls, then with io_uring
+    printf("%-8s %6s %14s %14s %14s\n", "calls", "batch", "writes/s", "reads/s", "syscalls/cmd");
+    int uring, i;
+    for(uring = 0; uring <= 1; uring++){
+        for(i = 0; i < (int)(sizeof(fs3BenchDepths) / sizeof(fs3BenchDepths[0])); i++){
+            if(bench_transport_run(uring, fs3BenchDepths[i], sectors) == -1){
+                return(-1);
+            }
+        }
+        if((uring == 1) && (fs3_uring_unavailable == 1)){
+            printf("io_uring is not available, so its runs used the socket calls\n");
+        }
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_transport_run
+// Description  : Mounts the disk, writes a file of a number of sectors, reads it
+//                back and checks it, then unmounts, with commands sent in batches
+//                of a number, and reports the rates and system calls of the run
+//
+// Inputs       : uring - 1 to carry the connections with io_uring
+//                depth - commands sent before their replies are read
+//                sectors - number of sectors written and read back
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_transport_run(int uring, uint16_t depth, int sectors) {
+    size_t size = (size_t)sectors * FS3_SECTOR_SIZE;
+    uint8_t *written = malloc(size);
+    uint8_t *read = malloc(size);
+    if((written == NULL) || (read == NULL)){
+        free(written);
+        free(read);
+        return(-1);
+    }
+    size_t i;
+    for(i = 0; i < size; i++){
+        written[i] = (uint8_t)rand();
+    }
+
+    fs3_transport_uring = uring;
+    fs3_network_pipeline_depth = depth;
+    if(fs3_mount_disk() == -1){
+        fprintf(stderr, "Failed mounting the disk\n");
+        free(written);
+        free(read);
+        return(-1);
+    }
+
+    // writes the file, then reads it back, counting the system calls and commands of both
+    int16_t fd = fs3_open("fs3_transport_bench");
+    uint64_t syscalls = fs3_network_syscalls;
+    uint64_t commands = fs3_network_round_trips;
+    double start = bench_clock();
+    int32_t writeCount = fs3_write(fd, written, (int32_t)size);
+    double writeEnd = bench_clock();
+    int32_t readCount = fs3_pread(fd, read, (int32_t)size, 0);
+    double readEnd = bench_clock();
+    syscalls = fs3_network_syscalls - syscalls;
+    commands = fs3_network_round_trips - commands;
+    fs3_close(fd);
+    fs3_unmount_disk();
+
+    int result = 0;
+    if((writeCount != (int32_t)size) || (readCount != (int32_t)size) || (memcmp(written, read, size) != 0)){
+        fprintf(stderr, "The file read back was not the file written (batch %u)\n", depth);
+        result = -1;
+    } else {
+        printf("%-8s %6u %14.0f %14.0f %14.3f\n", (uring == 1) ? "io_uring" : "sockets", depth,
+            sectors / (writeEnd - start), sectors / (readEnd - writeEnd), (double)syscalls / (double)commands);
+    }
+    free(written);
+    free(read);
+
+    return(result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_clock
+// Description  : Reads the monotonic clock
+//
+// Inputs       : none
+// Outputs      : seconds on the monotonic clock
+
+double bench_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return(now.tv_sec + (now.tv_nsec * 1e-9));
+}
@@ -0,0 +1,615 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_transport_shm.c
+//  Description    : This is the implementation of the shared memory transport
+//                   of the FS3 protocol, for a controller on the same host. The
+//                   controller creates a shared memory object of connection
+//                   slots, each a pair of single producer, single consumer byte
+//                   rings. A client claims a free slot and the controller
+//                   accepts it. Bytes are copied straight into and out of the
+//                   rings, and the reader and writer only make a system call
+//                   (a futex) when one of them has run out of bytes or room and
+//                   spun long enough to go to sleep.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/13/2021
+//
+
+// Includes
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Project Includes
+#include <fs3_transport.h>
+#include <fs3_network.h>
+
+// Defines
+#define FS3_SHM_RING_MASK (FS3_SHM_RING_SIZE - 1) // position of a byte count in a ring
+#if defined(__x86_64__) || defined(__i386__)
+#define FS3_SHM_PAUSE() __builtin_ia32_pause() // lets the other hyperthread run while spinning
+#else
+#define FS3_SHM_PAUSE() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+// Global Variables
+    int fs3_shm_spins = -1; // times a ring is checked before sleeping on it, -1 until worked out
+
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_connect
+// Description  : Shared memory transport, claim a free slot of the controller's
+//                shared memory object, then wait for the controller to accept it
+//
+// Inputs       : channel - the channel to connect
+//                target - the name of the shared memory object
+//                port - not used
+//                bufferSize - not used, the rings are always FS3_SHM_RING_SIZE
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_shm_connect(FS3Channel *channel, const char *target, uint16_t port, int bufferSize) {
+    (void)port;        // a shared memory object has no port
+    (void)bufferSize;  // its rings are the size the controller made them
+
+    // maps the controller's object, checking that it is one and is being served
+    FS3ShmArea *area = fs3_shm_map(target, 0);
+    if(area == NULL){
+        return(-1);
+    }
+    channel->area = area;
+    if((area->magic != FS3_SHM_MAGIC) || (fs3_shm_process_alive(area->serverPid) == 0)){
+        fs3_shm_unmap(area);
+        channel->area = NULL;
+        return(-1);
+    }
+
+    // claims the first free slot, setting up its rings before the controller can see it
+    FS3ShmSlot *slot = NULL;
+    int i;
+    for(i = 0; (i < FS3_SHM_SLOTS) && (slot == NULL); i++){
+        uint32_t expected = FS3_SHM_SLOT_FREE;
+        if(atomic_compare_exchange_strong(&area->slots[i].state, &expected, FS3_SHM_SLOT_CLAIMING)){
+            slot = &area->slots[i];
+        }
+    }
+    if(slot == NULL){
+        fs3_shm_unmap(area);
+        channel->area = NULL;
+        return(-1);
+    }
+    fs3_shm_ring_init(&slot->toServer);
+    fs3_shm_ring_init(&slot->toClient);
+    atomic_store(&slot->closedEnds, 0);
+    atomic_store(&slot->clientPid, (int32_t)getpid());
+    channel->slot = slot;
+    channel->sendRing = &slot->toServer;
+    channel->receiveRing = &slot->toClient;
+
+    // tells the controller the slot is claimed, then waits for it to be accepted
+    atomic_store(&slot->state, FS3_SHM_SLOT_CLAIMED);
+    atomic_fetch_add(&area->connectSignal, 1);
+    fs3_shm_futex_wake(&area->connectSignal, INT_MAX);
+
+    int waited = 0;
+    while((atomic_load(&slot->state) == FS3_SHM_SLOT_CLAIMED) && (waited < FS3_SHM_ACCEPT_MSECS)){
+        fs3_shm_futex_wait(&slot->state, FS3_SHM_SLOT_CLAIMED, FS3_SHM_WAIT_MSECS);
+        waited = waited + FS3_SHM_WAIT_MSECS;
+    }
+
+    // gives the slot back if the controller never accepted it
+    uint32_t expected = FS3_SHM_SLOT_CLAIMED;
+    if(atomic_compare_exchange_strong(&slot->state, &expected, FS3_SHM_SLOT_FREE)){
+        fs3_shm_unmap(area);
+        fs3_channel_init(channel);
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_listen
+// Description  : Shared memory transport, create the shared memory object clients
+//                claim slots of, replacing one left by a controller that exited
+//
+// Inputs       : listener - the channel clients are accepted from
+//                target - the name of the shared memory object
+//                port - not used
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_shm_listen(FS3Channel *listener, const char *target, uint16_t port) {
+    (void)port;  // a shared memory object has no port
+
+    FS3ShmArea *area = fs3_shm_map(target, 1);
+    if(area == NULL){
+        return(-1);
+    }
+
+    // leaves an object another controller is serving alone
+    if((area->magic == FS3_SHM_MAGIC) && (area->serverPid != getpid()) && (fs3_shm_process_alive(area->serverPid) == 1)){
+        fs3_shm_unmap(area);
+        return(-1);
+    }
+
+    // empties every slot, then marks the object as served
+    memset(area, 0, sizeof(FS3ShmArea));
+    atomic_store(&area->serverPid, (int32_t)getpid());
+    area->magic = FS3_SHM_MAGIC;
+
+    listener->area = area;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_accept
+// Description  : Shared memory transport, take the next slot claimed by a client,
+//                sleeping until one is
+//
+// Inputs       : listener - the channel clients are accepted from
+//                channel - the channel of the client
+// Outputs      : 0 if successful
+
+int fs3_shm_accept(FS3Channel *listener, FS3Channel *channel) {
+    FS3ShmArea *area = listener->area;
+
+    while(1){
+        // reads the signal before looking, so a claim made after the look wakes the sleep
+        uint32_t signal = atomic_load(&area->connectSignal);
+
+        int i;
+        for(i = 0; i < FS3_SHM_SLOTS; i++){
+            FS3ShmSlot *slot = &area->slots[i];
+            uint32_t expected = FS3_SHM_SLOT_CLAIMED;
+            if(atomic_compare_exchange_strong(&slot->state, &expected, FS3_SHM_SLOT_OPEN)){
+                fs3_shm_futex_wake(&slot->state, INT_MAX);
+
+                fs3_channel_init(channel);
+                channel->transport = listener->transport;
+                channel->area = area;
+                channel->slot = slot;
+                channel->sendRing = &slot->toClient;
+                channel->receiveRing = &slot->toServer;
+                channel->server = 1;
+                return(0);
+            }
+        }
+
+        fs3_shm_futex_wait(&area->connectSignal, signal, -1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_writev
+// Description  : Shared memory transport, copy as much of a list of buffers into
+//                the ring to the peer as it has room for, waiting for room if it
+//                is full
+//
+// Inputs       : channel - the channel
+//                iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : bytes written, -1 if the peer closed its end or went away
+
+ssize_t fs3_shm_writev(FS3Channel *channel, const struct iovec *iov, int iovcnt) {
+    FS3ShmRing *ring = channel->sendRing;
+
+    // waits for room, which the reader makes as it takes bytes out
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t room;
+    while((room = FS3_SHM_RING_SIZE - (tail - atomic_load_explicit(&ring->head, memory_order_acquire))) == 0){
+        if((atomic_load(&channel->receiveRing->closed) == 1) || (fs3_shm_ring_wait(channel, ring, 0, -1) == -1)){
+            errno = EPIPE;
+            return(-1);
+        }
+    }
+
+    // copies the buffers in at the tail, wrapping around the end of the ring
+    size_t written = 0;
+    int i;
+    for(i = 0; (i < iovcnt) && (room > 0); i++){
+        size_t length = iov[i].iov_len;
+        if(length > room){
+            length = room;
+        }
+        fs3_shm_ring_copy(ring->data, (tail + written) & FS3_SHM_RING_MASK, iov[i].iov_base, length, 1);
+        written = written + length;
+        room = room - length;
+    }
+
+    // publishes the bytes, then wakes the reader if it is asleep
+    atomic_store(&ring->tail, tail + written);
+    fs3_shm_ring_wake(&ring->dataSignal, &ring->readerWaiting);
+
+    return((ssize_t)written);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_readv
+// Description  : Shared memory transport, copy as many bytes as have arrived in
+//                the ring from the peer into a list of buffers, waiting for some
+//                if it is empty
+//
+// Inputs       : channel - the channel
+//                iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : bytes read, 0 if the peer closed its end, -1 if it went away
+
+ssize_t fs3_shm_readv(FS3Channel *channel, const struct iovec *iov, int iovcnt) {
+    FS3ShmRing *ring = channel->receiveRing;
+
+    // waits for bytes, checking for the end only once the ring is empty, as the writer closes
+    //  its end after its last bytes
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t available;
+    while((available = atomic_load_explicit(&ring->tail, memory_order_acquire) - head) == 0){
+        if(atomic_load(&ring->closed) == 1){
+            if(atomic_load(&ring->tail) == head){
+                return(0);
+            }
+            continue;
+        }
+        if(fs3_shm_ring_wait(channel, ring, 1, -1) == -1){
+            errno = ECONNRESET;
+            return(-1);
+        }
+    }
+
+    // copies the bytes out from the head, wrapping around the end of the ring
+    size_t got = 0;
+    int i;
+    for(i = 0; (i < iovcnt) && (available > 0); i++){
+        size_t length = iov[i].iov_len;
+        if(length > available){
+            length = available;
+        }
+        fs3_shm_ring_copy(ring->data, (head + got) & FS3_SHM_RING_MASK, iov[i].iov_base, length, 0);
+        got = got + length;
+        available = available - length;
+    }
+
+    // hands the room back, then wakes the writer if it is asleep
+    atomic_store(&ring->head, head + got);
+    fs3_shm_ring_wake(&ring->spaceSignal, &ring->writerWaiting);
+
+    return((ssize_t)got);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_wait
+// Description  : Shared memory transport, wait for bytes in the ring from the peer
+//
+// Inputs       : channel - the channel
+//                timeout - most milliseconds to wait, -1 for no limit
+// Outputs      : 1 if there are bytes to read, 0 if the timeout passed, -1 if the peer went away
+
+int fs3_shm_wait(FS3Channel *channel, int timeout) {
+    return(fs3_shm_ring_wait(channel, channel->receiveRing, 1, timeout));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_close
+// Description  : Shared memory transport, close this end of the connection. The
+//                slot is freed by the second end to close, or by the first if the
+//                other's process is gone
+//
+// Inputs       : channel - the channel
+// Outputs      : 0 if successful
+
+int fs3_shm_close(FS3Channel *channel) {
+    FS3ShmSlot *slot = channel->slot;
+
+    // tells the peer no more bytes are coming, waking it if it is waiting for them
+    atomic_store(&channel->sendRing->closed, 1);
+    atomic_fetch_add(&channel->sendRing->dataSignal, 1);
+    fs3_shm_futex_wake(&channel->sendRing->dataSignal, INT_MAX);
+
+    if((atomic_fetch_add(&slot->closedEnds, 1) == 1) || (fs3_shm_peer_alive(channel) == 0)){
+        atomic_store(&slot->state, FS3_SHM_SLOT_FREE);
+    }
+
+    // the controller's connections share its mapping of the object, a client has its own
+    if(channel->server == 0){
+        fs3_shm_unmap(channel->area);
+    }
+    fs3_channel_init(channel);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_ring_wait
+// Description  : Wait until a ring has bytes to read, or room to write. It spins
+//                checking first, as the peer is usually about to answer, then
+//                sleeps on the ring's signal, waking now and then to check the
+//                peer still exists. The sleeper marks itself waiting before the
+//                last check, and the peer checks for a sleeper after publishing,
+//                so one of them always sees the other
+//
+// Inputs       : channel - the channel the ring is of
+//                ring - the ring
+//                forData - 1 to wait for bytes to read, 0 for room to write
+//                timeout - most milliseconds to wait, -1 for no limit
+// Outputs      : 1 if ready, 0 if the timeout passed, -1 if the peer went away
+
+int fs3_shm_ring_wait(FS3Channel *channel, FS3ShmRing *ring, int forData, int timeout) {
+    int spinLimit = fs3_shm_spin_limit();
+    int spins;
+    for(spins = 0; spins < spinLimit; spins++){
+        if(fs3_shm_ring_ready(channel, ring, forData) == 1){
+            return(1);
+        }
+        FS3_SHM_PAUSE();
+    }
+
+    _Atomic uint32_t *signal = (forData == 1) ? &ring->dataSignal : &ring->spaceSignal;
+    _Atomic uint32_t *waiting = (forData == 1) ? &ring->readerWaiting : &ring->writerWaiting;
+    int waited = 0;
+    while(1){
+        uint32_t seen = atomic_load(signal);
+        atomic_store(waiting, 1);
+        if(fs3_shm_ring_ready(channel, ring, forData) == 1){
+            atomic_store(waiting, 0);
+            return(1);
+        }
+
+        // sleeps until woken, or the time to check on the peer or give up comes
+        int sleep = FS3_SHM_WAIT_MSECS;
+        if((timeout >= 0) && (timeout - waited < sleep)){
+            sleep = timeout - waited;
+        }
+        fs3_shm_futex_wait(signal, seen, sleep);
+        atomic_store(waiting, 0);
+        waited = waited + sleep;
+
+        if(fs3_shm_ring_ready(channel, ring, forData) == 1){
+            return(1);
+        }
+        if(fs3_shm_peer_alive(channel) == 0){
+            return(-1);
+        }
+        if((timeout >= 0) && (waited >= timeout)){
+            return(0);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_spin_limit
+// Description  : Work out how many times a ring is checked before sleeping on it.
+//                With a single processor the peer cannot run while this end
+//                spins, so it goes straight to sleep instead
+//
+// Inputs       : none
+// Outputs      : the number of checks
+
+int fs3_shm_spin_limit(void) {
+    if(fs3_shm_spins == -1){
+        fs3_shm_spins = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? FS3_SHM_SPIN_LIMIT : 0;
+    }
+
+    return(fs3_shm_spins);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_ring_ready
+// Description  : Check if a ring has bytes to read, or room to write. The end of
+//                the connection counts as ready, so the caller sees it
+//
+// Inputs       : channel - the channel the ring is of
+//                ring - the ring
+//                forData - 1 to check for bytes to read, 0 for room to write
+// Outputs      : 1 if ready, 0 if not
+
+int fs3_shm_ring_ready(FS3Channel *channel, FS3ShmRing *ring, int forData) {
+    uint64_t used = atomic_load(&ring->tail) - atomic_load(&ring->head);
+    if(forData == 1){
+        return(((used > 0) || (atomic_load(&ring->closed) == 1)) ? 1 : 0);
+    }
+
+    return(((used < FS3_SHM_RING_SIZE) || (atomic_load(&channel->receiveRing->closed) == 1)) ? 1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_ring_wake
+// Description  : Wake the peer sleeping on a ring, if it is. Nothing is done
+//                while the peer is spinning, so a busy pipeline makes no system
+//                calls at all
+//
+// Inputs       : signal - the signal the peer sleeps on
+//                waiting - set while the peer sleeps
+// Outputs      : 0 if successful
+
+int fs3_shm_ring_wake(_Atomic uint32_t *signal, _Atomic uint32_t *waiting) {
+    if(atomic_load(waiting) == 1){
+        atomic_fetch_add(signal, 1);
+        fs3_shm_futex_wake(signal, 1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_ring_init
+// Description  : Empty a ring and open its writer's end
+//
+// Inputs       : ring - the ring
+// Outputs      : 0 if successful
+
+int fs3_shm_ring_init(FS3ShmRing *ring) {
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->readerWaiting, 0);
+    atomic_store(&ring->writerWaiting, 0);
+    atomic_store(&ring->closed, 0);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_ring_copy
+// Description  : Copy bytes into or out of a ring's data, wrapping around its end
+//
+// Inputs       : data - the ring's data
+//                position - where in the data the bytes start
+//                buf - the bytes outside the ring
+//                length - number of bytes
+//                into - 1 to copy into the ring, 0 to copy out of it
+// Outputs      : 0 if successful
+
+int fs3_shm_ring_copy(uint8_t *data, uint64_t position, void *buf, size_t length, int into) {
+    size_t first = FS3_SHM_RING_SIZE - position;
+    if(first > length){
+        first = length;
+    }
+
+    if(into == 1){
+        memcpy(data + position, buf, first);
+        memcpy(data, (uint8_t *)buf + first, length - first);
+    } else {
+        memcpy(buf, data + position, first);
+        memcpy((uint8_t *)buf + first, data, length - first);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_peer_alive
+// Description  : Check that the process at the other end of a shared memory
+//                connection still exists
+//
+// Inputs       : channel - the channel
+// Outputs      : 1 if it exists, 0 if not
+
+int fs3_shm_peer_alive(FS3Channel *channel) {
+    if(channel->server == 1){
+        return(fs3_shm_process_alive(atomic_load(&channel->slot->clientPid)));
+    }
+
+    return(fs3_shm_process_alive(atomic_load(&channel->area->serverPid)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_process_alive
+// Description  : Check that a process exists
+//
+// Inputs       : pid - the process
+// Outputs      : 1 if it exists, 0 if not
+
+int fs3_shm_process_alive(int32_t pid) {
+    if(pid <= 0){
+        return(0);
+    }
+
+    return(((kill(pid, 0) == 0) || (errno == EPERM)) ? 1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_map
+// Description  : Open a shared memory object and map it
+//
+// Inputs       : name - the name of the object
+//                create - 1 to create the object if it does not exist, 0 to only open it
+// Outputs      : the object mapped, NULL if failure
+
+FS3ShmArea * fs3_shm_map(const char *name, int create) {
+    if((name == NULL) || (name[0] == '\0')){
+        return(NULL);
+    }
+
+    int fd = shm_open(name, O_RDWR | ((create == 1) ? O_CREAT : 0), 0600);
+    if(fd == -1){
+        return(NULL);
+    }
+
+    // a new object is sized to hold the area, an old one must be big enough already
+    struct stat info;
+    if((fstat(fd, &info) == -1) || ((info.st_size < (off_t)sizeof(FS3ShmArea)) &&
+        ((create == 0) || (ftruncate(fd, sizeof(FS3ShmArea)) == -1)))){
+        close(fd);
+        return(NULL);
+    }
+
+    // the mapping keeps the object, so the descriptor is not needed after
+    void *area = mmap(NULL, sizeof(FS3ShmArea), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(area == MAP_FAILED){
+        return(NULL);
+    }
+
+    return(area);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_unmap
+// Description  : Unmap a shared memory object
+//
+// Inputs       : area - the object mapped
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_shm_unmap(FS3ShmArea *area) {
+    return(munmap(area, sizeof(FS3ShmArea)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_futex_wait
+// Description  : Sleep while a word of shared memory holds a value, until woken
+//                or a timeout passes
+//
+// Inputs       : word - the word
+//                value - the value slept on
+//                timeout - most milliseconds to sleep, -1 for no limit
+// Outputs      : 0 if successful
+
+int fs3_shm_futex_wait(_Atomic uint32_t *word, uint32_t value, int timeout) {
+    struct timespec limit;
+    limit.tv_sec = timeout / 1000;
+    limit.tv_nsec = (long)(timeout % 1000) * 1000000;
+
+    fs3_network_syscalls = fs3_network_syscalls + 1;
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, (timeout >= 0) ? &limit : NULL, NULL, 0);
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_shm_futex_wake
+// Description  : Wake processes sleeping on a word of shared memory
+//
+// Inputs       : word - the word
+//                count - most sleepers to wake
+// Outputs      : 0 if successful
+
+int fs3_shm_futex_wake(_Atomic uint32_t *word, int count) {
+    fs3_network_syscalls = fs3_network_syscalls + 1;
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, count, NULL, NULL, 0);
+
+    return(0);
+}
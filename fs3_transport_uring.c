@@ -0,0 +1,666 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_transport_uring.c
+//  Description    : This is the implementation of carrying a socket connection
+//                   of the FS3 protocol with io_uring. A batch of commands
+//                   written is held until its replies are read, then the send,
+//                   the request for quick acknowledgements and the receive are
+//                   submitted linked together, so the whole round trip is one
+//                   system call rather than two or three. The driver's sector
+//                   pool is registered with each ring, and the sectors sent
+//                   from it go without a copy. The kernel's support is checked
+//                   when a connection is made, and a connection stays on the
+//                   plain socket calls without it.
+//
+//  Author         : Christopher Kurcz
+//  Last Modified  : 12/14/2021
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/tcp.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_transport.h>
+#include <fs3_network.h>
+
+// Global Variables
+    int fs3_uring_unavailable = 0; // 1 once io_uring was found missing, and the socket calls used instead
+
+    // transport of a socket connection carried by io_uring, which it moves the connection's bytes with
+    FS3Transport fs3_uring_transport = { "uring", NULL, NULL, NULL, fs3_uring_writev, fs3_uring_readv, fs3_uring_wait, fs3_uring_expect, fs3_uring_push, fs3_uring_close };
+
+    // memory registered with each io_uring, the driver's sector pool, NULL if none
+    struct iovec fs3_uring_region = {NULL, 0};
+
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_attach
+// Description  : Carry a connected socket with an io_uring of its own. If the
+//                kernel has no io_uring, or one that cannot send and receive
+//                socket messages, this is logged once and the connection stays
+//                on the socket calls
+//
+// Inputs       : channel - the channel, connected over a socket transport
+// Outputs      : 0 if successful, -1 if the socket calls are used instead
+
+int fs3_uring_attach(FS3Channel *channel) {
+    if(fs3_uring_unavailable == 1){
+        return(-1);
+    }
+
+    FS3Uring *uring = calloc(1, sizeof(FS3Uring));
+    if(uring == NULL){
+        return(-1);
+    }
+    uring->fd = -1;
+
+    if((fs3_uring_setup(uring, channel->fd) == -1) || (fs3_uring_probe(uring) != 1)){
+        logMessage(LOG_WARNING_LEVEL, "io_uring is not available (%s), using socket calls", strerror(errno));
+        fs3_uring_unavailable = 1;
+        fs3_uring_release(uring);
+        free(uring);
+        return(-1);
+    }
+    uring->quickAckRing = 1;
+    uring->quickAckValue = 1;
+    fs3_uring_register_buffers(uring);
+
+    channel->uring = uring;
+    channel->base = channel->transport;
+    channel->transport = &fs3_uring_transport;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_setup
+// Description  : Create an io_uring and map its queues, then register the
+//                socket with it so the kernel does not look the descriptor up
+//                for every operation
+//
+// Inputs       : uring - the io_uring, zeroed
+//                socketFd - the socket it carries
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_uring_setup(FS3Uring *uring, int socketFd) {
+    // has the kernel run the completion work when the ring is next entered, rather than
+    //  interrupting this end for it, if it knows how
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    uring->fd = (int)syscall(__NR_io_uring_setup, FS3_URING_ENTRIES, &params);
+    if((uring->fd == -1) && (errno == EINVAL)){
+        memset(&params, 0, sizeof(params));
+        uring->fd = (int)syscall(__NR_io_uring_setup, FS3_URING_ENTRIES, &params);
+    }
+    if(uring->fd == -1){
+        return(-1);
+    }
+
+    // maps the queues, in one mapping if the kernel shares it between them
+    uring->sqRingSize = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+    uring->cqRingSize = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(uring->cqRingSize > uring->sqRingSize){
+            uring->sqRingSize = uring->cqRingSize;
+        }
+        uring->cqRingSize = 0;
+    }
+    uring->sqRing = mmap(NULL, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    if(uring->sqRing == MAP_FAILED){
+        uring->sqRing = NULL;
+        return(-1);
+    }
+    uring->cqRing = uring->sqRing;
+    if(uring->cqRingSize > 0){
+        uring->cqRing = mmap(NULL, uring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+        if(uring->cqRing == MAP_FAILED){
+            uring->cqRing = NULL;
+            return(-1);
+        }
+    }
+    uring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+    if(uring->sqes == MAP_FAILED){
+        uring->sqes = NULL;
+        return(-1);
+    }
+
+    uint8_t *sq = uring->sqRing;
+    uint8_t *cq = uring->cqRing;
+    uring->sqTail = (_Atomic uint32_t *)(sq + params.sq_off.tail);
+    uring->sqArray = (uint32_t *)(sq + params.sq_off.array);
+    uring->sqMask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    uring->cqHead = (_Atomic uint32_t *)(cq + params.cq_off.head);
+    uring->cqTail = (_Atomic uint32_t *)(cq + params.cq_off.tail);
+    uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    uring->cqMask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+
+    // registers the socket, using it by its descriptor if that fails
+    uring->fixedFile = (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_FILES, &socketFd, 1) == 0) ? 1 : 0;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_probe
+// Description  : Check the io_uring can send and receive socket messages, which
+//                kernels older than 5.3 cannot, and if it can send from registered
+//                buffers without a copy, which kernels older than 6.0 cannot
+//
+// Inputs       : uring - the io_uring
+// Outputs      : 1 if it can, 0 if not
+
+int fs3_uring_probe(FS3Uring *uring) {
+    size_t size = sizeof(struct io_uring_probe) + (256 * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe *probe = calloc(1, size);
+    if(probe == NULL){
+        return(0);
+    }
+
+    int supported = 0;
+    if(syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PROBE, probe, 256) == 0){
+        supported = ((probe->last_op >= IORING_OP_RECVMSG) &&
+            (probe->ops[IORING_OP_SENDMSG].flags & IO_URING_OP_SUPPORTED) &&
+            (probe->ops[IORING_OP_RECVMSG].flags & IO_URING_OP_SUPPORTED)) ? 1 : 0;
+        uring->zeroCopy = ((probe->last_op >= IORING_OP_SEND_ZC) &&
+            (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED)) ? 1 : 0;
+    }
+    if(supported == 0){
+        errno = EOPNOTSUPP;
+    }
+    free(probe);
+
+    return(supported);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_register_buffers
+// Description  : Register the sector pool with an io_uring, so the kernel pins
+//                its pages once rather than for every send, and the sectors in
+//                it are sent from it without being copied. Without a pool, or a
+//                ring that can send without a copy, every send copies as before
+//
+// Inputs       : uring - the io_uring
+// Outputs      : 0 if successful, -1 if the pool is not registered
+
+int fs3_uring_register_buffers(FS3Uring *uring) {
+    uring->fixedBuffers = 0;
+    if((fs3_uring_region.iov_base == NULL) || (uring->zeroCopy == 0)){
+        return(-1);
+    }
+    if(syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS, &fs3_uring_region, 1) != 0){
+        return(-1);
+    }
+    uring->fixedBuffers = 1;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_release
+// Description  : Unmap an io_uring's queues and close it
+//
+// Inputs       : uring - the io_uring
+// Outputs      : 0 if successful
+
+int fs3_uring_release(FS3Uring *uring) {
+    if(uring->sqes != NULL){
+        munmap(uring->sqes, uring->sqesSize);
+    }
+    if((uring->cqRing != NULL) && (uring->cqRing != uring->sqRing)){
+        munmap(uring->cqRing, uring->cqRingSize);
+    }
+    if(uring->sqRing != NULL){
+        munmap(uring->sqRing, uring->sqRingSize);
+    }
+    if(uring->fd != -1){
+        close(uring->fd);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_get_sqe
+// Description  : Take the next submission queue entry for an operation on the
+//                channel's socket, cleared. Only this end adds entries, and the
+//                queue is emptied by each submission, so there is always room
+//
+// Inputs       : channel - the channel
+//                opcode - the operation
+//                flags - IOSQE_* flags of the entry
+//                userData - FS3_URING_* number its result is stored by
+// Outputs      : the entry
+
+struct io_uring_sqe * fs3_uring_get_sqe(FS3Channel *channel, uint8_t opcode, uint8_t flags, uint64_t userData) {
+    FS3Uring *uring = channel->uring;
+    uint32_t tail = atomic_load_explicit(uring->sqTail, memory_order_relaxed);
+    uint32_t index = tail & uring->sqMask;
+
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->flags = flags;
+    sqe->fd = (uring->fixedFile == 1) ? 0 : channel->fd;
+    if(uring->fixedFile == 1){
+        sqe->flags = sqe->flags | IOSQE_FIXED_FILE;
+    }
+    sqe->user_data = userData;
+
+    // publishes the entry to the kernel
+    uring->sqArray[index] = index;
+    atomic_store_explicit(uring->sqTail, tail + 1, memory_order_release);
+
+    return(sqe);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_complete
+// Description  : Submit the entries queued and wait for a number of completions,
+//                entering the kernel once unless interrupted. A send without a
+//                copy completes twice, the second time once its buffer is no
+//                longer used, which is waited for too
+//
+// Inputs       : uring - the io_uring
+//                submit - entries queued
+//                wanted - completions to wait for
+//                results - the result of each completion, by its user data
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_uring_complete(FS3Uring *uring, int submit, int wanted, int32_t *results) {
+    int done = 0;
+    while(done < wanted){
+        int entered = (int)syscall(__NR_io_uring_enter, uring->fd, submit, wanted - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        fs3_network_syscalls = fs3_network_syscalls + 1;
+        if(entered == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return(-1);
+        }
+        submit = submit - entered;
+
+        // takes the completions made
+        uint32_t head = atomic_load_explicit(uring->cqHead, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(uring->cqTail, memory_order_acquire);
+        while(head != tail){
+            struct io_uring_cqe *cqe = &uring->cqes[head & uring->cqMask];
+            if(((cqe->flags & IORING_CQE_F_NOTIF) == 0) && (cqe->user_data < FS3_URING_OPERATIONS)){
+                results[cqe->user_data] = cqe->res;
+            }
+            if(cqe->flags & IORING_CQE_F_MORE){
+                wanted = wanted + 1;
+            }
+            head = head + 1;
+            done = done + 1;
+        }
+        atomic_store_explicit(uring->cqHead, head, memory_order_release);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_prep_send
+// Description  : Queue the operations sending the batch of commands written,
+//                linked in order, followed by one asking for quick acknowledgements
+//                if they are wanted and the ring can set socket options. The
+//                request runs even if it fails, so a kernel without it does not
+//                stop the receive linked after it
+//
+// Inputs       : channel - the channel
+//                linked - 1 if an operation is linked after these
+// Outputs      : number of operations queued
+
+int fs3_uring_prep_send(FS3Channel *channel, int linked) {
+    FS3Uring *uring = channel->uring;
+    int quickAck = ((uring->quickAck == 1) && (uring->quickAckRing == 1)) ? 1 : 0;
+
+    // sends a sector of the registered pool from it without a copy, and the rest as messages
+    struct io_uring_sqe *sqe;
+    int k;
+    for(k = 0; k < uring->sendCount; k++){
+        uint8_t flags = ((k < uring->sendCount - 1) || (quickAck == 1) || (linked == 1)) ? IOSQE_IO_LINK : 0;
+        if(uring->sendFixed[k] == 1){
+            sqe = fs3_uring_get_sqe(channel, IORING_OP_SEND_ZC, flags, FS3_URING_SEND + k);
+            sqe->addr = (uint64_t)(uintptr_t)uring->sendMessages[k].msg_iov[0].iov_base;
+            sqe->len = (uint32_t)uring->sendMessages[k].msg_iov[0].iov_len;
+            sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = FS3_URING_FIXED_BUFFER;
+        } else {
+            sqe = fs3_uring_get_sqe(channel, IORING_OP_SENDMSG, flags, FS3_URING_SEND + k);
+            sqe->addr = (uint64_t)(uintptr_t)&uring->sendMessages[k];
+            sqe->len = 1;
+        }
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    }
+    if(quickAck == 0){
+        return(uring->sendCount);
+    }
+
+    // the fields of a socket option command, which older kernel headers do not name
+    sqe = fs3_uring_get_sqe(channel, IORING_OP_URING_CMD, (linked == 1) ? IOSQE_IO_HARDLINK : 0, FS3_URING_QUICKACK);
+    sqe->cmd_op = FS3_URING_SETSOCKOPT;
+    uint32_t option[2] = {IPPROTO_TCP, TCP_QUICKACK};
+    memcpy(&sqe->addr, option, sizeof(option));
+    sqe->file_index = sizeof(uring->quickAckValue);
+    sqe->addr3 = (uint64_t)(uintptr_t)&uring->quickAckValue;
+
+    return(uring->sendCount + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_check_send
+// Description  : Check the results of sending a batch of commands. A ring that
+//                could not set the quick acknowledgement option is not asked to
+//                again, the socket transport setting it instead
+//
+// Inputs       : channel - the channel
+//                results - the results of the operations, by user data
+// Outputs      : 0 if successful, -1 if the batch was not all sent
+
+int fs3_uring_check_send(FS3Channel *channel, int32_t *results) {
+    FS3Uring *uring = channel->uring;
+    if((uring->quickAck == 1) && (uring->quickAckRing == 1) && (results[FS3_URING_QUICKACK] < 0)){
+        uring->quickAckRing = 0;
+        channel->base->expect(channel, 2);
+    }
+
+    // adds up the bytes of every send, which are all sent unless one failed
+    uring->sendQueued = 0;
+    size_t sent = 0;
+    int k;
+    for(k = 0; k < uring->sendCount; k++){
+        if(results[FS3_URING_SEND + k] < 0){
+            errno = -results[FS3_URING_SEND + k];
+            return(-1);
+        }
+        sent = sent + (size_t)results[FS3_URING_SEND + k];
+    }
+    if(sent != uring->sendLength){
+        errno = EPIPE;
+        return(-1);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_push
+// Description  : Io_uring transport, send a batch of commands held on its own,
+//                waiting for it to be sent, so its buffers can be changed, then
+//                ask for quick acknowledgements with the socket call if the ring
+//                cannot
+//
+// Inputs       : channel - the channel
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_uring_push(FS3Channel *channel) {
+    FS3Uring *uring = channel->uring;
+    if(uring->sendQueued == 0){
+        return(0);
+    }
+
+    int32_t results[FS3_URING_OPERATIONS] = {0};
+    int count = fs3_uring_prep_send(channel, 0);
+    if((fs3_uring_complete(uring, count, count, results) == -1) || (fs3_uring_check_send(channel, results) == -1)){
+        uring->sendQueued = 0;
+        return(-1);
+    }
+    if((uring->quickAck == 1) && (uring->quickAckRing == 0)){
+        channel->base->expect(channel, 2);
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_writev
+// Description  : Io_uring transport, hold a list of buffers to be sent with the
+//                next read, where the replies to them are read, or when pushed.
+//                A batch still held from before is sent first
+//
+// Inputs       : channel - the channel
+//                iov - the buffers, which must not change until the next read or push
+//                iovcnt - number of buffers
+// Outputs      : bytes held, -1 if failure
+
+ssize_t fs3_uring_writev(FS3Channel *channel, const struct iovec *iov, int iovcnt) {
+    FS3Uring *uring = channel->uring;
+    if(fs3_uring_push(channel) == -1){
+        return(-1);
+    }
+
+    if(iovcnt > FS3_URING_IOVECS){
+        iovcnt = FS3_URING_IOVECS;
+    }
+    memcpy(uring->sendIov, iov, iovcnt * sizeof(struct iovec));
+    fs3_uring_split_send(uring, iovcnt);
+
+    size_t length = 0;
+    int i;
+    for(i = 0; i < iovcnt; i++){
+        length = length + iov[i].iov_len;
+    }
+    uring->sendLength = length;
+    uring->sendQueued = 1;
+
+    return((ssize_t)length);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_split_send
+// Description  : Split a batch of commands between its sends. Each sector of the
+//                registered pool is sent on its own, from the pool, and each run
+//                of buffers between them as a message. A batch with no sector of
+//                the pool, or too many to be sent at once, is one message
+//
+// Inputs       : uring - the io_uring
+//                iovcnt - number of buffers of the batch, in sendIov
+// Outputs      : number of sends
+
+int fs3_uring_split_send(FS3Uring *uring, int iovcnt) {
+    int fixedCount = 0;
+    int i;
+    if(uring->fixedBuffers == 1){
+        for(i = 0; i < iovcnt; i++){
+            fixedCount = fixedCount + fs3_uring_fixed(uring, &uring->sendIov[i]);
+        }
+    }
+
+    uring->sendCount = 0;
+    if((fixedCount == 0) || ((2 * fixedCount) + 1 > FS3_URING_SENDS)){
+        return(fs3_uring_add_send(uring, 0, iovcnt, 0));
+    }
+
+    int first = 0;
+    for(i = 0; i < iovcnt; i++){
+        if(fs3_uring_fixed(uring, &uring->sendIov[i]) == 1){
+            if(i > first){
+                fs3_uring_add_send(uring, first, i - first, 0);
+            }
+            fs3_uring_add_send(uring, i, 1, 1);
+            first = i + 1;
+        }
+    }
+    if(first < iovcnt){
+        fs3_uring_add_send(uring, first, iovcnt - first, 0);
+    }
+
+    return(uring->sendCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_add_send
+// Description  : Add a send of a run of the buffers of a batch of commands
+//
+// Inputs       : uring - the io_uring
+//                first - index of the run's first buffer in sendIov
+//                count - number of buffers in the run
+//                fixed - 1 if the run is one sector of the registered pool
+// Outputs      : number of sends
+
+int fs3_uring_add_send(FS3Uring *uring, int first, int count, int fixed) {
+    struct msghdr *message = &uring->sendMessages[uring->sendCount];
+    memset(message, 0, sizeof(*message));
+    message->msg_iov = &uring->sendIov[first];
+    message->msg_iovlen = count;
+    uring->sendFixed[uring->sendCount] = (uint8_t)fixed;
+    uring->sendCount = uring->sendCount + 1;
+
+    return(uring->sendCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_fixed
+// Description  : Check if a buffer is inside the memory registered with an
+//                io_uring, the sector pool
+//
+// Inputs       : uring - the io_uring
+//                iov - the buffer
+// Outputs      : 1 if it is, 0 if not
+
+int fs3_uring_fixed(FS3Uring *uring, const struct iovec *iov) {
+    uint8_t *start = fs3_uring_region.iov_base;
+    uint8_t *buf = iov->iov_base;
+    if((uring->fixedBuffers == 0) || (start == NULL)){
+        return(0);
+    }
+
+    return(((buf >= start) && (buf + iov->iov_len <= start + fs3_uring_region.iov_len)) ? 1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_readv
+// Description  : Io_uring transport, read what has arrived into a list of
+//                buffers. A batch of commands held is sent first, linked ahead
+//                of the receive in the same submission, so one system call sends
+//                the batch and waits for its replies
+//
+// Inputs       : channel - the channel
+//                iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : bytes read, 0 if the peer closed the connection, -1 if failure
+
+ssize_t fs3_uring_readv(FS3Channel *channel, const struct iovec *iov, int iovcnt) {
+    FS3Uring *uring = channel->uring;
+    int32_t results[FS3_URING_OPERATIONS] = {0};
+
+    // without the ring setting the option, the batch is sent on its own so it can be set after
+    if((uring->quickAck == 1) && (uring->quickAckRing == 0) && (fs3_uring_push(channel) == -1)){
+        return(-1);
+    }
+
+    int count = 0;
+    int sending = uring->sendQueued;
+    if(sending == 1){
+        count = fs3_uring_prep_send(channel, 1);
+    }
+
+    if(iovcnt > FS3_URING_IOVECS){
+        iovcnt = FS3_URING_IOVECS;
+    }
+    memcpy(uring->receiveIov, iov, iovcnt * sizeof(struct iovec));
+    memset(&uring->receiveMessage, 0, sizeof(uring->receiveMessage));
+    uring->receiveMessage.msg_iov = uring->receiveIov;
+    uring->receiveMessage.msg_iovlen = iovcnt;
+    struct io_uring_sqe *sqe = fs3_uring_get_sqe(channel, IORING_OP_RECVMSG, 0, FS3_URING_RECEIVE);
+    sqe->addr = (uint64_t)(uintptr_t)&uring->receiveMessage;
+    sqe->len = 1;
+    count = count + 1;
+
+    if(fs3_uring_complete(uring, count, count, results) == -1){
+        uring->sendQueued = 0;
+        return(-1);
+    }
+    if((sending == 1) && (fs3_uring_check_send(channel, results) == -1)){
+        return(-1);
+    }
+    if(results[FS3_URING_RECEIVE] < 0){
+        errno = -results[FS3_URING_RECEIVE];
+        return(-1);
+    }
+
+    return((ssize_t)results[FS3_URING_RECEIVE]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_wait
+// Description  : Io_uring transport, send a batch of commands held, then wait for
+//                bytes to read with the socket transport
+//
+// Inputs       : channel - the channel
+//                timeout - most milliseconds to wait, -1 for no limit
+// Outputs      : 1 if there are bytes to read, 0 if the timeout passed, -1 if failure
+
+int fs3_uring_wait(FS3Channel *channel, int timeout) {
+    if(fs3_uring_push(channel) == -1){
+        return(-1);
+    }
+
+    return(channel->base->wait(channel, timeout));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_expect
+// Description  : Io_uring transport, with more than one reply owed, asks for
+//                quick acknowledgements when the batch is sent, if the socket
+//                transport under the ring would (TCP does, as the server holds
+//                back small replies until the one before is acknowledged)
+//
+// Inputs       : channel - the channel
+//                replies - number of replies owed
+// Outputs      : 0 if successful
+
+int fs3_uring_expect(FS3Channel *channel, int replies) {
+    channel->uring->quickAck = ((channel->base->expect != NULL) && (replies > 1)) ? 1 : 0;
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_uring_close
+// Description  : Io_uring transport, close the io_uring, dropping any batch not
+//                sent, and then the socket
+//
+// Inputs       : channel - the channel
+// Outputs      : 0 if successful
+
+int fs3_uring_close(FS3Channel *channel) {
+    const FS3Transport *base = channel->base;
+
+    fs3_uring_release(channel->uring);
+    free(channel->uring);
+    channel->uring = NULL;
+    channel->base = NULL;
+    channel->transport = base;
+
+    return(base->close(channel));
+}